@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <sys/mman.h>
+
+namespace plugin::anomalydetection::num
+{
+
+static constexpr size_t CACHE_LINE_SIZE = 64;
+static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/*
+Zero-initialized, cache line aligned and contiguous storage for the probabilistic data structures.
+Large buffers can optionally be backed by transparent huge pages to reduce TLB misses on random probes.
+*/
+template<typename T>
+class aligned_buffer
+{
+private:
+    T* data_ = nullptr;
+    size_t size_ = 0; // number of T elements
+    size_t alloc_bytes_ = 0;
+    bool mmapped_ = false;
+
+    static size_t round_up(size_t n, size_t multiple)
+    {
+        return ((n + multiple - 1) / multiple) * multiple;
+    }
+
+    void allocate(size_t size, bool huge_pages)
+    {
+        size_ = size;
+        alloc_bytes_ = round_up(size * sizeof(T), CACHE_LINE_SIZE);
+        if (alloc_bytes_ == 0)
+        {
+            return;
+        }
+        if (huge_pages && alloc_bytes_ >= HUGE_PAGE_SIZE)
+        {
+            size_t bytes = round_up(alloc_bytes_, HUGE_PAGE_SIZE);
+            void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED)
+            {
+#ifdef MADV_HUGEPAGE
+                madvise(p, bytes, MADV_HUGEPAGE); // best effort, anonymous mappings are already zeroed
+#endif
+                alloc_bytes_ = bytes;
+                mmapped_ = true;
+                data_ = static_cast<T*>(p);
+                return;
+            }
+        }
+        void* p = std::aligned_alloc(CACHE_LINE_SIZE, alloc_bytes_);
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        std::memset(p, 0, alloc_bytes_);
+        data_ = static_cast<T*>(p);
+    }
+
+    void release()
+    {
+        if (data_ == nullptr)
+        {
+            return;
+        }
+        if (mmapped_)
+        {
+            munmap(data_, alloc_bytes_);
+        } else
+        {
+            std::free(data_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+        alloc_bytes_ = 0;
+        mmapped_ = false;
+    }
+
+public:
+    aligned_buffer() = default;
+
+    aligned_buffer(size_t size, bool huge_pages = false)
+    {
+        allocate(size, huge_pages);
+    }
+
+    ~aligned_buffer()
+    {
+        release();
+    }
+
+    aligned_buffer(const aligned_buffer& other)
+    {
+        allocate(other.size_, other.mmapped_);
+        if (size_ > 0)
+        {
+            std::memcpy(data_, other.data_, size_ * sizeof(T));
+        }
+    }
+
+    aligned_buffer& operator=(const aligned_buffer& other)
+    {
+        if (this != &other)
+        {
+            aligned_buffer tmp(other);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    aligned_buffer(aligned_buffer&& other) noexcept
+    {
+        swap(other);
+    }
+
+    aligned_buffer& operator=(aligned_buffer&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            swap(other);
+        }
+        return *this;
+    }
+
+    void swap(aligned_buffer& other) noexcept
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(alloc_bytes_, other.alloc_bytes_);
+        std::swap(mmapped_, other.mmapped_);
+    }
+
+    void clear()
+    {
+        if (data_ != nullptr)
+        {
+            std::memset(static_cast<void*>(data_), 0, size_ * sizeof(T));
+        }
+    }
+
+    T* data() { return data_; }
+
+    const T* data() const { return data_; }
+
+    T& operator[](size_t i) { return data_[i]; }
+
+    const T& operator[](size_t i) const { return data_[i]; }
+
+    size_t size() const { return size_; }
+
+    size_t get_size_bytes() const { return alloc_bytes_; }
+
+    bool is_huge_page_backed() const { return mmapped_; }
+};
+
+} // namespace plugin::anomalydetection::num
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "xxhash_ext.h"
+#include "aligned_buffer.h"
+
+#include <cstdint>
+#include <algorithm>
+
+/*
+Blocked Bloom filter answering "never seen before" in a single cache line probe: each key selects one 64 byte block
+and sets one bit in each of its eight 64-bit words. Putze et al., Cache-, hash- and space-efficient Bloom filters, 2007.
+No false negatives, so a negative answer can short-circuit the d probes of a sketch estimate.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+static constexpr uint32_t BLOOM_BLOCK_WORDS = CACHE_LINE_SIZE / sizeof(uint64_t);
+static constexpr uint32_t BLOOM_BITS_PER_KEY = 16;
+
+class blocked_bloom
+{
+private:
+    aligned_buffer<uint64_t> blocks_;
+    uint64_t n_blocks_;
+
+    const uint64_t* block(const XXH128_hash_t& hash) const
+    {
+        // Multiply-shift range reduction, no modulo on the probe path
+        return &blocks_[static_cast<uint64_t>((static_cast<unsigned __int128>(hash.high64) * n_blocks_) >> 64) * BLOOM_BLOCK_WORDS];
+    }
+
+    // Bit of word i, six bits of the low half each
+    static uint64_t mask(const XXH128_hash_t& hash, uint32_t i)
+    {
+        return uint64_t(1) << ((hash.low64 >> (i * 6)) & 63);
+    }
+
+    static uint64_t blocks_for(uint64_t capacity)
+    {
+        return std::max<uint64_t>(1, (capacity * BLOOM_BITS_PER_KEY + CACHE_LINE_SIZE * 8 - 1) / (CACHE_LINE_SIZE * 8));
+    }
+
+public:
+    // Size the filter for `capacity` distinct keys at `BLOOM_BITS_PER_KEY`
+    explicit blocked_bloom(uint64_t capacity)
+    {
+        n_blocks_ = blocks_for(capacity);
+        blocks_ = aligned_buffer<uint64_t>(n_blocks_ * BLOOM_BLOCK_WORDS);
+    }
+
+    // Words are relaxed atomics like the `cms` counters, concurrent inserts and lookups never block
+    void insert(const XXH128_hash_t& hash)
+    {
+        uint64_t* words = const_cast<uint64_t*>(block(hash));
+        for (uint32_t i = 0; i < BLOOM_BLOCK_WORDS; ++i)
+        {
+            uint64_t m = mask(hash, i);
+            if ((__atomic_load_n(&words[i], __ATOMIC_RELAXED) & m) == 0)
+            {
+                __atomic_fetch_or(&words[i], m, __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    // Return false if `hash` was definitely never inserted since the last clear
+    bool maybe_contains(const XXH128_hash_t& hash) const
+    {
+        const uint64_t* words = block(hash);
+        uint64_t missing = 0;
+        for (uint32_t i = 0; i < BLOOM_BLOCK_WORDS; ++i)
+        {
+            missing |= mask(hash, i) & ~__atomic_load_n(&words[i], __ATOMIC_RELAXED);
+        }
+        return missing == 0;
+    }
+
+    void clear()
+    {
+        for (uint64_t i = 0; i < blocks_.size(); ++i)
+        {
+            __atomic_store_n(&blocks_[i], uint64_t(0), __ATOMIC_RELAXED);
+        }
+    }
+
+    uint64_t get_blocks() const
+    {
+        return n_blocks_;
+    }
+
+    size_t get_size_bytes() const
+    {
+        return blocks_.get_size_bytes();
+    }
+
+    // Size of a filter for `capacity` distinct keys, without allocating it
+    static size_t get_size_bytes(uint64_t capacity)
+    {
+        return blocks_for(capacity) * BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+    }
+};
+
+/*
+Novelty filter of a sketch: must contain every key with a non-zero count, so it follows the forgetting of the sketch.
+A sliding window of k slices only forgets keys slice by slice, hence two filters receive all inserts and the queried
+one is replaced by the other once the other has seen k rotations, i.e. covers every unexpired slice. Waiting k rather
+than k - 1 rotations keeps inserts racing with the clear of the warming filter out of the slices it covers.
+The owning sketch rotates or resets the filter before its counters, see `sketch_impl::reset`.
+*/
+class novelty_filter
+{
+private:
+    blocked_bloom filters_[2];
+    uint32_t active_ = 0; // Index of the queried filter, the other one is warming up
+    uint32_t rotations_ = 0; // Rotations since the warming filter was cleared
+    uint32_t bypass_rotations_ = 0; // Rotations until counts restored from outside the filter have expired
+
+public:
+    explicit novelty_filter(uint64_t capacity) : filters_{blocked_bloom(capacity), blocked_bloom(capacity)} {}
+
+    void insert(const XXH128_hash_t& hash)
+    {
+        filters_[0].insert(hash);
+        filters_[1].insert(hash);
+    }
+
+    // Return false if the sketch count of `hash` is definitely 0
+    bool maybe_seen(const XXH128_hash_t& hash) const
+    {
+        if (__atomic_load_n(&bypass_rotations_, __ATOMIC_RELAXED) > 0)
+        {
+            return true;
+        }
+        return filters_[__atomic_load_n(&active_, __ATOMIC_ACQUIRE)].maybe_contains(hash);
+    }
+
+    // Follow `sketch::rotate` of a sketch with `slices` slices, called by the same single thread
+    void rotate(uint32_t slices)
+    {
+        uint32_t bypass = __atomic_load_n(&bypass_rotations_, __ATOMIC_RELAXED);
+        if (bypass > 0)
+        {
+            __atomic_store_n(&bypass_rotations_, bypass - 1, __ATOMIC_RELAXED);
+        }
+        if (slices <= 1)
+        {
+            // Rotating a plain sketch drops all counts
+            reset();
+            return;
+        }
+        if (++rotations_ >= slices)
+        {
+            uint32_t warming = __atomic_load_n(&active_, __ATOMIC_RELAXED);
+            __atomic_store_n(&active_, warming ^ 1, __ATOMIC_RELEASE);
+            filters_[warming].clear();
+            rotations_ = 0;
+        }
+    }
+
+    void reset()
+    {
+        filters_[0].clear();
+        filters_[1].clear();
+        rotations_ = 0;
+    }
+
+    // Answer "maybe seen" for the next `rotations` rotations, e.g. after counts were restored from a snapshot
+    void bypass(uint32_t rotations)
+    {
+        __atomic_store_n(&bypass_rotations_, rotations, __ATOMIC_RELAXED);
+    }
+
+    size_t get_size_bytes() const
+    {
+        return filters_[0].get_size_bytes() + filters_[1].get_size_bytes();
+    }
+};
+
+} // namespace plugin::anomalydetection::num
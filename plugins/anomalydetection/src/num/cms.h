@@ -18,13 +18,22 @@ limitations under the License.
 #pragma once
 
 #include "xxhash_ext.h"
+#include "aligned_buffer.h"
 
 #include <iostream>
 #include <cstdint>
 #include <cmath>
 #include <vector>
 #include <algorithm>
+#include <limits>
+#include <type_traits>
 #include <memory>
+#include <string_view>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PLUGIN_ANOMALYDETECTION_CMS_AVX2 1
+#include <immintrin.h>
+#endif
 
 /*
 CountMinSketch Powered Probabilistic Counting and Filtering
@@ -34,17 +43,296 @@ Falco Proposal: https://github.com/falcosecurity/falco/blob/master/proposals/202
 namespace plugin::anomalydetection::num
 {
 
+enum class cms_concurrency
+{
+    NONE = 0, // Plain counters, callers must synchronize externally
+    SINGLE_WRITER, // One updating thread, any number of readers and resets; relaxed atomic loads / stores (no locked instructions)
+    MULTI_WRITER, // Any number of updating threads; relaxed atomic read-modify-write
+};
+
+struct cms_options
+{
+    bool pow2_cols = false; // Round w up to the next power of two, Row indices are then derived via a mask instead of a modulo
+    bool huge_pages = false; // Back large sketches with transparent huge pages
+    cms_concurrency concurrency = cms_concurrency::NONE;
+    bool double_buffered = false; // Keep an active and a standby buffer, `reset` clears the standby buffer and swaps it in
+    bool conservative_update = false; // Only raise the counters equal to the current minimum, reduces the overestimation of rare items
+    bool simd = true; // Gather the Row counters of estimates with AVX2 if the CPU supports it (32 and 64 bit counters)
+};
+
+// Occupancy of a sketch, see `cms::get_stats`
+struct cms_stats
+{
+    double fill_ratio = 0; // Fraction of non-zero counters, an unseen key is overestimated with probability ~ fill_ratio^d
+    uint64_t total = 0; // Largest Row sum: the number of counted items, a lower bound with conservative updates or saturated counters
+};
+
+// Rows up to which estimates use fixed-size stack arrays of bucket offsets (gathered / prefetched), larger sketches use the plain loop
+static constexpr uint64_t CMS_BATCH_MAX_ROWS = 16;
+
+// Keys of `update_batch` whose bucket addresses are all prefetched before the first of them is written
+static constexpr size_t CMS_PREFETCH_KEYS = 8;
+
+inline bool cpu_supports_avx2()
+{
+#ifdef PLUGIN_ANOMALYDETECTION_CMS_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+// Counters saturate at their maximum, small counter types (e.g. uint8_t, uint16_t) then still yield a valid upper bound
 template<typename T>
 class cms 
 {
+    static_assert(std::is_unsigned<T>::value, "cms counters must be unsigned integers");
+
 private:
-    std::unique_ptr<std::unique_ptr<T[]>[]> sketch;
+    aligned_buffer<T> sketch; // d Rows of w Cols (x2 if double buffered) in one contiguous allocation, each Row starts on a cache line
     uint64_t d_; // d / Rows / number of hash functions
     uint64_t w_; // w / Cols / number of buckets
+    uint64_t stride_; // Distance between Rows, w padded to a multiple of the cache line size
+    uint64_t w_mask_; // w - 1 if w is a power of two, else 0
     double gamma_; // Error probability (e.g. 0.001)
     double eps_; // Relative error (e.g. 0.0001)
+    cms_concurrency concurrency_;
+    bool conservative_update_;
+    uint64_t n_buffers_; // 2 if double buffered, else 1
+    uint32_t active_ = 0; // Index of the active buffer, swapped atomically
+    bool simd_ = false; // AVX2 estimate path selected at construction via runtime CPU feature detection
+
+    void init_sketch(const cms_options& options)
+    {
+        concurrency_ = options.concurrency;
+        conservative_update_ = options.conservative_update;
+        n_buffers_ = options.double_buffered ? 2 : 1;
+        simd_ = options.simd && (sizeof(T) == 4 || sizeof(T) == 8) && cpu_supports_avx2();
+        if (options.pow2_cols)
+        {
+            uint64_t w = round_w_cols_pow2(w_);
+            if (w != w_)
+            {
+                w_ = w;
+                eps_ = calculate_eps_cols_buckets_from_w(w_);
+            }
+        }
+        w_mask_ = (w_ > 0 && (w_ & (w_ - 1)) == 0) ? w_ - 1 : 0;
+        uint64_t per_line = std::max<uint64_t>(1, CACHE_LINE_SIZE / sizeof(T));
+        stride_ = ((w_ + per_line - 1) / per_line) * per_line;
+        sketch = aligned_buffer<T>(n_buffers_ * d_ * stride_, options.huge_pages); // Init to 0
+    }
+
+    // Resolve the active buffer once per operation so an operation never straddles a swap
+    T* active_buffer()
+    {
+        return sketch.data() + __atomic_load_n(&active_, __ATOMIC_ACQUIRE) * d_ * stride_;
+    }
+
+    const T* active_buffer() const
+    {
+        return sketch.data() + __atomic_load_n(&active_, __ATOMIC_ACQUIRE) * d_ * stride_;
+    }
+
+    void clear_buffer(T* buffer)
+    {
+        if (concurrency_ == cms_concurrency::NONE)
+        {
+            std::fill(buffer, buffer + d_ * stride_, static_cast<T>(0));
+            return;
+        }
+        for (uint64_t i = 0; i < d_ * stride_; ++i)
+        {
+            __atomic_store_n(&buffer[i], static_cast<T>(0), __ATOMIC_RELAXED);
+        }
+    }
+
+    // Counter accessors, concurrent modes never block: readers and the reset may observe slightly stale counts
+    T load_counter(const T* counter) const
+    {
+        if (concurrency_ == cms_concurrency::NONE)
+        {
+            return *counter;
+        }
+        return __atomic_load_n(counter, __ATOMIC_RELAXED);
+    }
+
+    void store_counter(T* counter, T value)
+    {
+        if (concurrency_ == cms_concurrency::NONE)
+        {
+            *counter = value;
+            return;
+        }
+        __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+    }
+
+    T add_counter(T* counter, T count)
+    {
+        switch (concurrency_)
+        {
+        case cms_concurrency::NONE:
+            return *counter = saturating_add(*counter, count);
+        case cms_concurrency::SINGLE_WRITER:
+        {
+            T value = saturating_add(__atomic_load_n(counter, __ATOMIC_RELAXED), count);
+            __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+            return value;
+        }
+        default:
+            if constexpr (sizeof(T) >= sizeof(uint64_t))
+            {
+                return __atomic_add_fetch(counter, count, __ATOMIC_RELAXED); // 64 bit counters practically never saturate
+            } else
+            {
+                T expected = __atomic_load_n(counter, __ATOMIC_RELAXED);
+                T value;
+                do
+                {
+                    value = saturating_add(expected, count);
+                } while (!__atomic_compare_exchange_n(counter, &expected, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+                return value;
+            }
+        }
+    }
+
+    // Raise the counter to at least value, used by the conservative update
+    void raise_counter(T* counter, T value)
+    {
+        if (concurrency_ == cms_concurrency::MULTI_WRITER)
+        {
+            T expected = __atomic_load_n(counter, __ATOMIC_RELAXED);
+            while (expected < value && !__atomic_compare_exchange_n(counter, &expected, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+            }
+            return;
+        }
+        if (load_counter(counter) < value)
+        {
+            store_counter(counter, value);
+        }
+    }
+
+    T update_conservative(T* buffer, const XXH128_hash_t& hash, T count)
+    {
+        // Only the Rows holding the minimum can be exact, raising the other ones would only add overestimation
+        T target = saturating_add(estimate_buffer(buffer, hash), count);
+        for (uint64_t row = 0; row < d_; ++row)
+        {
+            raise_counter(buffer + row * stride_ + get_index(hash, row), target);
+        }
+        return target;
+    }
+
+    // Bucket offsets of all Rows, padded to a multiple of 4 gather lanes by repeating the first Row (the minimum is unaffected)
+    uint64_t get_offsets(const XXH128_hash_t& hash, long long* offsets) const
+    {
+        uint64_t n = (d_ + 3) & ~uint64_t(3);
+        for (uint64_t row = 0; row < d_; ++row)
+        {
+            offsets[row] = row * stride_ + get_index(hash, row);
+        }
+        for (uint64_t row = d_; row < n; ++row)
+        {
+            offsets[row] = offsets[0];
+        }
+        return n;
+    }
+
+#ifdef PLUGIN_ANOMALYDETECTION_CMS_AVX2
+    __attribute__((target("avx2")))
+    static __m256i min_epu64(__m256i a, __m256i b)
+    {
+        // AVX2 has no unsigned 64 bit min, compare with flipped sign bits instead
+        const __m256i sign = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+        __m256i a_gt_b = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+        return _mm256_blendv_epi8(a, b, a_gt_b);
+    }
+
+    // Gathered Row reads and a SIMD horizontal min. The lanes of the gathers are aligned counters of at most 8 bytes,
+    // which x86 reads without tearing, same as the relaxed atomic loads of the scalar path.
+    __attribute__((target("avx2")))
+    T estimate_avx2(const T* buffer, const XXH128_hash_t& hash) const
+    {
+        alignas(32) long long offsets[CMS_BATCH_MAX_ROWS];
+        uint64_t n = get_offsets(hash, offsets);
+        if constexpr (sizeof(T) == 8)
+        {
+            const long long* base = reinterpret_cast<const long long*>(buffer);
+            __m256i min = _mm256_i64gather_epi64(base, _mm256_load_si256(reinterpret_cast<const __m256i*>(offsets)), 8);
+            for (uint64_t i = 4; i < n; i += 4)
+            {
+                min = min_epu64(min, _mm256_i64gather_epi64(base, _mm256_load_si256(reinterpret_cast<const __m256i*>(offsets + i)), 8));
+            }
+            min = min_epu64(min, _mm256_permute4x64_epi64(min, _MM_SHUFFLE(1, 0, 3, 2)));
+            min = min_epu64(min, _mm256_shuffle_epi32(min, _MM_SHUFFLE(1, 0, 3, 2)));
+            return static_cast<T>(_mm_cvtsi128_si64(_mm256_castsi256_si128(min)));
+        } else
+        {
+            const int* base = reinterpret_cast<const int*>(buffer);
+            __m128i min = _mm256_i64gather_epi32(base, _mm256_load_si256(reinterpret_cast<const __m256i*>(offsets)), 4);
+            for (uint64_t i = 4; i < n; i += 4)
+            {
+                min = _mm_min_epu32(min, _mm256_i64gather_epi32(base, _mm256_load_si256(reinterpret_cast<const __m256i*>(offsets + i)), 4));
+            }
+            min = _mm_min_epu32(min, _mm_shuffle_epi32(min, _MM_SHUFFLE(1, 0, 3, 2)));
+            min = _mm_min_epu32(min, _mm_shuffle_epi32(min, _MM_SHUFFLE(2, 3, 0, 1)));
+            return static_cast<T>(static_cast<uint32_t>(_mm_cvtsi128_si32(min)));
+        }
+    }
+#endif
+
+    T estimate_buffer(const T* buffer, const XXH128_hash_t& hash) const
+    {
+        // Return the minimum count across Rows as an estimate.
+        // Note: d is typically very small (e.g. < 10)
+        if (d_ == 0)
+        {
+            return T();
+        }
+        if (d_ <= CMS_BATCH_MAX_ROWS)
+        {
+#ifdef PLUGIN_ANOMALYDETECTION_CMS_AVX2
+            if constexpr (sizeof(T) == 4 || sizeof(T) == 8)
+            {
+                if (simd_)
+                {
+                    return estimate_avx2(buffer, hash);
+                }
+            }
+#endif
+            // Scalar fallback: issue all Row reads before consuming any of them
+            long long offsets[CMS_BATCH_MAX_ROWS];
+            get_offsets(hash, offsets);
+            for (uint64_t row = 0; row < d_; ++row)
+            {
+                __builtin_prefetch(buffer + offsets[row]);
+            }
+            T min_estimate = std::numeric_limits<T>::max();
+            for (uint64_t row = 0; row < d_; ++row)
+            {
+                min_estimate = std::min(min_estimate, load_counter(buffer + offsets[row]));
+            }
+            return min_estimate;
+        }
+        T min_estimate = std::numeric_limits<T>::max();
+        for (uint64_t row = 0; row < d_; ++row)
+        {
+            min_estimate = std::min(min_estimate, load_counter(buffer + row * stride_ + get_index(hash, row)));
+        }
+        return min_estimate;
+    }
 
 public:
+    using counter_type = T;
+
+    static T saturating_add(T a, T b)
+    {
+        T sum;
+        return __builtin_add_overflow(a, b, &sum) ? std::numeric_limits<T>::max() : sum;
+    }
+
     static uint64_t calculate_d_rows_from_gamma(double gamma)
     {
         // -> determine Rows / number of hash functions
@@ -69,119 +357,286 @@ public:
         return std::exp(1) / w;
     }
 
-    cms(double gamma, double eps) 
+    static uint64_t round_w_cols_pow2(uint64_t w)
+    {
+        // -> next power of two >= w, trading some memory for a cheaper bucket index computation
+        uint64_t p = 1;
+        while (p < w)
+        {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    cms(double gamma, double eps, const cms_options& options = cms_options())
     {
         d_ = calculate_d_rows_from_gamma(gamma); // -> determine Rows / number of hash functions
         w_ = calculate_w_cols_buckets_from_eps(eps); // -> determine Cols / number of buckets
         gamma_ = gamma;
         eps_ = eps;
-        sketch = std::make_unique<std::unique_ptr<T[]>[]>(d_);
-        for (uint64_t i = 0; i < d_; ++i) 
-        {
-            sketch[i] = std::make_unique<T[]>(w_);
-            std::fill(sketch[i].get(), sketch[i].get() + w_, static_cast<T>(0)); // Init to 0
-        }
+        init_sketch(options);
     }
 
     // Overloaded constructor
-    cms(uint64_t d, uint64_t w)
+    cms(uint64_t d, uint64_t w, const cms_options& options = cms_options())
     {
         d_ = d;
         w_ = w;
         gamma_ = calculate_gamma_rows_from_d(d); // -> reverse calculate error probability from Rows / number of hash functions 
         eps_ = calculate_eps_cols_buckets_from_w(w); // -> reverse calculate relative error from Cols / number of buckets
-        sketch = std::make_unique<std::unique_ptr<T[]>[]>(d_);
-        for (uint64_t i = 0; i < d_; ++i) 
-        {
-            sketch[i] = std::make_unique<T[]>(w_);
-            std::fill(sketch[i].get(), sketch[i].get() + w_, static_cast<T>(0)); // Init to 0
-        }
+        init_sketch(options);
     }
 
     void reset()
     {
         // Reset data structure
-        for (uint64_t i = 0; i < d_; ++i) 
+        if (n_buffers_ > 1)
+        {
+            // O(1) pause for updates and estimates regardless of the sketch size
+            clear_standby();
+            swap_buffers();
+            return;
+        }
+        clear_buffer(sketch.data());
+    }
+
+    // Periodic forgetting step, a plain sketch is a tumbling window of a single slice
+    void rotate()
+    {
+        reset();
+    }
+
+    // Zero the standby buffer, safe to call while the active buffer is being updated
+    void clear_standby()
+    {
+        if (n_buffers_ > 1)
+        {
+            uint32_t standby = __atomic_load_n(&active_, __ATOMIC_ACQUIRE) ^ 1;
+            clear_buffer(sketch.data() + standby * d_ * stride_);
+        }
+    }
+
+    // Atomically make the standby buffer the active one
+    void swap_buffers()
+    {
+        if (n_buffers_ > 1)
         {
-            std::fill(sketch[i].get(), sketch[i].get() + w_, static_cast<T>(0));
+            __atomic_xor_fetch(&active_, 1, __ATOMIC_ACQ_REL);
         }
     }
 
-    uint64_t hash_XXH3_seed(std::string value, uint64_t seed) const
+    uint64_t hash_XXH3_seed(std::string_view value, uint64_t seed) const
     {
         // using https://raw.githubusercontent.com/Cyan4973/xxHash/v0.8.2/xxhash.h
         // Requirement: Need fast and reliable independent hash functions.
-        uint64_t hash = XXH3_64bits_withSeed(value.c_str(), value.size(), seed);
+        uint64_t hash = XXH3_64bits_withSeed(value.data(), value.size(), seed);
         return hash;
     }
 
-    void update(std::string value, T count)
+    static XXH128_hash_t hash_XXH3_128(std::string_view value)
+    {
+        // Hash each value only once, the d Row indices are derived from the two 64 bit halves (see `get_index`)
+        return XXH3_128bits(value.data(), value.size());
+    }
+
+    uint64_t get_index(const XXH128_hash_t& hash, uint64_t row) const
+    {
+        // Kirsch-Mitzenmacher double hashing: g_i(x) = h1(x) + i * h2(x) mod w
+        // Forcing h2 to be odd makes it invertible mod w when w is a power of two, so with d <= w all Rows probe distinct
+        // buckets on the mask path. With `% w_` (w not a power of two) the 64 bit sums wrap and Rows may collide.
+        uint64_t h = hash.low64 + row * (hash.high64 | 1);
+        return w_mask_ ? (h & w_mask_) : (h % w_);
+    }
+
+    void update(std::string_view value, T count)
     {
         if (value.empty())
         {
             return;
         }
-        // Update counts for each hash function.
-        // Note: d is typically very small (e.g. < 10)
-        for (uint64_t seed = 0; seed < d_; ++seed)
+        update(hash_XXH3_128(value), count);
+    }
+
+    void update(const XXH128_hash_t& hash, T count)
+    {
+        // Update counts for each Row, d is typically very small (e.g. < 10)
+        T* buffer = active_buffer();
+        if (conservative_update_)
+        {
+            update_conservative(buffer, hash, count);
+            return;
+        }
+        for (uint64_t row = 0; row < d_; ++row)
+        {
+            add_counter(buffer + row * stride_ + get_index(hash, row), count);
+        }
+    }
+
+    // Update the counts of n keys. The bucket addresses of up to `CMS_PREFETCH_KEYS` keys are prefetched before any
+    // of them is written, overlapping the cache misses of independent keys instead of taking them one after another.
+    void update_batch(const XXH128_hash_t* hashes, size_t n, T count)
+    {
+        T* buffer = active_buffer();
+        if (d_ > CMS_BATCH_MAX_ROWS)
         {
-            // Map the hash value to an index of the current sketch Row by taking the modulo of the hash value, where w is the number of buckets.
-            // Simply loop over d, which is the number of hash functions, to obtain a seed in order to use independent hash functions for each Row.
-            sketch[seed][hash_XXH3_seed(value, seed) % w_] += count;
+            for (size_t i = 0; i < n; ++i)
+            {
+                update(hashes[i], count);
+            }
+            return;
+        }
+        long long offsets[CMS_PREFETCH_KEYS][CMS_BATCH_MAX_ROWS];
+        for (size_t start = 0; start < n; start += CMS_PREFETCH_KEYS)
+        {
+            size_t m = std::min(CMS_PREFETCH_KEYS, n - start);
+            for (size_t i = 0; i < m; ++i)
+            {
+                get_offsets(hashes[start + i], offsets[i]);
+                for (uint64_t row = 0; row < d_; ++row)
+                {
+                    __builtin_prefetch(buffer + offsets[i][row], 1);
+                }
+            }
+            for (size_t i = 0; i < m; ++i)
+            {
+                if (conservative_update_)
+                {
+                    update_conservative(buffer, hashes[start + i], count);
+                    continue;
+                }
+                for (uint64_t row = 0; row < d_; ++row)
+                {
+                    add_counter(buffer + offsets[i][row], count);
+                }
+            }
         }
     }
 
-    T update_estimate(std::string value, T count) const
+    T update_estimate(std::string_view value, T count)
     {
         if (value.empty())
         {
             return T();
         }
-        std::vector<T> estimates;
+        return update_estimate(hash_XXH3_128(value), count);
+    }
+
+    T update_estimate(const XXH128_hash_t& hash, T count)
+    {
         // Same as the update function, but also returns the minimum count as an estimate.
         // Note: d is typically very small (e.g. < 10)
-        for (uint64_t seed = 0; seed < d_; ++seed)
+        T* buffer = active_buffer();
+        if (conservative_update_)
         {
-            uint64_t index = hash_XXH3_seed(value, seed) % w_;
-            sketch[seed][index] += count;
-            estimates.push_back(sketch[seed][index]);
+            return update_conservative(buffer, hash, count);
         }
-        auto min_element = std::min_element(estimates.begin(), estimates.end());
-        return min_element != estimates.end() ? *min_element : T();
+        T min_estimate = std::numeric_limits<T>::max();
+        for (uint64_t row = 0; row < d_; ++row)
+        {
+            min_estimate = std::min(min_estimate, add_counter(buffer + row * stride_ + get_index(hash, row), count));
+        }
+        return d_ > 0 ? min_estimate : T();
     }
 
-    T estimate(std::string value) const
+    T estimate(std::string_view value) const
     {
         if (value.empty())
         {
             return T();
         }
-        std::vector<T> estimates;
-        // Return the minimum count across hash functions as an estimate.
-        // Note: d is typically very small (e.g. < 10)
-        for (uint64_t seed = 0; seed < d_; ++seed)
-        {
-            uint64_t index = hash_XXH3_seed(value, seed) % w_;
-            estimates.push_back(sketch[seed][index]);
-        }
-        auto min_element = std::min_element(estimates.begin(), estimates.end());
-        return min_element != estimates.end() ? *min_element : T();
+        return estimate(hash_XXH3_128(value));
+    }
+
+    T estimate(const XXH128_hash_t& hash) const
+    {
+        return estimate_buffer(active_buffer(), hash);
     }
 
     T get_item(uint64_t row, uint64_t col) const
     {
         if (row >= 0 && row < d_ && col >= 0 && col < w_) 
         {
-            return sketch[row][col];
+            return load_counter(active_buffer() + row * stride_ + col);
         } else
         {
             return T();
         }
     }
 
+    // Copy the d x w counters of the active buffer to `out`, Row by Row without the cache line padding
+    void export_counters(T* out) const
+    {
+        const T* buffer = active_buffer();
+        for (uint64_t row = 0; row < d_; ++row)
+        {
+            for (uint64_t col = 0; col < w_; ++col)
+            {
+                out[row * w_ + col] = load_counter(buffer + row * stride_ + col);
+            }
+        }
+    }
+
+    // Scan the active buffer, O(d x w) and meant for periodic metrics rather than the event path
+    cms_stats get_stats() const
+    {
+        cms_stats stats;
+        const T* buffer = active_buffer();
+        uint64_t nonzero = 0;
+        for (uint64_t row = 0; row < d_; ++row)
+        {
+            uint64_t row_total = 0;
+            for (uint64_t col = 0; col < w_; ++col)
+            {
+                T count = load_counter(buffer + row * stride_ + col);
+                nonzero += count != 0;
+                row_total += count;
+            }
+            stats.total = std::max(stats.total, row_total);
+        }
+        stats.fill_ratio = d_ * w_ == 0 ? 0 : static_cast<double>(nonzero) / static_cast<double>(d_ * w_);
+        return stats;
+    }
+
+    // Overwrite the active buffer with d x w counters laid out as by `export_counters`
+    void import_counters(const T* in)
+    {
+        T* buffer = active_buffer();
+        for (uint64_t row = 0; row < d_; ++row)
+        {
+            for (uint64_t col = 0; col < w_; ++col)
+            {
+                store_counter(buffer + row * stride_ + col, in[row * w_ + col]);
+            }
+        }
+    }
+
+    // Add the counts of `other` to this sketch, both need the same dimensions. Sketches are linear,
+    // the merged sketch estimates the combined streams as if they had been counted by one sketch.
+    bool merge(const cms& other)
+    {
+        if (other.d_ != d_ || other.w_ != w_)
+        {
+            return false;
+        }
+        T* buffer = active_buffer();
+        const T* in = other.active_buffer();
+        for (uint64_t row = 0; row < d_; ++row)
+        {
+            for (uint64_t col = 0; col < w_; ++col)
+            {
+                T count = other.load_counter(in + row * stride_ + col);
+                if (count > 0)
+                {
+                    add_counter(buffer + row * stride_ + col, count);
+                }
+            }
+        }
+        return true;
+    }
+
     size_t get_size_bytes() const 
     {
-        return d_ * w_ * sizeof(T);
+        return n_buffers_ * d_ * w_ * sizeof(T);
     }
 
     static size_t get_size_bytes(uint64_t d, uint64_t w)
@@ -218,6 +673,42 @@ public:
         return eps_;
     }
 
+    // Return the number of time slices, always 1 for a plain sketch
+    uint32_t get_slices() const
+    {
+        return 1;
+    }
+
+    // Return the concurrency mode of the counters
+    cms_concurrency get_concurrency() const
+    {
+        return concurrency_;
+    }
+
+    // Return true if updates only raise the counters equal to the current minimum
+    bool is_conservative_update() const
+    {
+        return conservative_update_;
+    }
+
+    // Return true if the sketch keeps a standby buffer for O(1) resets
+    bool is_double_buffered() const
+    {
+        return n_buffers_ > 1;
+    }
+
+    // Return true if estimates use the AVX2 gather path
+    bool is_simd() const
+    {
+        return simd_;
+    }
+
+    // Return true if the sketch memory is backed by huge pages
+    bool is_huge_page_backed() const
+    {
+        return sketch.is_huge_page_backed();
+    }
+
     cms(cms&&) noexcept = default;
     cms(const cms&) = default;
     cms& operator=(cms&&) noexcept = default;
@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "cms.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <string_view>
+
+/*
+Sliding window CountMinSketch: a ring of k sub-sketches (slices) that each cover window / k of time.
+Updates go to the head slice, estimates sum all slices and `rotate` expires the oldest slice only,
+so counts fade out gradually instead of dropping to zero at each reset.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+template<typename T>
+class cms_window
+{
+private:
+    std::vector<cms<T>> slices_; // Ring of k sub-sketches sharing the same dimensions and therefore the same bucket indices
+    uint32_t head_ = 0; // Index of the slice receiving updates, advanced atomically
+
+    void init_slices(uint64_t d, uint64_t w, uint32_t k, const cms_options& options)
+    {
+        cms_options slice_options = options;
+        slice_options.double_buffered = false; // Only ever the oldest slice is cleared, it receives no updates at that time
+        k = std::max<uint32_t>(1, k);
+        slices_.reserve(k);
+        for (uint32_t i = 0; i < k; ++i)
+        {
+            slices_.emplace_back(d, w, slice_options);
+        }
+    }
+
+    uint32_t head() const
+    {
+        return __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+    }
+
+public:
+    using counter_type = T;
+
+    cms_window(double gamma, double eps, uint32_t k, const cms_options& options = cms_options())
+    {
+        init_slices(cms<T>::calculate_d_rows_from_gamma(gamma), cms<T>::calculate_w_cols_buckets_from_eps(eps), k, options);
+    }
+
+    // Overloaded constructor
+    cms_window(uint64_t d, uint64_t w, uint32_t k, const cms_options& options = cms_options())
+    {
+        init_slices(d, w, k, options);
+    }
+
+    void reset()
+    {
+        // Reset data structure
+        for (auto& slice : slices_)
+        {
+            slice.reset();
+        }
+    }
+
+    void rotate()
+    {
+        // Clear the oldest slice while it receives no updates, then make it the new head.
+        // Concurrent estimates may briefly observe it partially cleared, which only lowers expiring counts.
+        uint32_t oldest = (head() + 1) % slices_.size();
+        slices_[oldest].reset();
+        __atomic_store_n(&head_, oldest, __ATOMIC_RELEASE);
+    }
+
+    void update(std::string_view value, T count)
+    {
+        if (value.empty())
+        {
+            return;
+        }
+        update(cms<T>::hash_XXH3_128(value), count);
+    }
+
+    void update(const XXH128_hash_t& hash, T count)
+    {
+        slices_[head()].update(hash, count);
+    }
+
+    void update_batch(const XXH128_hash_t* hashes, size_t n, T count)
+    {
+        slices_[head()].update_batch(hashes, n, count);
+    }
+
+    T update_estimate(std::string_view value, T count)
+    {
+        if (value.empty())
+        {
+            return T();
+        }
+        return update_estimate(cms<T>::hash_XXH3_128(value), count);
+    }
+
+    T update_estimate(const XXH128_hash_t& hash, T count)
+    {
+        update(hash, count);
+        return estimate(hash);
+    }
+
+    T estimate(std::string_view value) const
+    {
+        if (value.empty())
+        {
+            return T();
+        }
+        return estimate(cms<T>::hash_XXH3_128(value));
+    }
+
+    T estimate(const XXH128_hash_t& hash) const
+    {
+        // Return the minimum across Rows of the counts summed over all slices
+        T min_estimate = std::numeric_limits<T>::max();
+        const cms<T>& first = slices_.front();
+        for (uint64_t row = 0; row < first.get_d(); ++row)
+        {
+            uint64_t col = first.get_index(hash, row);
+            T sum = T();
+            for (const auto& slice : slices_)
+            {
+                sum = cms<T>::saturating_add(sum, slice.get_item(row, col));
+            }
+            min_estimate = std::min(min_estimate, sum);
+        }
+        return first.get_d() > 0 ? min_estimate : T();
+    }
+
+    // Copy the counters of all slices to `out`, oldest slice first
+    void export_counters(T* out) const
+    {
+        uint32_t k = get_slices();
+        uint32_t oldest = (head() + 1) % k;
+        uint64_t n = get_d() * get_w();
+        for (uint32_t i = 0; i < k; ++i)
+        {
+            slices_[(oldest + i) % k].export_counters(out + i * n);
+        }
+    }
+
+    // Overwrite all slices with counters laid out as by `export_counters`, the newest slice becomes the head
+    void import_counters(const T* in)
+    {
+        uint32_t k = get_slices();
+        uint64_t n = get_d() * get_w();
+        for (uint32_t i = 0; i < k; ++i)
+        {
+            slices_[i].import_counters(in + i * n);
+        }
+        __atomic_store_n(&head_, k - 1, __ATOMIC_RELEASE);
+    }
+
+    // Add the counts of `other` slice by slice, aligned by slice age, both need the same dimensions and slices
+    bool merge(const cms_window& other)
+    {
+        uint32_t k = get_slices();
+        if (other.get_slices() != k || other.get_d() != get_d() || other.get_w() != get_w())
+        {
+            return false;
+        }
+        uint32_t head = this->head();
+        uint32_t other_head = other.head();
+        for (uint32_t i = 0; i < k; ++i)
+        {
+            slices_[(head + k - i) % k].merge(other.slices_[(other_head + k - i) % k]);
+        }
+        return true;
+    }
+
+    // Counters are non-zero if non-zero in any slice, the fill ratio of the slice union assumes independent slices
+    cms_stats get_stats() const
+    {
+        cms_stats stats;
+        double empty = 1;
+        for (const auto& slice : slices_)
+        {
+            cms_stats slice_stats = slice.get_stats();
+            empty *= 1 - slice_stats.fill_ratio;
+            stats.total += slice_stats.total;
+        }
+        stats.fill_ratio = 1 - empty;
+        return stats;
+    }
+
+    size_t get_size_bytes() const
+    {
+        return slices_.size() * slices_.front().get_size_bytes();
+    }
+
+    // Return Rows / number of hash functions
+    uint64_t get_d() const
+    {
+        return slices_.front().get_d();
+    }
+
+    // Return Cols / number of buckets
+    uint64_t get_w() const
+    {
+        return slices_.front().get_w();
+    }
+
+    // Return error probability
+    double get_gamma() const
+    {
+        return slices_.front().get_gamma();
+    }
+
+    // Return relative error of each slice
+    double get_eps() const
+    {
+        return slices_.front().get_eps();
+    }
+
+    // Return the number of time slices k, `rotate` is expected to be called every window / k
+    uint32_t get_slices() const
+    {
+        return static_cast<uint32_t>(slices_.size());
+    }
+
+    cms_window(cms_window&&) noexcept = default;
+    cms_window(const cms_window&) = default;
+    cms_window& operator=(cms_window&&) noexcept = default;
+    cms_window& operator=(const cms_window&) = default;
+    cms_window() = delete;
+};
+
+} // namespace plugin::anomalydetection::num
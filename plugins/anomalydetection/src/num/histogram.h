@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+Log2 bucketed histogram for sampled latencies: 65 fixed buckets, no allocation and a handful of instructions per sample.
+Quantiles are reported as the upper bound of their bucket, i.e. within a factor of 2 of the exact value.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+class log2_histogram
+{
+private:
+    static constexpr size_t BUCKETS = 65; // Bucket 0 holds 0, bucket b > 0 holds [2^(b-1), 2^b)
+
+    uint64_t buckets_[BUCKETS] = {};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+
+    static uint64_t load(const uint64_t& v)
+    {
+        return __atomic_load_n(&v, __ATOMIC_RELAXED);
+    }
+
+    // Single recording thread, concurrent readers; relaxed load and store instead of a locked read-modify-write
+    static void add(uint64_t& v, uint64_t n)
+    {
+        __atomic_store_n(&v, load(v) + n, __ATOMIC_RELAXED);
+    }
+
+public:
+    void record(uint64_t value)
+    {
+        add(buckets_[value == 0 ? 0 : 64 - __builtin_clzll(value)], 1);
+        add(count_, 1);
+        add(sum_, value);
+    }
+
+    uint64_t get_count() const
+    {
+        return load(count_);
+    }
+
+    uint64_t get_mean() const
+    {
+        uint64_t count = get_count();
+        return count == 0 ? 0 : load(sum_) / count;
+    }
+
+    // Return the upper bound of the bucket holding the q-th quantile, 0 without samples
+    uint64_t get_quantile(double q) const
+    {
+        uint64_t total = 0;
+        for (size_t b = 0; b < BUCKETS; ++b)
+        {
+            total += load(buckets_[b]);
+        }
+        if (total == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; ++b)
+        {
+            seen += load(buckets_[b]);
+            if (seen >= rank)
+            {
+                return b == 0 ? 0 : b == 64 ? UINT64_MAX : (uint64_t(1) << b) - 1;
+            }
+        }
+        return UINT64_MAX;
+    }
+
+    void reset()
+    {
+        for (auto& b : buckets_)
+        {
+            __atomic_store_n(&b, uint64_t(0), __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&count_, uint64_t(0), __ATOMIC_RELAXED);
+        __atomic_store_n(&sum_, uint64_t(0), __ATOMIC_RELAXED);
+    }
+};
+
+} // namespace plugin::anomalydetection::num
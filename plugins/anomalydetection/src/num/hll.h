@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "xxhash_ext.h"
+#include "aligned_buffer.h"
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <string_view>
+
+/*
+HyperLogLog cardinality estimator: approximate number of distinct items in 2^p one byte registers
+(e.g. 4 KB for p = 12 at a standard error of 1.04 / sqrt(2^p) ~ 1.6%).
+Flajolet et al., HyperLogLog: the analysis of a near-optimal cardinality estimation algorithm, 2007.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+class hll
+{
+private:
+    aligned_buffer<uint8_t> registers_; // 2^p registers, each the max rank observed for its bucket
+    uint32_t p_; // Precision, number of hash bits selecting the register
+
+    uint8_t load_register(uint64_t i) const
+    {
+        return __atomic_load_n(&registers_[i], __ATOMIC_RELAXED);
+    }
+
+public:
+    static constexpr uint32_t MIN_PRECISION = 4;
+    static constexpr uint32_t MAX_PRECISION = 18;
+
+    explicit hll(uint32_t p = 12)
+    {
+        p_ = std::clamp(p, MIN_PRECISION, MAX_PRECISION);
+        registers_ = aligned_buffer<uint8_t>(uint64_t(1) << p_);
+    }
+
+    // Single updating thread, concurrent estimates and resets; registers are relaxed atomics like the `cms` counters
+    void update(const XXH128_hash_t& hash)
+    {
+        // Register index and rank only need uniform bits per item. The high half is also the `cms` double hashing stride
+        // (see `cms::get_index`), which correlates the two structures per key but does not bias the distinct count.
+        uint64_t h = hash.high64;
+        uint64_t i = h >> (64 - p_);
+        uint64_t w = (h << p_) | (uint64_t(1) << (p_ - 1)); // Sentinel bit caps the rank at 64 - p + 1
+        uint8_t rank = static_cast<uint8_t>(__builtin_clzll(w) + 1);
+        if (load_register(i) < rank)
+        {
+            __atomic_store_n(&registers_[i], rank, __ATOMIC_RELAXED);
+        }
+    }
+
+    void update(std::string_view value)
+    {
+        if (!value.empty())
+        {
+            update(XXH3_128bits(value.data(), value.size()));
+        }
+    }
+
+    // Return the estimated number of distinct items
+    uint64_t estimate() const
+    {
+        uint64_t m = get_registers();
+        double sum = 0;
+        uint64_t zeros = 0;
+        for (uint64_t i = 0; i < m; ++i)
+        {
+            uint8_t r = load_register(i);
+            sum += std::ldexp(1.0, -static_cast<int>(r));
+            zeros += r == 0;
+        }
+        double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 : 0.7213 / (1.0 + 1.079 / m);
+        double e = alpha * m * m / sum;
+        if (e <= 2.5 * m && zeros > 0)
+        {
+            e = m * std::log(static_cast<double>(m) / zeros); // Linear counting for small cardinalities
+        }
+        return static_cast<uint64_t>(std::llround(e));
+    }
+
+    // Union with another estimator of the same precision
+    bool merge(const hll& other)
+    {
+        if (other.p_ != p_)
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i < get_registers(); ++i)
+        {
+            uint8_t r = other.load_register(i);
+            if (load_register(i) < r)
+            {
+                __atomic_store_n(&registers_[i], r, __ATOMIC_RELAXED);
+            }
+        }
+        return true;
+    }
+
+    void reset()
+    {
+        for (uint64_t i = 0; i < get_registers(); ++i)
+        {
+            __atomic_store_n(&registers_[i], static_cast<uint8_t>(0), __ATOMIC_RELAXED);
+        }
+    }
+
+    // Return the precision p
+    uint32_t get_precision() const
+    {
+        return p_;
+    }
+
+    // Return the number of registers 2^p
+    uint64_t get_registers() const
+    {
+        return uint64_t(1) << p_;
+    }
+
+    size_t get_size_bytes() const
+    {
+        return registers_.get_size_bytes();
+    }
+};
+
+} // namespace plugin::anomalydetection::num
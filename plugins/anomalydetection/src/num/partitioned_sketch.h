@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "sketch.h"
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/*
+One small sketch per partition key (e.g. per container), so a noisy partition cannot mask rare behavior in a quiet one.
+Memory stays bounded under churn: at most `max_partitions` sketches are ever active, the least recently updated
+partition is evicted to make room and partitions idle for longer than the TTL (in event time) are evicted as the
+writer goes. Sketches of evicted partitions are pooled for reuse instead of being freed.
+Single writer: the event parsing thread owns the partitions, updates and estimates never take a lock. The periodic
+workers only post requests: `rotate` is applied to each partition the next time it is touched, and `reset_evicted`
+clears the pooled sketches off the event parsing thread.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+class partitioned_sketch
+{
+public:
+    using factory = std::function<std::shared_ptr<sketch>()>;
+
+private:
+    struct partition
+    {
+        std::shared_ptr<sketch> sketch_ptr;
+        std::list<uint64_t>::iterator lru;
+        uint64_t last_update_ns;
+        uint64_t rotations; // `rotations_requested_` the sketch was last rotated to
+    };
+
+    factory factory_;
+    size_t max_partitions_;
+    uint64_t ttl_ns_; // 0 disables the TTL
+    std::unordered_map<uint64_t, partition> partitions_; // Writer only
+    std::list<uint64_t> lru_; // Partition keys, most recently updated first, writer only
+    std::mutex pool_mutex_; // Guards the pools, shared by the writer and `reset_evicted`
+    std::vector<std::shared_ptr<sketch>> pool_; // Reset sketches ready for reuse
+    std::vector<std::shared_ptr<sketch>> evicted_; // Sketches of evicted partitions, still holding their counts
+    uint64_t rotations_requested_ = 0; // Raised by `rotate`
+    uint64_t evictions_ = 0;
+    uint64_t n_partitions_ = 0; // Mirrors `partitions_.size()` for readers on other threads
+    uint64_t size_bytes_ = 0; // Memory of all allocated sketches, active and pooled
+
+    void evict(std::unordered_map<uint64_t, partition>::iterator it)
+    {
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex_);
+            evicted_.push_back(std::move(it->second.sketch_ptr));
+        }
+        lru_.erase(it->second.lru);
+        partitions_.erase(it);
+        __atomic_add_fetch(&evictions_, (uint64_t)1, __ATOMIC_RELAXED);
+        __atomic_store_n(&n_partitions_, (uint64_t)partitions_.size(), __ATOMIC_RELAXED);
+    }
+
+    // A reset sketch for a new partition, resets an evicted one in place only if `reset_evicted` has not caught up
+    std::shared_ptr<sketch> acquire()
+    {
+        std::shared_ptr<sketch> sketch_ptr;
+        bool dirty = false;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex_);
+            if (!pool_.empty())
+            {
+                sketch_ptr = std::move(pool_.back());
+                pool_.pop_back();
+            } else if (!evicted_.empty())
+            {
+                sketch_ptr = std::move(evicted_.back());
+                evicted_.pop_back();
+                dirty = true;
+            }
+        }
+        if (dirty)
+        {
+            sketch_ptr->reset();
+        } else if (!sketch_ptr)
+        {
+            sketch_ptr = factory_();
+            __atomic_add_fetch(&size_bytes_, (uint64_t)sketch_ptr->get_size_bytes(), __ATOMIC_RELAXED);
+        }
+        return sketch_ptr;
+    }
+
+    // Apply the rotations requested since the partition was last touched, all slices expired is one reset
+    void catch_up(partition& p)
+    {
+        uint64_t requested = __atomic_load_n(&rotations_requested_, __ATOMIC_ACQUIRE);
+        uint64_t missed = requested - p.rotations;
+        if (missed == 0)
+        {
+            return;
+        }
+        if (missed >= p.sketch_ptr->get_slices())
+        {
+            p.sketch_ptr->reset();
+        } else
+        {
+            for (uint64_t j = 0; j < missed; ++j)
+            {
+                p.sketch_ptr->rotate();
+            }
+        }
+        p.rotations = requested;
+    }
+
+public:
+    partitioned_sketch(factory make_sketch, size_t max_partitions, uint64_t ttl_ns = 0) :
+        factory_(std::move(make_sketch)), max_partitions_(std::max<size_t>(1, max_partitions)), ttl_ns_(ttl_ns)
+    {
+        partitions_.reserve(max_partitions_);
+    }
+
+    // Writer only, `now_ns` is the event time the TTL is measured in
+    void update(uint64_t key, const XXH128_hash_t& hash, uint64_t count, uint64_t now_ns)
+    {
+        evict_expired(now_ns);
+        auto it = partitions_.find(key);
+        if (it == partitions_.end())
+        {
+            if (partitions_.size() >= max_partitions_)
+            {
+                evict(partitions_.find(lru_.back()));
+            }
+            auto sketch_ptr = acquire();
+            lru_.push_front(key);
+            it = partitions_.emplace(key, partition{std::move(sketch_ptr), lru_.begin(), now_ns, __atomic_load_n(&rotations_requested_, __ATOMIC_ACQUIRE)}).first;
+            __atomic_store_n(&n_partitions_, (uint64_t)partitions_.size(), __ATOMIC_RELAXED);
+        } else
+        {
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+            it->second.last_update_ns = now_ns;
+            catch_up(it->second);
+        }
+        it->second.sketch_ptr->update(hash, count);
+    }
+
+    // Writer only, return the estimate within the partition of `key`, 0 for partitions without updates (e.g. a new container)
+    uint64_t estimate(uint64_t key, const XXH128_hash_t& hash)
+    {
+        auto it = partitions_.find(key);
+        if (it == partitions_.end())
+        {
+            return 0;
+        }
+        catch_up(it->second);
+        return it->second.sketch_ptr->estimate(hash);
+    }
+
+    // Writer only, evict the partitions without updates within the TTL, returns the number of evicted partitions
+    size_t evict_expired(uint64_t now_ns)
+    {
+        size_t evicted = 0;
+        while (ttl_ns_ > 0 && !lru_.empty())
+        {
+            auto it = partitions_.find(lru_.back());
+            if (it->second.last_update_ns + ttl_ns_ > now_ns)
+            {
+                break;
+            }
+            evict(it);
+            evicted++;
+        }
+        return evicted;
+    }
+
+    // Periodic forgetting step of all partitions, see `sketch::rotate`, any thread
+    void rotate()
+    {
+        __atomic_add_fetch(&rotations_requested_, (uint64_t)1, __ATOMIC_RELEASE);
+    }
+
+    // Clear the sketches of evicted partitions for reuse, any thread, the writer is only blocked to move them
+    void reset_evicted()
+    {
+        std::vector<std::shared_ptr<sketch>> evicted;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex_);
+            evicted.swap(evicted_);
+        }
+        for (auto& s : evicted)
+        {
+            s->reset();
+        }
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        for (auto& s : evicted)
+        {
+            pool_.push_back(std::move(s));
+        }
+    }
+
+    // Writer only
+    void reset()
+    {
+        while (!lru_.empty())
+        {
+            evict(partitions_.find(lru_.back()));
+        }
+    }
+
+    size_t get_partitions() const
+    {
+        return (size_t)__atomic_load_n(&n_partitions_, __ATOMIC_RELAXED);
+    }
+
+    size_t get_max_partitions() const
+    {
+        return max_partitions_;
+    }
+
+    uint64_t get_evictions() const
+    {
+        return __atomic_load_n(&evictions_, __ATOMIC_RELAXED);
+    }
+
+    // Return the memory of all allocated sketches, active and pooled
+    size_t get_size_bytes() const
+    {
+        return (size_t)__atomic_load_n(&size_bytes_, __ATOMIC_RELAXED);
+    }
+};
+
+} // namespace plugin::anomalydetection::num
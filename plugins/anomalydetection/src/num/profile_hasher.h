@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "xxhash_ext.h"
+
+#include <cstdint>
+#include <string_view>
+
+/*
+Streaming hash of a behavior profile: each field is fed straight into an incremental XXH3 state instead of
+materializing the concatenated profile string. Each field is terminated by a separator so that shifting
+characters between adjacent fields changes the hash.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+class profile_hasher
+{
+private:
+    XXH3_state_t state_;
+    uint64_t length_ = 0; // Length of the profile string without separators
+
+public:
+    profile_hasher()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        XXH3_128bits_reset(&state_);
+        length_ = 0;
+    }
+
+    void update(std::string_view value)
+    {
+        static const char separator = '\0';
+        XXH3_128bits_update(&state_, value.data(), value.size());
+        XXH3_128bits_update(&state_, &separator, 1);
+        length_ += value.size();
+    }
+
+    XXH128_hash_t digest() const
+    {
+        return XXH3_128bits_digest(&state_);
+    }
+
+    uint64_t get_length() const
+    {
+        return length_;
+    }
+};
+
+} // namespace plugin::anomalydetection::num
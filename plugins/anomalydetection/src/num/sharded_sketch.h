@@ -0,0 +1,414 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "sketch.h"
+#include "spsc_queue.h"
+
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Sketch split by key hash into n shards, each shard sketch is owned and updated by its own worker thread.
+The event parsing thread only routes each update to its shard's single producer single consumer queue, so the sketch
+memory accesses of the updates are spread across cores. Estimates are answered from the key's shard with the relaxed
+counter loads of the shard sketch. On the producer thread `estimate_with_queued` also adds the key's updates still in
+the shard queue, so the producer reads its own writes without waiting for the worker: each shard keeps a small table of
+the counts pushed per hash slot, retired once the worker's applied watermark passes their last push. Colliding slots
+and partly applied counts only add to the estimate, like the sketch itself, by at most the updates queued meanwhile.
+Shards split the keys and the memory alike, n shards of w / n cols have the error bound of one sketch of w cols.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+// Updates moved from a shard queue to its sketch at once
+static constexpr size_t SHARD_BATCH_SIZE = 64;
+
+// Empty polls of a shard worker before it parks until the producer pushes again
+static constexpr uint32_t SHARD_IDLE_SPINS = 64;
+
+class sharded_sketch : public sketch
+{
+public:
+    using factory = std::function<std::shared_ptr<sketch>()>;
+
+private:
+    struct shard_update
+    {
+        XXH128_hash_t hash;
+        uint64_t count;
+    };
+
+    // Counts pushed to a hash slot and not yet known to be applied, producer only
+    struct pending_slot
+    {
+        uint64_t count = 0;
+        uint64_t end = 0; // Queue position after the last push to the slot, live while greater than the applied watermark
+    };
+
+    struct shard
+    {
+        std::shared_ptr<sketch> sketch_ptr;
+        spsc_queue<shard_update> queue;
+        std::vector<pending_slot> pending; // As many slots as the queue, a power of two
+        std::thread worker;
+        std::mutex park_mutex;
+        std::condition_variable park_cv;
+        alignas(CACHE_LINE_SIZE) uint64_t pushed = 0; // Written by the producer
+        uint64_t seen_applied = 0; // Producer's last read of `applied`
+        alignas(CACHE_LINE_SIZE) uint64_t applied = 0; // Written by the worker once the popped updates are in the sketch
+        bool parked = false; // Written by the worker, the producer only notifies a parked worker
+
+        shard(std::shared_ptr<sketch> s, size_t queue_capacity) : sketch_ptr(std::move(s)), queue(queue_capacity), pending(queue.capacity()) {}
+    };
+
+    std::vector<std::unique_ptr<shard>> shards_;
+    bool stop_ = false;
+    uint64_t stalls_ = 0; // Updates that found their shard queue full
+
+    void run(shard& s)
+    {
+        shard_update updates[SHARD_BATCH_SIZE];
+        XXH128_hash_t hashes[SHARD_BATCH_SIZE];
+        uint32_t idle = 0;
+        while (true)
+        {
+            size_t n = s.queue.pop_batch(updates, SHARD_BATCH_SIZE);
+            if (n == 0)
+            {
+                // Stop only once drained, the final updates still reach the sketch
+                if (__atomic_load_n(&stop_, __ATOMIC_ACQUIRE))
+                {
+                    break;
+                }
+                if (++idle < SHARD_IDLE_SPINS)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                // Announce the park before the last look at the queue, pairs with the fence in `push`
+                std::unique_lock<std::mutex> lock(s.park_mutex);
+                __atomic_store_n(&s.parked, true, __ATOMIC_RELAXED);
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                s.park_cv.wait(lock, [this, &s]() { return !s.queue.empty() || __atomic_load_n(&stop_, __ATOMIC_ACQUIRE); });
+                __atomic_store_n(&s.parked, false, __ATOMIC_RELAXED);
+                idle = 0;
+                continue;
+            }
+            idle = 0;
+            // Runs of equal counts are applied as one batch, the plugin's updates all count 1
+            size_t start = 0;
+            while (start < n)
+            {
+                size_t end = start;
+                while (end < n && updates[end].count == updates[start].count)
+                {
+                    hashes[end - start] = updates[end].hash;
+                    end++;
+                }
+                s.sketch_ptr->update_batch(hashes, end - start, updates[start].count);
+                // After the counters like `sketch_impl::update`, the filter bits are relaxed atomics shared by the workers
+                if (novelty_)
+                {
+                    for (size_t i = 0; i < end - start; ++i)
+                    {
+                        novelty_->insert(hashes[i]);
+                    }
+                }
+                start = end;
+            }
+            __atomic_add_fetch(&s.applied, (uint64_t)n, __ATOMIC_RELEASE);
+        }
+    }
+
+    shard& get_shard(const XXH128_hash_t& hash) const
+    {
+        // Both halves are mixed, so the keys of a shard still spread over all buckets and Bloom filter blocks of its sketch
+        uint64_t mixed = (hash.low64 ^ hash.high64) * 0x9E3779B97F4A7C15ULL;
+        return *shards_[(size_t)(((unsigned __int128)mixed * shards_.size()) >> 64)];
+    }
+
+    pending_slot& get_pending_slot(shard& s, const XXH128_hash_t& hash) const
+    {
+        // Low half, `get_shard` picks the shard from the high bits of the mixed halves
+        return s.pending[hash.low64 & (s.pending.size() - 1)];
+    }
+
+    void push(shard& s, const XXH128_hash_t& hash, uint64_t count)
+    {
+        if (!s.queue.try_push(shard_update{hash, count}))
+        {
+            __atomic_add_fetch(&stalls_, (uint64_t)1, __ATOMIC_RELAXED);
+            while (!s.queue.try_push(shard_update{hash, count}))
+            {
+                std::this_thread::yield();
+            }
+        }
+        uint64_t pushed = s.pushed + 1;
+        __atomic_store_n(&s.pushed, pushed, __ATOMIC_RELAXED);
+        // Re-read the watermark once per worker batch, a stale read only keeps counts pending longer
+        if (pushed % SHARD_BATCH_SIZE == 0)
+        {
+            s.seen_applied = __atomic_load_n(&s.applied, __ATOMIC_ACQUIRE);
+        }
+        auto& slot = get_pending_slot(s, hash);
+        slot.count = (slot.end > s.seen_applied ? slot.count : 0) + count;
+        slot.end = pushed;
+        // Pairs with the fence of a parking worker, either it sees the update or the producer sees it parked
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&s.parked, __ATOMIC_RELAXED))
+        {
+            std::lock_guard<std::mutex> lock(s.park_mutex);
+            s.park_cv.notify_one();
+        }
+    }
+
+    uint64_t estimate_applied(const shard& s, const XXH128_hash_t& hash) const
+    {
+        if (novelty_ && !novelty_->maybe_seen(hash))
+        {
+            return 0;
+        }
+        return s.sketch_ptr->estimate(hash);
+    }
+
+    static void wait_applied(const shard& s)
+    {
+        uint64_t target = __atomic_load_n(&s.pushed, __ATOMIC_RELAXED);
+        while (__atomic_load_n(&s.applied, __ATOMIC_ACQUIRE) < target)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+public:
+    // `make_shard` creates the sketch of each shard, sized for about 1 / n_shards of the keys
+    sharded_sketch(factory make_shard, uint32_t n_shards, size_t queue_capacity)
+    {
+        n_shards = std::max<uint32_t>(1, n_shards);
+        for (uint32_t j = 0; j < n_shards; ++j)
+        {
+            shards_.push_back(std::make_unique<shard>(make_shard(), queue_capacity));
+        }
+        for (auto& s : shards_)
+        {
+            shard* p = s.get();
+            s->worker = std::thread([this, p]() { run(*p); });
+        }
+    }
+
+    sharded_sketch(const sharded_sketch&) = delete;
+    sharded_sketch& operator=(const sharded_sketch&) = delete;
+
+    ~sharded_sketch() override
+    {
+        __atomic_store_n(&stop_, true, __ATOMIC_RELEASE);
+        for (auto& s : shards_)
+        {
+            {
+                std::lock_guard<std::mutex> lock(s->park_mutex);
+                s->park_cv.notify_one();
+            }
+            if (s->worker.joinable())
+            {
+                s->worker.join();
+            }
+        }
+    }
+
+    using sketch::update;
+    using sketch::estimate;
+
+    // Single producer, like the event parsing thread
+    void update(const XXH128_hash_t& hash, uint64_t count) override
+    {
+        push(get_shard(hash), hash, count);
+    }
+
+    void update_batch(const XXH128_hash_t* hashes, size_t n, uint64_t count) override
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            update(hashes[i], count);
+        }
+    }
+
+    // Any thread, only the updates the workers have applied so far
+    uint64_t estimate(const XXH128_hash_t& hash) const override
+    {
+        return estimate_applied(get_shard(hash), hash);
+    }
+
+    // Producer only, also counts the updates of `hash` still queued for its shard, without waiting for the worker
+    uint64_t estimate_with_queued(const XXH128_hash_t& hash)
+    {
+        shard& s = get_shard(hash);
+        // Updates before the watermark are in the counters, the later ones are all in their live pending slot
+        s.seen_applied = __atomic_load_n(&s.applied, __ATOMIC_ACQUIRE);
+        const auto& slot = get_pending_slot(s, hash);
+        return estimate_applied(s, hash) + (slot.end > s.seen_applied ? slot.count : 0);
+    }
+
+    void flush() override
+    {
+        for (const auto& s : shards_)
+        {
+            wait_applied(*s);
+        }
+    }
+
+    void reset() override
+    {
+        // Filter first, see `sketch_impl::reset`
+        if (novelty_)
+        {
+            novelty_->reset();
+        }
+        for (auto& s : shards_)
+        {
+            s->sketch_ptr->reset();
+        }
+        if (topk_)
+        {
+            topk_->clear();
+        }
+    }
+
+    void rotate() override
+    {
+        if (novelty_)
+        {
+            novelty_->rotate(get_slices());
+        }
+        for (auto& s : shards_)
+        {
+            s->sketch_ptr->rotate();
+        }
+        if (topk_)
+        {
+            topk_->clear();
+        }
+    }
+
+    uint32_t get_slices() const override { return shards_[0]->sketch_ptr->get_slices(); }
+
+    size_t get_size_bytes() const override
+    {
+        size_t size = novelty_ ? novelty_->get_size_bytes() : 0;
+        for (const auto& s : shards_)
+        {
+            size += s->sketch_ptr->get_size_bytes() + s->queue.get_size_bytes() + s->pending.size() * sizeof(pending_slot);
+        }
+        return size;
+    }
+
+    uint64_t get_d() const override { return shards_[0]->sketch_ptr->get_d(); }
+
+    // Cols of all shards, the error bound of the sharded sketch is the one of a single sketch that wide
+    uint64_t get_w() const override
+    {
+        uint64_t w = 0;
+        for (const auto& s : shards_)
+        {
+            w += s->sketch_ptr->get_w();
+        }
+        return w;
+    }
+
+    static std::string get_shard_path(const std::string& path, size_t j)
+    {
+        return path + ".shard" + std::to_string(j);
+    }
+
+    // One file per shard, call `flush` first to include the queued updates
+    bool save_snapshot(const std::string& path, uint64_t fingerprint) const override
+    {
+        bool ok = true;
+        for (size_t j = 0; j < shards_.size(); ++j)
+        {
+            ok = shards_[j]->sketch_ptr->save_snapshot(get_shard_path(path, j), fingerprint) && ok;
+        }
+        return ok;
+    }
+
+    bool load_snapshot(const std::string& path, uint64_t fingerprint) override
+    {
+        for (size_t j = 0; j < shards_.size(); ++j)
+        {
+            if (!shards_[j]->sketch_ptr->load_snapshot(get_shard_path(path, j), fingerprint))
+            {
+                // All or nothing, shards restored so far are cleared again
+                for (size_t k = 0; k < j; ++k)
+                {
+                    shards_[k]->sketch_ptr->reset();
+                }
+                return false;
+            }
+        }
+        if (novelty_)
+        {
+            novelty_->bypass(get_slices());
+        }
+        return true;
+    }
+
+    // Not supported, the shards do not add up to the dimensions of a plain sketch the wire format describes
+    std::string serialize(uint64_t fingerprint) const override { return std::string(); }
+
+    cms_stats get_stats() const override
+    {
+        cms_stats stats = {0.0, 0};
+        for (const auto& s : shards_)
+        {
+            auto shard_stats = s->sketch_ptr->get_stats();
+            stats.fill_ratio += shard_stats.fill_ratio / shards_.size();
+            stats.total += shard_stats.total;
+        }
+        return stats;
+    }
+
+    size_t get_shards() const
+    {
+        return shards_.size();
+    }
+
+    // Updates queued and not yet applied, approximate
+    uint64_t get_pending() const
+    {
+        uint64_t pending = 0;
+        for (const auto& s : shards_)
+        {
+            pending += s->queue.size();
+        }
+        return pending;
+    }
+
+    uint64_t get_stalls() const
+    {
+        return __atomic_load_n(&stalls_, __ATOMIC_RELAXED);
+    }
+};
+
+} // namespace plugin::anomalydetection::num
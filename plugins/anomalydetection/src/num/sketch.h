@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "xxhash_ext.h"
+#include "snapshot.h"
+#include "wire.h"
+#include "topk.h"
+#include "bloom.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+/*
+Common interface of the counting sketches, allows each behavior profile to select its own sketch type.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+class sketch
+{
+public:
+    virtual ~sketch() = default;
+
+    virtual void update(const XXH128_hash_t& hash, uint64_t count) = 0;
+
+    // Update n keys at once, see `cms::update_batch`
+    virtual void update_batch(const XXH128_hash_t* hashes, size_t n, uint64_t count) = 0;
+
+    virtual uint64_t estimate(const XXH128_hash_t& hash) const = 0;
+
+    // Drop all counts
+    virtual void reset() = 0;
+
+    // Periodic forgetting step, called by the reset worker every reset interval / `get_slices`
+    virtual void rotate() = 0;
+
+    virtual uint32_t get_slices() const = 0;
+
+    virtual size_t get_size_bytes() const = 0;
+
+    virtual uint64_t get_d() const = 0;
+
+    virtual uint64_t get_w() const = 0;
+
+    // Persist the counters, `fingerprint` identifies the behavior profile definition they were learned for
+    virtual bool save_snapshot(const std::string& path, uint64_t fingerprint) const = 0;
+
+    // Restore counters persisted by `save_snapshot`, fails without side effects on any mismatch
+    virtual bool load_snapshot(const std::string& path, uint64_t fingerprint) = 0;
+
+    // Encode the counters in the compact wire format, see `merge_serialized`
+    virtual std::string serialize(uint64_t fingerprint) const = 0;
+
+    // Occupancy of the counters, see `cms::get_stats`
+    virtual cms_stats get_stats() const = 0;
+
+    // Wait until the updates handed to worker threads are applied, no-op for sketches updated in place, see `sharded_sketch`
+    virtual void flush() {}
+
+    // Attach heavy hitter and rare item tracking, fed by the caller and cleared together with the counts
+    void enable_topk(size_t k, size_t rare_capacity)
+    {
+        topk_ = std::make_unique<num::topk>(k, rare_capacity);
+    }
+
+    // Return the attached tracking, nullptr if not enabled
+    num::topk* get_topk() const
+    {
+        return topk_.get();
+    }
+
+    // Attach a novelty filter sized for `capacity` distinct keys, estimates of keys never seen skip the sketch
+    void enable_novelty_filter(uint64_t capacity)
+    {
+        novelty_ = std::make_unique<num::novelty_filter>(capacity);
+    }
+
+    // Return the attached novelty filter, nullptr if not enabled
+    const num::novelty_filter* get_novelty_filter() const
+    {
+        return novelty_.get();
+    }
+
+    static XXH128_hash_t hash(std::string_view value)
+    {
+        return XXH3_128bits(value.data(), value.size());
+    }
+
+    void update(std::string_view value, uint64_t count)
+    {
+        if (!value.empty())
+        {
+            update(hash(value), count);
+        }
+    }
+
+    uint64_t estimate(std::string_view value) const
+    {
+        return value.empty() ? 0 : estimate(hash(value));
+    }
+
+protected:
+    std::unique_ptr<num::topk> topk_;
+    std::unique_ptr<num::novelty_filter> novelty_;
+};
+
+// Adapts a concrete sketch (e.g. `cms<T>`, `cms_window<T>`) to the common interface
+template<typename S>
+class sketch_impl : public sketch
+{
+private:
+    S sketch_;
+
+public:
+    template<typename... Args>
+    explicit sketch_impl(Args&&... args) : sketch_(std::forward<Args>(args)...) {}
+
+    using sketch::update;
+    using sketch::estimate;
+
+    using counter_type = typename S::counter_type;
+
+    void update(const XXH128_hash_t& hash, uint64_t count) override
+    {
+        // Clamp to the counter type, the counters saturate anyway
+        sketch_.update(hash, static_cast<counter_type>(std::min<uint64_t>(count, std::numeric_limits<counter_type>::max())));
+        // After the counters, so a concurrent `reset` either drops both or the filter keeps the key, see `reset`
+        if (novelty_)
+        {
+            novelty_->insert(hash);
+        }
+    }
+
+    void update_batch(const XXH128_hash_t* hashes, size_t n, uint64_t count) override
+    {
+        sketch_.update_batch(hashes, n, static_cast<counter_type>(std::min<uint64_t>(count, std::numeric_limits<counter_type>::max())));
+        if (novelty_)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                novelty_->insert(hashes[i]);
+            }
+        }
+    }
+
+    uint64_t estimate(const XXH128_hash_t& hash) const override
+    {
+        // Novelty fast path, a single probe answers 0 for keys never seen
+        if (novelty_ && !novelty_->maybe_seen(hash))
+        {
+            return 0;
+        }
+        return sketch_.estimate(hash);
+    }
+
+    void reset() override
+    {
+        // Filter first: an update racing with the reset then counts in the dropped counters or sets its filter bits
+        // after the clear, so the race can only answer "maybe seen", never 0 for a counted key
+        if (novelty_)
+        {
+            novelty_->reset();
+        }
+        sketch_.reset();
+        if (topk_)
+        {
+            topk_->clear();
+        }
+    }
+
+    void rotate() override
+    {
+        // Filter first as in `reset`. Tracked items re-enter with their remaining counts, which for sliding windows
+        // include the unexpired slices
+        if (novelty_)
+        {
+            novelty_->rotate(sketch_.get_slices());
+        }
+        sketch_.rotate();
+        if (topk_)
+        {
+            topk_->clear();
+        }
+    }
+
+    uint32_t get_slices() const override { return sketch_.get_slices(); }
+
+    size_t get_size_bytes() const override { return sketch_.get_size_bytes() + (novelty_ ? novelty_->get_size_bytes() : 0); }
+
+    uint64_t get_d() const override { return sketch_.get_d(); }
+
+    uint64_t get_w() const override { return sketch_.get_w(); }
+
+    bool save_snapshot(const std::string& path, uint64_t fingerprint) const override { return num::save_snapshot(sketch_, path, fingerprint); }
+
+    bool load_snapshot(const std::string& path, uint64_t fingerprint) override
+    {
+        if (!num::load_snapshot(sketch_, path, fingerprint))
+        {
+            return false;
+        }
+        if (novelty_)
+        {
+            // The restored keys are unknown to the filter until they expire
+            novelty_->bypass(sketch_.get_slices());
+        }
+        return true;
+    }
+
+    std::string serialize(uint64_t fingerprint) const override { return num::serialize(sketch_, fingerprint); }
+
+    cms_stats get_stats() const override { return sketch_.get_stats(); }
+
+    S& get() { return sketch_; }
+
+    const S& get() const { return sketch_; }
+};
+
+} // namespace plugin::anomalydetection::num
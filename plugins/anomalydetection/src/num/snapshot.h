@@ -0,0 +1,232 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+Binary snapshots of the sketch counters to warm restart with the learned baseline.
+Layout: a fixed 64 byte header followed by the raw counters, slice by slice (oldest first) and Row by Row,
+in host byte order. Snapshots are loaded via a read-only memory mapping.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+static constexpr uint64_t SNAPSHOT_MAGIC = 0x3150414e53534d43ULL; // "CMSSNAP1"
+static constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+struct snapshot_header
+{
+    uint64_t magic = SNAPSHOT_MAGIC;
+    uint32_t version = SNAPSHOT_VERSION;
+    uint32_t counter_bytes = 0; // Width of one counter
+    uint64_t d = 0; // Rows
+    uint64_t w = 0; // Cols
+    double gamma = 0; // Informational, d and w define the layout
+    double eps = 0;
+    uint64_t fingerprint = 0; // Hash of the behavior profile definition the counts were learned for
+    uint32_t slices = 0; // 1 for a plain sketch, k for a sliding window sketch
+    uint32_t reserved = 0;
+};
+
+static_assert(sizeof(snapshot_header) == 64, "snapshot header layout must stay stable");
+
+// Read-only memory mapping of a snapshot file
+class snapshot_mapping
+{
+private:
+    void* data_ = MAP_FAILED;
+    size_t size_ = 0;
+
+public:
+    explicit snapshot_mapping(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat st = {};
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(snapshot_header))
+        {
+            size_ = st.st_size;
+            data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd); // The mapping stays valid
+    }
+
+    ~snapshot_mapping()
+    {
+        if (data_ != MAP_FAILED)
+        {
+            munmap(data_, size_);
+        }
+    }
+
+    snapshot_mapping(const snapshot_mapping&) = delete;
+    snapshot_mapping& operator=(const snapshot_mapping&) = delete;
+
+    bool is_valid() const { return data_ != MAP_FAILED; }
+
+    const snapshot_header& header() const { return *static_cast<const snapshot_header*>(data_); }
+
+    const void* counters() const { return static_cast<const char*>(data_) + sizeof(snapshot_header); }
+
+    size_t counters_bytes() const { return size_ - sizeof(snapshot_header); }
+};
+
+// Write `header` followed by `size` bytes of counters to `path`, replaced atomically via a temporary file
+inline bool write_snapshot(const std::string& path, const snapshot_header& header, const void* counters, size_t size)
+{
+    std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (f == nullptr)
+    {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && (size == 0 || fwrite(counters, 1, size, f) == size);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Write the counters of `sketch` (`cms<T>` or `cms_window<T>`) to `path`, replaced atomically via a temporary file
+template<typename S>
+bool save_snapshot(const S& sketch, const std::string& path, uint64_t fingerprint)
+{
+    using T = typename S::counter_type;
+    snapshot_header header;
+    header.counter_bytes = sizeof(T);
+    header.d = sketch.get_d();
+    header.w = sketch.get_w();
+    header.gamma = sketch.get_gamma();
+    header.eps = sketch.get_eps();
+    header.fingerprint = fingerprint;
+    header.slices = sketch.get_slices();
+
+    std::vector<T> counters(header.slices * header.d * header.w);
+    sketch.export_counters(counters.data());
+    return write_snapshot(path, header, counters.data(), counters.size() * sizeof(T));
+}
+
+// Restore counters written by `save_snapshot`, leaves `sketch` untouched unless the snapshot matches its type, dimensions and `fingerprint`
+template<typename S>
+bool load_snapshot(S& sketch, const std::string& path, uint64_t fingerprint)
+{
+    using T = typename S::counter_type;
+    snapshot_mapping mapping(path);
+    if (!mapping.is_valid())
+    {
+        return false;
+    }
+    const auto& header = mapping.header();
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || header.counter_bytes != sizeof(T)
+        || header.fingerprint != fingerprint || header.d != sketch.get_d() || header.w != sketch.get_w()
+        || header.slices != sketch.get_slices()
+        || mapping.counters_bytes() != header.slices * header.d * header.w * sizeof(T))
+    {
+        return false;
+    }
+    sketch.import_counters(static_cast<const T*>(mapping.counters()));
+    return true;
+}
+
+template<typename T>
+bool merge_snapshot_counters(const std::vector<std::unique_ptr<snapshot_mapping>>& mappings, const std::string& path)
+{
+    std::vector<T> sum(mappings[0]->counters_bytes() / sizeof(T), 0);
+    for (const auto& mapping : mappings)
+    {
+        const T* counters = static_cast<const T*>(mapping->counters());
+        for (size_t i = 0; i < sum.size(); ++i)
+        {
+            // Saturate like the sketch counters
+            T value = sum[i] + counters[i];
+            sum[i] = value < sum[i] ? std::numeric_limits<T>::max() : value;
+        }
+    }
+    return write_snapshot(path, mappings[0]->header(), sum.data(), sum.size() * sizeof(T));
+}
+
+/*
+Sum the counters of snapshots learned for the same behavior profile on disjoint parts of the events, e.g. the chunks of
+a capture replayed in parallel, into one snapshot at `path`. Sliding window slices are summed slice by slice.
+Writes nothing unless all inputs match in counter width, dimensions, slices and fingerprint.
+*/
+inline bool merge_snapshots(const std::vector<std::string>& inputs, const std::string& path)
+{
+    std::vector<std::unique_ptr<snapshot_mapping>> mappings;
+    for (const auto& input : inputs)
+    {
+        auto mapping = std::make_unique<snapshot_mapping>(input);
+        if (!mapping->is_valid())
+        {
+            return false;
+        }
+        const auto& header = mapping->header();
+        if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION
+            || mapping->counters_bytes() != header.slices * header.d * header.w * header.counter_bytes)
+        {
+            return false;
+        }
+        if (!mappings.empty())
+        {
+            const auto& first = mappings[0]->header();
+            if (header.counter_bytes != first.counter_bytes || header.d != first.d || header.w != first.w
+                || header.slices != first.slices || header.fingerprint != first.fingerprint)
+            {
+                return false;
+            }
+        }
+        mappings.push_back(std::move(mapping));
+    }
+    if (mappings.empty())
+    {
+        return false;
+    }
+    switch (mappings[0]->header().counter_bytes)
+    {
+    case 1:
+        return merge_snapshot_counters<uint8_t>(mappings, path);
+    case 2:
+        return merge_snapshot_counters<uint16_t>(mappings, path);
+    case 4:
+        return merge_snapshot_counters<uint32_t>(mappings, path);
+    case 8:
+        return merge_snapshot_counters<uint64_t>(mappings, path);
+    default:
+        return false;
+    }
+}
+
+} // namespace plugin::anomalydetection::num
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "aligned_buffer.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+/*
+Bounded lock-free single producer single consumer ring buffer.
+The producer owns `tail_`, the consumer owns `head_`, each on its own cache line next to a cached copy of the other
+side's index, so the shared indices are only re-read when the queue looks full (producer) or short of a batch (consumer).
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+template<typename T>
+class spsc_queue
+{
+private:
+    std::vector<T> buffer_;
+    uint64_t mask_; // Capacity - 1, the capacity is a power of two
+
+    alignas(CACHE_LINE_SIZE) uint64_t head_ = 0; // Next slot to pop, written by the consumer
+    uint64_t cached_tail_ = 0; // Consumer's last seen `tail_`
+
+    alignas(CACHE_LINE_SIZE) uint64_t tail_ = 0; // Next slot to push, written by the producer
+    uint64_t cached_head_ = 0; // Producer's last seen `head_`
+
+public:
+    explicit spsc_queue(size_t capacity)
+    {
+        uint64_t n = 2;
+        while (n < capacity)
+        {
+            n <<= 1;
+        }
+        buffer_.resize(n);
+        mask_ = n - 1;
+    }
+
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+
+    // Producer only, returns false if the queue is full
+    bool try_push(const T& value)
+    {
+        uint64_t tail = tail_;
+        if (tail - cached_head_ > mask_)
+        {
+            cached_head_ = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+            if (tail - cached_head_ > mask_)
+            {
+                return false;
+            }
+        }
+        buffer_[tail & mask_] = value;
+        __atomic_store_n(&tail_, tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Consumer only, moves up to `max` values to `out` and returns their number
+    size_t pop_batch(T* out, size_t max)
+    {
+        uint64_t head = head_;
+        if (cached_tail_ - head < max)
+        {
+            cached_tail_ = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+            if (cached_tail_ == head)
+            {
+                return 0;
+            }
+        }
+        size_t n = (size_t)std::min<uint64_t>(max, cached_tail_ - head);
+        for (size_t i = 0; i < n; ++i)
+        {
+            out[i] = buffer_[(head + i) & mask_];
+        }
+        __atomic_store_n(&head_, head + n, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    // Approximate from any thread other than the two sides
+    size_t size() const
+    {
+        uint64_t head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        uint64_t tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+        return tail > head ? (size_t)(tail - head) : 0;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    size_t capacity() const
+    {
+        return (size_t)(mask_ + 1);
+    }
+
+    size_t get_size_bytes() const
+    {
+        return buffer_.size() * sizeof(T);
+    }
+};
+
+} // namespace plugin::anomalydetection::num
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "xxhash_ext.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+Sketch updates of a behavior profile staged for one batched `update_batch`, with the occurrences of each hash in the
+batch kept in a small open addressing table, so the top-k tracking counts the staged updates of a hash in O(1)
+instead of rescanning the batch. Only the slots taken by the batch are cleared.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+class staged_batch
+{
+private:
+    struct slot
+    {
+        XXH128_hash_t hash;
+        uint32_t count; // 0 if free
+    };
+
+    std::vector<XXH128_hash_t> hashes_;
+    std::vector<slot> slots_; // At least twice the batch capacity, a power of two
+    std::vector<uint32_t> taken_;
+    uint64_t mask_ = 0;
+
+    size_t probe(const XXH128_hash_t& hash) const
+    {
+        size_t i = (size_t)(hash.low64 & mask_);
+        while (slots_[i].count != 0 && (slots_[i].hash.low64 != hash.low64 || slots_[i].hash.high64 != hash.high64))
+        {
+            i = (i + 1) & mask_;
+        }
+        return i;
+    }
+
+public:
+    explicit staged_batch(size_t capacity = 1)
+    {
+        size_t n = 2;
+        while (n < 2 * capacity)
+        {
+            n <<= 1;
+        }
+        slots_.assign(n, slot{{0, 0}, 0});
+        mask_ = n - 1;
+        hashes_.reserve(capacity);
+        taken_.reserve(capacity);
+    }
+
+    // Stage one update, at most `capacity` until `clear`
+    void push(const XXH128_hash_t& hash)
+    {
+        hashes_.push_back(hash);
+        size_t i = probe(hash);
+        if (slots_[i].count++ == 0)
+        {
+            slots_[i].hash = hash;
+            taken_.push_back((uint32_t)i);
+        }
+    }
+
+    // Staged updates of `hash`
+    uint32_t count(const XXH128_hash_t& hash) const
+    {
+        return slots_[probe(hash)].count;
+    }
+
+    void clear()
+    {
+        for (uint32_t i : taken_)
+        {
+            slots_[i].count = 0;
+        }
+        taken_.clear();
+        hashes_.clear();
+    }
+
+    const XXH128_hash_t* data() const { return hashes_.data(); }
+
+    size_t size() const { return hashes_.size(); }
+
+    bool empty() const { return hashes_.empty(); }
+};
+
+} // namespace plugin::anomalydetection::num
@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "xxhash_ext.h"
+
+#include <cstdint>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Heavy hitters and rare items of a sketch. The counts are the estimates of the sketch itself (sketch + heap top-k),
+so only the k labels need to be stored and an item entering the top k starts with its full count.
+The tracked items are indexed by hash and ordered in a min-heap by count: raising a count is one lookup and a sift
+of O(log k), deciding whether an untracked item enters the top k reads the heap root.
+Labels (e.g. behavior profile strings) are only handed over when an item enters the top k or is first seen.
+Single writer: the event parsing thread owns the tracked items and raises their counts without locking, the mutex is
+only taken when it replaces items and by readers copying them. `clear` may be called from any thread, it is applied
+by the writer at its next call.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+class topk
+{
+public:
+    struct item
+    {
+        XXH128_hash_t hash;
+        uint64_t count;
+        std::string label;
+    };
+
+private:
+    mutable std::mutex mutex_; // Guards the item vectors against readers while the writer changes them
+    size_t k_;
+    size_t rare_capacity_;
+    std::vector<item> items_; // At most k tracked heavy hitters, slots in insertion order
+    std::vector<uint32_t> heap_; // Slots of `items_`, min-heap by count, writer only
+    std::vector<uint32_t> heap_pos_; // Position of each slot in `heap_`, writer only
+    std::unordered_map<uint64_t, uint32_t> index_; // Low half of the hash to slot, writer only
+    std::vector<item> rare_; // Ring of the most recently first seen items
+    size_t rare_next_ = 0;
+    uint64_t clears_requested_ = 0; // Raised by `clear`
+    uint64_t clears_applied_ = 0; // Requests the writer dropped the items for, changed under the mutex
+
+    static bool equal(const XXH128_hash_t& a, const XXH128_hash_t& b)
+    {
+        return a.low64 == b.low64 && a.high64 == b.high64;
+    }
+
+    // Writer only, slot of a tracked item or -1, distinct items sharing the low half are not tracked both
+    int64_t find(const XXH128_hash_t& hash) const
+    {
+        auto it = index_.find(hash.low64);
+        return it != index_.end() && equal(items_[it->second].hash, hash) ? (int64_t)it->second : -1;
+    }
+
+    uint64_t heap_count(size_t pos) const
+    {
+        return items_[heap_[pos]].count;
+    }
+
+    void heap_swap(size_t a, size_t b)
+    {
+        std::swap(heap_[a], heap_[b]);
+        heap_pos_[heap_[a]] = (uint32_t)a;
+        heap_pos_[heap_[b]] = (uint32_t)b;
+    }
+
+    void sift_up(size_t pos)
+    {
+        while (pos > 0 && heap_count(pos) < heap_count((pos - 1) / 2))
+        {
+            heap_swap(pos, (pos - 1) / 2);
+            pos = (pos - 1) / 2;
+        }
+    }
+
+    void sift_down(size_t pos)
+    {
+        while (true)
+        {
+            size_t min = pos;
+            for (size_t child = 2 * pos + 1; child <= 2 * pos + 2 && child < heap_.size(); ++child)
+            {
+                min = heap_count(child) < heap_count(min) ? child : min;
+            }
+            if (min == pos)
+            {
+                return;
+            }
+            heap_swap(pos, min);
+            pos = min;
+        }
+    }
+
+    // Writer only, drops the items if a `clear` is pending
+    void apply_clear()
+    {
+        uint64_t requested = __atomic_load_n(&clears_requested_, __ATOMIC_ACQUIRE);
+        if (requested != clears_applied_)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            items_.clear();
+            heap_.clear();
+            heap_pos_.clear();
+            index_.clear();
+            rare_.clear();
+            rare_next_ = 0;
+            clears_applied_ = requested;
+        }
+    }
+
+    // Readers under the mutex, the items are stale while a `clear` is pending
+    bool clear_pending() const
+    {
+        return __atomic_load_n(&clears_requested_, __ATOMIC_ACQUIRE) != clears_applied_;
+    }
+
+    // Reader copy, the counts are raised concurrently by the writer
+    static item load(const item& i)
+    {
+        return {i.hash, __atomic_load_n(&i.count, __ATOMIC_RELAXED), i.label};
+    }
+
+public:
+    topk(size_t k, size_t rare_capacity) : k_(k), rare_capacity_(rare_capacity)
+    {
+        items_.reserve(k_);
+        heap_.reserve(k_);
+        heap_pos_.reserve(k_);
+        index_.reserve(k_);
+        rare_.reserve(rare_capacity_);
+    }
+
+    // Writer only, raise the count of a tracked item to `count`, returns false if the item is not tracked
+    bool update(const XXH128_hash_t& hash, uint64_t count)
+    {
+        apply_clear();
+        int64_t slot = find(hash);
+        if (slot < 0)
+        {
+            return false;
+        }
+        auto& i = items_[slot];
+        if (count > i.count)
+        {
+            __atomic_store_n(&i.count, count, __ATOMIC_RELAXED);
+            sift_down(heap_pos_[slot]);
+        }
+        return true;
+    }
+
+    // Writer only, return true if an untracked item with `count` would enter the top k
+    bool admits(uint64_t count)
+    {
+        apply_clear();
+        return k_ > 0 && (items_.size() < k_ || count > heap_count(0));
+    }
+
+    // Writer only, track an untracked item, replacing the smallest tracked item once k items are tracked
+    void insert(const XXH128_hash_t& hash, uint64_t count, std::string label)
+    {
+        apply_clear();
+        if (k_ == 0 || index_.count(hash.low64) > 0)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (items_.size() < k_)
+        {
+            uint32_t slot = (uint32_t)items_.size();
+            items_.push_back({hash, count, std::move(label)});
+            heap_.push_back(slot);
+            heap_pos_.push_back(slot);
+            index_.emplace(hash.low64, slot);
+            sift_up(heap_.size() - 1);
+            return;
+        }
+        uint32_t slot = heap_[0];
+        if (count > items_[slot].count)
+        {
+            index_.erase(items_[slot].hash.low64);
+            items_[slot] = {hash, count, std::move(label)};
+            index_.emplace(hash.low64, slot);
+            sift_down(0);
+        }
+    }
+
+    // Writer only, record a first seen item, the oldest record is dropped once the ring is full
+    void insert_rare(const XXH128_hash_t& hash, std::string label)
+    {
+        apply_clear();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (rare_capacity_ == 0)
+        {
+            return;
+        }
+        for (const auto& i : rare_)
+        {
+            if (equal(i.hash, hash))
+            {
+                return;
+            }
+        }
+        if (rare_.size() < rare_capacity_)
+        {
+            rare_.push_back({hash, 1, std::move(label)});
+        } else
+        {
+            rare_[rare_next_] = {hash, 1, std::move(label)};
+        }
+        rare_next_ = (rare_next_ + 1) % rare_capacity_;
+    }
+
+    // Return the tracked heavy hitters, highest count first
+    std::vector<item> get_top() const
+    {
+        std::vector<item> top;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (clear_pending())
+            {
+                return top;
+            }
+            top.reserve(items_.size());
+            for (const auto& i : items_)
+            {
+                top.push_back(load(i));
+            }
+        }
+        std::sort(top.begin(), top.end(), [](const item& a, const item& b) { return a.count > b.count; });
+        return top;
+    }
+
+    // Return the recorded rare items, most recent first
+    std::vector<item> get_rare() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<item> rare;
+        if (clear_pending())
+        {
+            return rare;
+        }
+        rare.reserve(rare_.size());
+        for (size_t i = 1; i <= rare_.size(); ++i)
+        {
+            rare.push_back(rare_[(rare_next_ + rare_.size() - i) % rare_.size()]);
+        }
+        return rare;
+    }
+
+    // Forget all items, called whenever the counts of the sketch are reset or expire
+    void clear()
+    {
+        __atomic_add_fetch(&clears_requested_, (uint64_t)1, __ATOMIC_RELEASE);
+    }
+
+    size_t get_k() const { return k_; }
+
+    size_t get_rare_capacity() const { return rare_capacity_; }
+};
+
+} // namespace plugin::anomalydetection::num
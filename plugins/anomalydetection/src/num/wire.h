@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "cms.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+Compact wire format to exchange sketches between nodes. Sketches are linear, the fleet-wide counts are the
+sum of the exchanged sketches of identical dimensions (see `cms::merge`).
+Layout: a fixed 48 byte header followed by the non-zero counters as LEB128 varint pairs
+(distance to the previous non-zero counter index, count). Sliding window sketches are collapsed to the sum of their slices.
+*/
+
+namespace plugin::anomalydetection::num
+{
+
+static constexpr uint64_t WIRE_MAGIC = 0x31455249575343ULL; // "CSWIRE1"
+static constexpr uint32_t WIRE_VERSION = 1;
+
+struct wire_header
+{
+    uint64_t magic = WIRE_MAGIC;
+    uint32_t version = WIRE_VERSION;
+    uint32_t reserved = 0;
+    uint64_t d = 0; // Rows
+    uint64_t w = 0; // Cols
+    uint64_t fingerprint = 0; // Hash of the behavior profile definition the counts were learned for
+    uint64_t nonzero = 0; // Number of encoded counters
+};
+
+static_assert(sizeof(wire_header) == 48, "wire header layout must stay stable");
+
+inline void put_varint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline bool get_varint(std::string_view in, size_t& pos, uint64_t& value)
+{
+    value = 0;
+    for (uint32_t shift = 0; shift < 64 && pos < in.size(); shift += 7)
+    {
+        uint8_t byte = static_cast<uint8_t>(in[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Encode the counters of `sketch` (`cms<T>` or `cms_window<T>`)
+template<typename S>
+std::string serialize(const S& sketch, uint64_t fingerprint)
+{
+    using T = typename S::counter_type;
+    wire_header header;
+    header.d = sketch.get_d();
+    header.w = sketch.get_w();
+    header.fingerprint = fingerprint;
+
+    uint64_t n = header.d * header.w;
+    std::vector<T> counters(sketch.get_slices() * n);
+    sketch.export_counters(counters.data());
+
+    std::string out(sizeof(header), '\0');
+    uint64_t last = 0;
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        uint64_t count = 0;
+        for (uint32_t slice = 0; slice < sketch.get_slices(); ++slice)
+        {
+            count += counters[slice * n + i];
+        }
+        if (count > 0)
+        {
+            put_varint(out, i - last);
+            put_varint(out, count);
+            last = i;
+            header.nonzero++;
+        }
+    }
+    std::memcpy(out.data(), &header, sizeof(header));
+    return out;
+}
+
+// Add the counts encoded in `data` to `fleet`, fails without side effects on any mismatch or malformed input
+inline bool merge_serialized(cms<uint64_t>& fleet, std::string_view data, uint64_t fingerprint)
+{
+    wire_header header;
+    if (data.size() < sizeof(header))
+    {
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != WIRE_MAGIC || header.version != WIRE_VERSION || header.fingerprint != fingerprint
+        || header.d != fleet.get_d() || header.w != fleet.get_w())
+    {
+        return false;
+    }
+
+    uint64_t n = header.d * header.w;
+    std::vector<uint64_t> counters(n, 0);
+    size_t pos = sizeof(header);
+    uint64_t index = 0;
+    for (uint64_t i = 0; i < header.nonzero; ++i)
+    {
+        uint64_t delta = 0;
+        uint64_t count = 0;
+        if (!get_varint(data, pos, delta) || !get_varint(data, pos, count) || delta >= n - index)
+        {
+            return false;
+        }
+        index += delta;
+        counters[index] = count;
+    }
+    if (pos != data.size())
+    {
+        return false;
+    }
+
+    cms<uint64_t> peer(header.d, header.w);
+    peer.import_counters(counters.data());
+    return fleet.merge(peer);
+}
+
+} // namespace plugin::anomalydetection::num
@@ -19,7 +19,9 @@ limitations under the License.
 
 #include <optional>
 #include <filesystem>
+#include <fstream>
 #include <sys/stat.h>
+#include <unistd.h>
 
 void anomalydetection::log_error(std::string err_mess)
 {
@@ -84,6 +86,77 @@ falcosecurity::init_schema anomalydetection::get_init_schema()
           },
           "minItems": 1
         },
+        "cols_pow2": {
+          "type": "boolean",
+          "description": "Round the number of cols / buckets of each sketch up to the next power of two, trading some memory for cheaper bucket lookups."
+        },
+        "huge_pages": {
+          "type": "boolean",
+          "description": "Back large sketches with transparent huge pages to reduce TLB misses."
+        },
+        "counter_bits": {
+          "type": "integer",
+          "enum": [
+            8,
+            16,
+            32,
+            64
+          ],
+          "description": "The width of each sketch counter in bits, smaller counters saturate at their maximum and allow proportionally more cols / buckets in the same memory."
+        },
+        "conservative_update": {
+          "type": "boolean",
+          "description": "Only raise the counters equal to the current minimum estimate on updates, reducing the overestimation of rare behaviors."
+        },
+        "update_batch_size": {
+          "type": "integer",
+          "minimum": 1,
+          "maximum": 64,
+          "description": "The number of behavior profile updates staged per sketch and then applied in one batch with prefetched sketch memory accesses, defaults to 16. Extracting a count applies the staged updates first. Set to 1 to disable batching."
+        },
+        "shards": {
+          "type": "integer",
+          "minimum": 1,
+          "maximum": 64,
+          "description": "Split each sketch by behavior profile hash into this many shards, each updated by its own worker thread fed through a lock-free queue, so the sketch updates scale across cores. Estimates also count the updates still queued. Shards split the sketch memory alike. Not combined with fleet_dir. Defaults to 1, updating the sketches on the event parsing thread."
+        },
+        "shard_queue_capacity": {
+          "type": "integer",
+          "minimum": 64,
+          "description": "The number of updates queued per shard before the event parsing thread waits for the shard's worker, defaults to 16384."
+        },
+        "stats_interval_ms": {
+          "type": "number",
+          "description": "Refresh the sketch occupancy metrics (fill_ratio, false_positive_rate, error_bound), which scan all sketch counters, every stats_interval_ms milliseconds (ms), defaults to 10000. Disabled if 0 or if periodic_workers is false, the metrics then keep the values computed at init."
+        },
+        "periodic_workers": {
+          "type": "boolean",
+          "description": "Run the wall clock driven background workers: reset_timer_ms resets and sliding window rotations, partition TTL evictions, HLL resets, periodic snapshots, top-k dumps, fleet exchanges and metrics refreshes. The sketch types and window slices are kept either way, so snapshots still match. Defaults to true, disabled by the offline trainer so a replay learns the whole capture regardless of its speed."
+        },
+        "topk_dump_interval_ms": {
+          "type": "number",
+          "description": "Log the tracked heavy hitters and rare behavior profiles of each sketch every topk_dump_interval_ms milliseconds (ms). Disabled if 0."
+        },
+        "snapshot_dir": {
+          "type": "string",
+          "description": "Directory to persist the sketch counts to on shutdown and to reload them from at startup, as long as the behavior profile definitions are unchanged. Disabled if empty."
+        },
+        "snapshot_interval_ms": {
+          "type": "number",
+          "description": "Additionally persist the sketch counts every snapshot_interval_ms milliseconds (ms). Disabled if 0."
+        },
+        "fleet_dir": {
+          "type": "string",
+          "description": "Directory shared across nodes (e.g. a synced volume) to periodically export this node's sketches to and to merge all nodes' sketches from into the fleet-wide sketches of the anomaly.count_min_sketch.fleet field. Disabled if empty."
+        },
+        "fleet_interval_ms": {
+          "type": "number",
+          "description": "The interval, in milliseconds (ms), of the fleet sketch exchange, defaults to 60000. Sketch files not refreshed within 3 intervals are ignored."
+        },
+        "node_id": {
+          "type": "string",
+          "description": "Unique name of this node's sketch files in fleet_dir, defaults to the hostname."
+        },
         "behavior_profiles": {
           "type": "array",
           "items": {
@@ -104,6 +177,69 @@ falcosecurity::init_schema anomalydetection::get_init_schema()
               "reset_timer_ms": {
                 "type": "number",
                 "description": "The anomaly detection behavior profile timer, in milliseconds (ms), is used to reset the sketch counts."
+              },
+              "sketch_type": {
+                "type": "string",
+                "enum": [
+                  "count_min_sketch",
+                  "sliding_window"
+                ],
+                "description": "The sketch type of the behavior profile. A sliding_window sketch counts over the last reset_timer_ms only, expiring its oldest slice every reset_timer_ms / window_slices instead of resetting all counts at once."
+              },
+              "window_slices": {
+                "type": "integer",
+                "minimum": 2,
+                "description": "The number of slices of a sliding_window sketch, each slice is a sub-sketch of the configured dimensions."
+              },
+              "topk": {
+                "type": "integer",
+                "minimum": 0,
+                "maximum": 1000,
+                "description": "The number of heavy hitter behavior profiles to track alongside the sketch, exposed via the anomaly.count_min_sketch.topk field. Disabled if 0."
+              },
+              "rare_items": {
+                "type": "integer",
+                "minimum": 0,
+                "maximum": 1000,
+                "description": "The number of most recently first seen behavior profiles to track alongside the sketch, exposed via the anomaly.count_min_sketch.rare field. Disabled if 0."
+              },
+              "hll_precision": {
+                "type": "integer",
+                "minimum": 4,
+                "maximum": 18,
+                "description": "Count the distinct behavior profiles with a HyperLogLog of 2^hll_precision one byte registers, exposed via the anomaly.hll.distinct field and reset together with the sketch every reset_timer_ms. Disabled if not set."
+              },
+              "novelty_filter_capacity": {
+                "type": "integer",
+                "minimum": 0,
+                "description": "Expected number of distinct behavior profiles per reset_timer_ms. Sizes a blocked Bloom filter in front of the sketch so that anomaly.count_min_sketch answers 0 for never seen behavior profiles with a single cache line probe. Not used by partitioned behavior profiles. Disabled if 0."
+              },
+              "partition_by": {
+                "type": "string",
+                "description": "Fields (e.g. %container.id) partitioning the behavior profile into one small sketch per distinct value, anomaly.count_min_sketch then returns the estimate within the partition of the event. Disabled if not set."
+              },
+              "partition_rows_cols": {
+                "type": "array",
+                "items": [
+                  {
+                    "type": "number"
+                  },
+                  {
+                    "type": "number"
+                  }
+                ],
+                "minItems": 2,
+                "maxItems": 2,
+                "description": "The rows / hash functions and cols / buckets of each partition's sketch, defaults to [3, 2048]."
+              },
+              "max_partitions": {
+                "type": "integer",
+                "minimum": 1,
+                "description": "The maximum number of partition sketches, the least recently updated partition is evicted to make room for a new one, defaults to 1024."
+              },
+              "partition_ttl_ms": {
+                "type": "number",
+                "description": "Evict partitions without updates for partition_ttl_ms milliseconds (ms). Disabled if 0."
               }
             },
             "required": [
@@ -126,8 +262,37 @@ void anomalydetection::parse_init_config(nlohmann::json& config_json)
     m_gamma_eps.clear();
     m_rows_cols.clear();
     m_reset_timers.clear();
+    m_window_slices.clear();
+    m_topk.clear();
+    m_hll_precisions.clear();
+    m_novelty_filter_capacities.clear();
+    m_partition_extractors.clear();
+    m_partition_rows_cols.clear();
+    m_max_partitions.clear();
+    m_partition_ttl_ms.clear();
+    m_rare_items.clear();
+    m_topk_dump_interval_ms = 0;
+    m_stats_interval_ms = 10000;
+    m_periodic_workers = true;
     m_behavior_profiles_fields.clear();
+    m_behavior_profiles_extractors.clear();
+    m_extraction_slots.clear();
+    m_lineage_depth = 0;
+    m_lineage_values.clear();
+    m_dirfd_cache_enabled = false;
     m_behavior_profiles_event_codes.clear();
+    m_event_code_profiles.assign(PPM_EVENT_MAX, std::vector<uint32_t>());
+    m_cms_options = plugin::anomalydetection::num::cms_options();
+    m_counter_bits = 64;
+    m_update_batch_size = 16;
+    m_shards = 1;
+    m_shard_queue_capacity = 16384;
+    m_snapshot_dir.clear();
+    m_snapshot_interval_ms = 0;
+    m_profile_fingerprints.clear();
+    m_fleet_dir.clear();
+    m_fleet_interval_ms = 60000;
+    m_node_id.clear();
     if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch")))
     {
         if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/enabled")))
@@ -146,6 +311,117 @@ void anomalydetection::parse_init_config(nlohmann::json& config_json)
                         .get_to(m_n_sketches);
             }
 
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/cols_pow2")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/cols_pow2"))
+                        .get_to(m_cms_options.pow2_cols);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/huge_pages")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/huge_pages"))
+                        .get_to(m_cms_options.huge_pages);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/counter_bits")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/counter_bits"))
+                        .get_to(m_counter_bits);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/conservative_update")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/conservative_update"))
+                        .get_to(m_cms_options.conservative_update);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/update_batch_size")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/update_batch_size"))
+                        .get_to(m_update_batch_size);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/shards")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/shards"))
+                        .get_to(m_shards);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/shard_queue_capacity")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/shard_queue_capacity"))
+                        .get_to(m_shard_queue_capacity);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/stats_interval_ms")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/stats_interval_ms"))
+                        .get_to(m_stats_interval_ms);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/periodic_workers")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/periodic_workers"))
+                        .get_to(m_periodic_workers);
+            }
+            if (!m_periodic_workers)
+            {
+                log_error("Count min sketch periodic workers are disabled, sketches are neither reset nor rotated by wall clock time");
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/topk_dump_interval_ms")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/topk_dump_interval_ms"))
+                        .get_to(m_topk_dump_interval_ms);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/snapshot_dir")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/snapshot_dir"))
+                        .get_to(m_snapshot_dir);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/snapshot_interval_ms")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/snapshot_interval_ms"))
+                        .get_to(m_snapshot_interval_ms);
+            }
+            if (!m_snapshot_dir.empty())
+            {
+                log_error("Count min sketch counts are persisted to (" + m_snapshot_dir + ") on shutdown"
+                + (m_snapshot_interval_ms > 100 ? " and every (" + std::to_string(m_snapshot_interval_ms) + ") ms" : ""));
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/fleet_dir")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/fleet_dir"))
+                        .get_to(m_fleet_dir);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/fleet_interval_ms")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/fleet_interval_ms"))
+                        .get_to(m_fleet_interval_ms);
+            }
+            if(config_json.contains(nlohmann::json::json_pointer("/count_min_sketch/node_id")))
+            {
+                config_json.at(nlohmann::json::json_pointer("/count_min_sketch/node_id"))
+                        .get_to(m_node_id);
+            }
+            if (!m_fleet_dir.empty())
+            {
+                if (m_node_id.empty())
+                {
+                    char hostname[256] = {0};
+                    m_node_id = gethostname(hostname, sizeof(hostname) - 1) == 0 ? hostname : "localhost";
+                }
+                log_error("Count min sketches are exchanged as node (" + m_node_id + ") with the fleet via (" + m_fleet_dir + ") every (" + std::to_string(m_fleet_interval_ms) + ") ms");
+            }
+            m_shards = std::max<uint32_t>(1, m_shards);
+            if (m_shards > 1 && !m_fleet_dir.empty())
+            {
+                log_error("Count min sketches are exchanged with the fleet, shards is ignored");
+                m_shards = 1;
+            }
+            if (m_shards > 1)
+            {
+                log_error("Count min sketches are sharded across (" + std::to_string(m_shards) + ") worker threads each, queueing up to ("
+                + std::to_string(m_shard_queue_capacity) + ") updates per shard");
+            }
+            if (m_counter_bits != 64 || m_cms_options.conservative_update)
+            {
+                log_error("Count min sketch counters are (" + std::to_string(m_counter_bits) + ") bit wide"
+                + (m_counter_bits != 64 ? " and saturate at their maximum" : "")
+                + (m_cms_options.conservative_update ? ", using conservative updates" : ""));
+            }
+
             // If used, config JSON schema enforces a minimum of 1 items and 2-d sub-arrays
             auto gamma_eps_pointer = nlohmann::json::json_pointer("/count_min_sketch/gamma_eps");
             if (config_json.contains(gamma_eps_pointer) && config_json[gamma_eps_pointer].is_array())
@@ -156,16 +432,20 @@ void anomalydetection::parse_init_config(nlohmann::json& config_json)
                     if (array.is_array() && array.size() == 2)
                     {
                         std::vector<double> sub_array = {array[0].get<double>(), array[1].get<double>()};
+                        uint64_t d = plugin::anomalydetection::num::cms<uint64_t>::calculate_d_rows_from_gamma(sub_array[0]);
+                        uint64_t w = plugin::anomalydetection::num::cms<uint64_t>::calculate_w_cols_buckets_from_eps(sub_array[1]);
+                        if (m_cms_options.pow2_cols)
+                        {
+                            w = plugin::anomalydetection::num::cms<uint64_t>::round_w_cols_pow2(w);
+                        }
                         log_error("Count min sketch data structure number (" 
                         + std::to_string(n) + ") loaded with gamma and eps values (" 
                         + std::to_string(sub_array[0]) + ","
                         + std::to_string(sub_array[1])
                         + ") equivalent to sketch dimensions ("
-                        + std::to_string(plugin::anomalydetection::num::cms<uint64_t>::calculate_d_rows_from_gamma(sub_array[0])) + ","
-                        + std::to_string(plugin::anomalydetection::num::cms<uint64_t>::calculate_w_cols_buckets_from_eps(sub_array[1]))
-                        + ") -> adding ("
-                        + std::to_string(plugin::anomalydetection::num::cms<uint64_t>::get_size_bytes(plugin::anomalydetection::num::cms<uint64_t>::calculate_d_rows_from_gamma(sub_array[0]),plugin::anomalydetection::num::cms<uint64_t>::calculate_w_cols_buckets_from_eps(sub_array[1])))
-                        + ") bytes of constant memory allocation on the heap");
+                        + std::to_string(d) + ","
+                        + std::to_string(w)
+                        + ")");
                         m_gamma_eps.emplace_back(sub_array);     
                     }
                     n++;
@@ -186,6 +466,10 @@ void anomalydetection::parse_init_config(nlohmann::json& config_json)
                     if (array.is_array() && array.size() == 2)
                     {
                         std::vector<uint64_t> sub_array = {array[0].get<uint64_t>(), array[1].get<uint64_t>()};
+                        if (m_cms_options.pow2_cols)
+                        {
+                            sub_array[1] = plugin::anomalydetection::num::cms<uint64_t>::round_w_cols_pow2(sub_array[1]);
+                        }
                         log_error("Count min sketch data structure number (" 
                         + std::to_string(n) + ") loaded with d and w/buckets values (" 
                         + std::to_string(sub_array[0]) + ","
@@ -193,9 +477,7 @@ void anomalydetection::parse_init_config(nlohmann::json& config_json)
                         + ") equivalent to sketch error probability and relative error tolerances ("
                         + std::to_string(plugin::anomalydetection::num::cms<uint64_t>::calculate_gamma_rows_from_d(sub_array[0])) + ","
                         + std::to_string(plugin::anomalydetection::num::cms<uint64_t>::calculate_eps_cols_buckets_from_w(sub_array[1]))
-                        + ") -> adding ("
-                        + std::to_string(plugin::anomalydetection::num::cms<uint64_t>::get_size_bytes(sub_array[0],sub_array[1]))
-                        + ") bytes of constant memory allocation on the heap");
+                        + ")");
                         m_rows_cols.emplace_back(sub_array);
                     }
                     n++;
@@ -284,17 +566,103 @@ void anomalydetection::parse_init_config(nlohmann::json& config_json)
                         {
                             m_reset_timers.emplace_back(uint64_t(0));
                         }
-                        log_error("Behavior profile number (" + std::to_string(n) + ") resets the counts to zero every (" + std::to_string(interval) + ") ms");
+                        if (profile.value("sketch_type", "count_min_sketch") != "sliding_window")
+                        {
+                            log_error("Behavior profile number (" + std::to_string(n) + ") resets the counts to zero every (" + std::to_string(interval) + ") ms"
+                            + (interval > 100 ? ", its sketch is double buffered (2x memory) to swap in a cleared buffer at each interval" : ""));
+                        }
                     } else
                     {
                         m_reset_timers.emplace_back(uint64_t(0));
                     }
+                    uint32_t window_slices = 0;
+                    if (profile.contains("sketch_type") && profile["sketch_type"].get<std::string>() == "sliding_window")
+                    {
+                        window_slices = profile.contains("window_slices") ? profile["window_slices"].get<uint32_t>() : 8;
+                        if (m_reset_timers.back() > 0 && window_slices > 1)
+                        {
+                            log_error("Behavior profile number (" + std::to_string(n) + ") uses a sliding window sketch of (" + std::to_string(window_slices) + ") slices, expiring the oldest slice every (" + std::to_string(m_reset_timers.back() / window_slices) + ") ms ("
+                            + std::to_string(window_slices) + "x memory)");
+                        } else
+                        {
+                            log_error("Behavior profile number (" + std::to_string(n) + ") sliding window sketch requires a reset_timer_ms > 100 as window length and at least 2 window_slices, falling back to a count min sketch");
+                            window_slices = 0;
+                        }
+                    }
+                    m_window_slices.emplace_back(window_slices);
+                    m_topk.emplace_back(profile.value("topk", (uint32_t)0));
+                    m_rare_items.emplace_back(profile.value("rare_items", (uint32_t)0));
+                    m_hll_precisions.emplace_back(profile.value("hll_precision", (uint32_t)0));
+                    m_novelty_filter_capacities.emplace_back(profile.value("novelty_filter_capacity", (uint64_t)0));
+                    std::vector<profile_extractor> partition_extractors;
+                    if (profile.contains("partition_by"))
+                    {
+                        partition_extractors = compile_profile_extractors(plugin_anomalydetection::utils::get_profile_fields(profile["partition_by"].get<std::string>()));
+                        if (partition_extractors.empty())
+                        {
+                            log_error("Behavior profile number (" + std::to_string(n) + ") partition_by (" + profile["partition_by"].get<std::string>() + ") contains no supported fields, the behavior profile is not partitioned");
+                        }
+                    }
+                    m_partition_extractors.emplace_back(std::move(partition_extractors));
+                    m_partition_rows_cols.emplace_back(profile.value("partition_rows_cols", std::vector<uint64_t>{3, 2048}));
+                    m_max_partitions.emplace_back(profile.value("max_partitions", (uint32_t)1024));
+                    m_partition_ttl_ms.emplace_back(profile.value("partition_ttl_ms", (uint64_t)0));
+                    if (!m_partition_extractors.back().empty())
+                    {
+                        const auto& dims = m_partition_rows_cols.back();
+                        log_error("Behavior profile number (" + std::to_string(n) + ") is partitioned by (" + profile["partition_by"].get<std::string>() + ") into at most ("
+                        + std::to_string(m_max_partitions.back()) + ") sketches of rows_cols (" + std::to_string(dims[0]) + "," + std::to_string(dims[1]) + ")"
+                        + (m_partition_ttl_ms.back() > 0 ? ", evicting partitions idle for (" + std::to_string(m_partition_ttl_ms.back()) + ") ms" : ""));
+                    }
+                    if (m_novelty_filter_capacities.back() > 0)
+                    {
+                        if (!m_partition_extractors.back().empty())
+                        {
+                            log_error("Behavior profile number (" + std::to_string(n) + ") is partitioned, novelty_filter_capacity is ignored");
+                            m_novelty_filter_capacities.back() = 0;
+                        } else
+                        {
+                            log_error("Behavior profile number (" + std::to_string(n) + ") answers never seen behaviors from a novelty filter -> adding ("
+                            + std::to_string(2 * plugin::anomalydetection::num::blocked_bloom::get_size_bytes(m_novelty_filter_capacities.back())) + ") bytes of Bloom filters");
+                        }
+                    }
+                    if (m_hll_precisions.back() > 0)
+                    {
+                        log_error("Behavior profile number (" + std::to_string(n) + ") counts its distinct behaviors -> adding ("
+                        + std::to_string(uint64_t(1) << m_hll_precisions.back()) + ") bytes of HyperLogLog registers");
+                    }
+                    if (m_topk.back() > 0 || m_rare_items.back() > 0)
+                    {
+                        log_error("Behavior profile number (" + std::to_string(n) + ") tracks the top (" + std::to_string(m_topk.back()) + ") and the last (" + std::to_string(m_rare_items.back()) + ") first seen behaviors");
+                    }
+                    m_behavior_profiles_extractors.emplace_back(compile_profile_extractors(filter_check_fields));
                     m_behavior_profiles_fields.emplace_back(filter_check_fields);
                     m_behavior_profiles_event_codes.emplace_back(std::move(codes));
+
+                    // Snapshots are only reloaded into a sketch learning the very same behavior profile
+                    std::string definition = profile.dump() + ":" + std::to_string(m_counter_bits) + ":" + std::to_string(m_cms_options.conservative_update) + ":" + std::to_string(m_cms_options.pow2_cols);
+                    if (m_shards > 1)
+                    {
+                        definition += ":" + std::to_string(m_shards);
+                    }
+                    m_profile_fingerprints.emplace_back(XXH3_64bits(definition.data(), definition.size()));
                     n++;
                 }
             }
 
+            for (uint32_t i = 0; i < m_behavior_profiles_event_codes.size(); i++)
+            {
+                for (const auto& code : m_behavior_profiles_event_codes[i])
+                {
+                    if (code < m_event_code_profiles.size())
+                    {
+                        m_event_code_profiles[code].push_back(i);
+                    }
+                }
+            }
+            m_field_cache.assign(m_extraction_slots.size(), extraction_cache_entry());
+            m_profile_cache.assign(m_behavior_profiles_extractors.size(), profile_cache_entry());
+
             // Check correlated conditions that can't be directly enforced by the config JSON schema
             if (!m_gamma_eps.empty() && m_n_sketches != m_gamma_eps.size())
             {
@@ -320,6 +688,35 @@ void anomalydetection::parse_init_config(nlohmann::json& config_json)
     }
 }
 
+template<typename T, typename... Dims>
+std::shared_ptr<plugin::anomalydetection::num::sketch> anomalydetection::make_typed_sketch(uint32_t i, Dims... dims)
+{
+    namespace num = plugin::anomalydetection::num;
+    auto options = m_cms_options;
+    if (m_window_slices[i] > 1)
+    {
+        return std::make_shared<num::sketch_impl<num::cms_window<T>>>(dims..., m_window_slices[i], options);
+    }
+    options.double_buffered = m_reset_timers[i] > 0; // O(1) periodic resets at the cost of 2x memory
+    return std::make_shared<num::sketch_impl<num::cms<T>>>(dims..., options);
+}
+
+template<typename... Dims>
+std::shared_ptr<plugin::anomalydetection::num::sketch> anomalydetection::make_sketch(uint32_t i, Dims... dims)
+{
+    switch (m_counter_bits)
+    {
+    case 8:
+        return make_typed_sketch<uint8_t>(i, dims...);
+    case 16:
+        return make_typed_sketch<uint16_t>(i, dims...);
+    case 32:
+        return make_typed_sketch<uint32_t>(i, dims...);
+    default:
+        return make_typed_sketch<uint64_t>(i, dims...);
+    }
+}
+
 bool anomalydetection::init(falcosecurity::init_input& in)
 {
     using st = falcosecurity::state_value_type;
@@ -398,6 +795,16 @@ bool anomalydetection::init(falcosecurity::init_input& in)
         /* Custom fields */
         m_lastevent_fd_field = m_thread_table.add_field(
                 t.fields(), "lastevent_fd", st::SS_PLUGIN_ST_INT64);
+        m_lineage_comm = m_thread_table.add_field(
+                t.fields(), "anomaly_lineage_comm", st::SS_PLUGIN_ST_STRING);
+        m_lineage_exe = m_thread_table.add_field(
+                t.fields(), "anomaly_lineage_exe", st::SS_PLUGIN_ST_STRING);
+        m_lineage_exepath = m_thread_table.add_field(
+                t.fields(), "anomaly_lineage_exepath", st::SS_PLUGIN_ST_STRING);
+        m_lineage_pid = m_thread_table.add_field(
+                t.fields(), "anomaly_lineage_pid", st::SS_PLUGIN_ST_STRING);
+        m_lineage_ptid = m_thread_table.add_field(
+                t.fields(), "anomaly_lineage_ptid", st::SS_PLUGIN_ST_INT64);
     }
     catch(falcosecurity::plugin_exception e)
     {
@@ -418,17 +825,34 @@ bool anomalydetection::init(falcosecurity::init_input& in)
 
     // Init the plugin managed state table holding the count min sketch estimates for each behavior profile
     m_thread_manager.stop_threads(); // Important for reloading configs conditions
-    m_count_min_sketches.lock()->clear();
+    m_count_min_sketches.clear();
+    m_sharded_sketches.clear();
+    m_hlls.clear();
+    m_partitioned_sketches.clear();
 
     if (m_count_min_sketch_enabled)
     {
+        // Single event parsing thread, concurrent extraction reads and periodic resets
+        m_cms_options.concurrency = plugin::anomalydetection::num::cms_concurrency::SINGLE_WRITER;
+        // Each shard sees 1 / m_shards of the behavior profiles, its sketch gets 1 / m_shards of the cols
+        uint32_t shards = m_shards;
         if (m_rows_cols.size() == m_n_sketches)
         {
             for (uint32_t i = 0; i < m_n_sketches; ++i)
             {
                 uint64_t rows = m_rows_cols[i][0];
                 uint64_t cols = m_rows_cols[i][1];
-                m_count_min_sketches.lock()->push_back(std::make_shared<plugin::anomalydetection::num::cms<uint64_t>>(rows, cols));
+                if (shards > 1)
+                {
+                    m_sharded_sketches.push_back(std::make_shared<plugin::anomalydetection::num::sharded_sketch>(
+                        [this, i, rows, cols, shards]() { return make_sketch(i, rows, std::max<uint64_t>(1, cols / shards)); },
+                        shards, m_shard_queue_capacity));
+                    m_count_min_sketches.push_back(m_sharded_sketches.back());
+                } else
+                {
+                    m_sharded_sketches.push_back(nullptr);
+                    m_count_min_sketches.push_back(make_sketch(i, rows, cols));
+                }
             }
         } else if (m_gamma_eps.size() == m_n_sketches && m_rows_cols.empty())
         {
@@ -436,158 +860,613 @@ bool anomalydetection::init(falcosecurity::init_input& in)
             {
                 double gamma = m_gamma_eps[i][0];
                 double eps = m_gamma_eps[i][1];
-                m_count_min_sketches.lock()->push_back(std::make_shared<plugin::anomalydetection::num::cms<uint64_t>>(gamma, eps));
+                if (shards > 1)
+                {
+                    m_sharded_sketches.push_back(std::make_shared<plugin::anomalydetection::num::sharded_sketch>(
+                        [this, i, gamma, eps, shards]() { return make_sketch(i, gamma, std::min(1.0, eps * shards)); },
+                        shards, m_shard_queue_capacity));
+                    m_count_min_sketches.push_back(m_sharded_sketches.back());
+                } else
+                {
+                    m_sharded_sketches.push_back(nullptr);
+                    m_count_min_sketches.push_back(make_sketch(i, gamma, eps));
+                }
             }
         } else
         {
             return false;
         }
-
-        // Launch threads to periodically reset the data structures (if applicable)
-        m_thread_manager.m_stop_requested = false;
+        // Sizes of the sketches as built, incl. counter width, double buffers, window slices and shard queues
         for (uint32_t i = 0; i < m_n_sketches; ++i)
         {
-            m_thread_manager.start_periodic_count_min_sketch_reset_worker<uint64_t>(i, (uint64_t)m_reset_timers[i], m_count_min_sketches);
+            log_error("Count min sketch data structure number (" + std::to_string(i + 1) + ") -> adding ("
+            + std::to_string(m_count_min_sketches[i]->get_size_bytes()) + ") bytes of constant memory allocation on the heap");
         }
-    }
-
-    return true;
-}
-
-//////////////////////////
-// Extract capability
-//////////////////////////
-
-std::vector<falcosecurity::field_info> anomalydetection::get_fields()
-{
-    using ft = falcosecurity::field_value_type;
-    const falcosecurity::field_info fields[] = {
-            {ft::FTYPE_UINT64, "anomaly.count_min_sketch", 
-             "Count Min Sketch Estimate",
-             "Count Min Sketch Estimate according to the specified behavior profile for a predefined set of {syscalls} events. Access different behavior profiles/sketches using indices. For instance, anomaly.count_min_sketch[0] retrieves the first behavior profile defined in the plugins' `init_config`.",
-             { // field arg
-                false, // key
-                true,  // index
-                false,
-             }},
-            {ft::FTYPE_STRING, "anomaly.count_min_sketch.profile", 
-             "Behavior Profile Concatenated String",
-             "Concatenated string according to the specified behavior profile (not preserving original order). Access different behavior profiles using indices. For instance, anomaly.count_min_sketch.profile[0] retrieves the first behavior profile defined in the plugins' `init_config`.",
-             { // field arg
-                false, // key
-                true,  // index
-                false,
-             }},
-             {ft::FTYPE_UINT64, "anomaly.falco.duration_ns", 
-             "Falco agent run duration in nanoseconds",
-             "Falco agent run duration in nanoseconds, which could be useful for ignoring some rare events at launch time while Falco is just starting to build up the counts in the sketch data structures (if applicable).",
-             { // field arg
-                false, // key
-                false,  // index
-                false,
-             }},
-    };
-    const int fields_size = sizeof(fields) / sizeof(fields[0]);
-    static_assert(fields_size == ANOMALYDETECTION_FIELD_MAX, "Wrong number of anomaly fields.");
-    return std::vector<falcosecurity::field_info>(fields, fields + fields_size);
-}
 
-bool anomalydetection::extract(const falcosecurity::extract_fields_input& in)
-{
-    auto& req = in.get_extract_request();
-    auto& tr = in.get_table_reader();
-    auto& evt = in.get_event_reader();
-    switch(req.get_field_id())
-    {
-    case ANOMALYDETECTION_COUNT_MIN_SKETCH_COUNT:
+        for (uint32_t i = 0; i < m_n_sketches && i < m_novelty_filter_capacities.size(); ++i)
         {
-            int64_t thread_id = evt.get_tid();
-            uint64_t count_min_sketch_estimate = 0;
-            std::string behavior_profile_concat_str;
-            auto index = req.get_arg_index();
-            if(!m_count_min_sketch_enabled)
+            // Before loading the snapshots, restored counts bypass the filter until they expire
+            if (m_novelty_filter_capacities[i] > 0)
             {
-                m_lasterr = "count_min_sketch disabled, but `anomaly.count_min_sketch` field referenced";
-                return false;
+                m_count_min_sketches[i]->enable_novelty_filter(m_novelty_filter_capacities[i]);
             }
-            if(index >= m_n_sketches)
+        }
+        load_snapshots();
+        for (uint32_t i = 0; i < m_n_sketches; ++i)
+        {
+            if (i < m_partition_extractors.size() && !m_partition_extractors[i].empty())
             {
-                m_lasterr = "sketch index out of bounds";
-                return false;
+                uint64_t rows = m_partition_rows_cols[i][0];
+                uint64_t cols = m_partition_rows_cols[i][1];
+                m_partitioned_sketches.push_back(std::make_shared<plugin::anomalydetection::num::partitioned_sketch>(
+                    [this, i, rows, cols]() { return make_sketch(i, rows, cols); },
+                    m_max_partitions[i], m_partition_ttl_ms[i] * 1000000));
+            } else
+            {
+                m_partitioned_sketches.push_back(nullptr);
             }
-            if(extract_filterchecks_concat_profile(evt, tr, m_behavior_profiles_fields[index], behavior_profile_concat_str))
+            m_hlls.push_back(i < m_hll_precisions.size() && m_hll_precisions[i] > 0 ? std::make_shared<plugin::anomalydetection::num::hll>(m_hll_precisions[i]) : nullptr);
+        }
+        for (uint32_t i = 0; i < m_n_sketches && i < m_topk.size(); ++i)
+        {
+            if (m_topk[i] > 0 || m_rare_items[i] > 0)
             {
-                count_min_sketch_estimate = m_count_min_sketches.lock()->at(index).get()->estimate(behavior_profile_concat_str);
-                req.set_value(count_min_sketch_estimate, true);
+                m_count_min_sketches[i]->enable_topk(m_topk[i], m_rare_items[i]);
             }
-            return true;
         }
-    case ANOMALYDETECTION_COUNT_MIN_SKETCH_BEHAVIOR_PROFILE_CONCAT_STR:
+        m_profile_metrics.assign(m_n_sketches, profile_metrics());
+        m_staged_updates.assign(m_n_sketches, plugin::anomalydetection::num::staged_batch(m_update_batch_size));
+
+        // Metrics only read the cached occupancy, the scan of all counters runs off the metrics collection thread
+        refresh_sketch_stats();
+        m_fleet_sketches.assign(m_n_sketches, nullptr);
+
+        // Launch threads to periodically reset the data structures (if applicable), all driven by wall clock time
+        m_thread_manager.m_stop_requested = false;
+        if (m_periodic_workers)
         {
-            int64_t thread_id = evt.get_tid();
-            uint64_t count_min_sketch_estimate = 0;
-            std::string behavior_profile_concat_str;
-            auto index = req.get_arg_index();
-            if(!m_count_min_sketch_enabled)
+            for (uint32_t i = 0; i < m_n_sketches; ++i)
             {
-                m_lasterr = "count_min_sketch disabled, but `anomaly.count_min_sketch` field referenced";
-                return false;
+                m_thread_manager.start_periodic_count_min_sketch_reset_worker(i, (uint64_t)m_reset_timers[i], m_count_min_sketches);
+                if (auto partitioned = m_partitioned_sketches[i])
+                {
+                    // Only requests, the event parsing thread rotates each partition when it next touches it
+                    if (m_reset_timers[i] > 0)
+                    {
+                        uint64_t tick_ms = m_reset_timers[i] / std::max<uint32_t>(1, m_window_slices[i]);
+                        m_thread_manager.start_periodic_task_worker(tick_ms, [partitioned]() { partitioned->rotate(); });
+                    }
+                    // Evicted partitions (LRU or TTL) are cleared here instead of on the event parsing thread
+                    m_thread_manager.start_periodic_task_worker(1000, [partitioned]() { partitioned->reset_evicted(); });
+                }
+                if (m_hlls[i])
+                {
+                    // Distinct counts are per reset interval, sliding window sketches included
+                    auto hll = m_hlls[i];
+                    m_thread_manager.start_periodic_task_worker((uint64_t)m_reset_timers[i], [hll]() { hll->reset(); });
+                }
             }
-            if(index >= m_n_sketches)
+            if (!m_snapshot_dir.empty())
             {
-                m_lasterr = "sketch index out of bounds";
-                return false;
+                m_thread_manager.start_periodic_task_worker(m_snapshot_interval_ms, [this]() { save_snapshots(); });
             }
-            if(extract_filterchecks_concat_profile(evt, tr, m_behavior_profiles_fields[index], behavior_profile_concat_str))
+            m_thread_manager.start_periodic_task_worker(m_stats_interval_ms, [this]() { refresh_sketch_stats(); });
+            if (std::any_of(m_count_min_sketches.begin(), m_count_min_sketches.end(), [](const auto& s) { return s->get_topk() != nullptr; }))
             {
-                req.set_value(behavior_profile_concat_str, true);
+                m_thread_manager.start_periodic_task_worker(m_topk_dump_interval_ms, [this]() { log_topk(); });
+            }
+            if (!m_fleet_dir.empty())
+            {
+                m_thread_manager.start_periodic_task_worker(m_fleet_interval_ms, [this]() { exchange_fleet_sketches(); });
             }
-            return true;
-        }  
-    case ANOMALYDETECTION_FALCO_DURATION_NS:
-        {
-            auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
-                std::chrono::system_clock::now().time_since_epoch()).count();
-            req.set_value((uint64_t)(now - m_falco_start_ts_epoch_ns), true);
         }
-        return true;
-    default:
-        m_lasterr = "unknown extraction request";
-        return false;
     }
 
     return true;
 }
 
-//////////////////////////
-// Parse capability
-//////////////////////////
+std::string anomalydetection::get_snapshot_path(uint32_t i) const
+{
+    return m_snapshot_dir + "/behavior_profile_" + std::to_string(i) + ".cms";
+}
 
-// Adopted from the k8smeta plugin, obtain a param from a sinsp event
-static inline sinsp_param get_syscall_evt_param(void* evt, uint32_t num_param)
+void anomalydetection::load_snapshots()
 {
-    uint32_t dataoffset = 0;
-    // pointer to the lengths array inside the event.
-    auto len = (uint16_t*)((uint8_t*)evt +
-                           sizeof(falcosecurity::_internal::ss_plugin_event));
-    for(uint32_t j = 0; j < num_param; j++)
+    if (m_snapshot_dir.empty())
     {
-        // sum lengths of the previous params.
-        dataoffset += len[j];
+        return;
+    }
+    for (uint32_t i = 0; i < m_count_min_sketches.size() && i < m_profile_fingerprints.size(); ++i)
+    {
+        std::string path = get_snapshot_path(i);
+        if (m_count_min_sketches[i]->load_snapshot(path, m_profile_fingerprints[i]))
+        {
+            log_error("Behavior profile number (" + std::to_string(i + 1) + ") warm restarted from snapshot (" + path + ")");
+        } else
+        {
+            log_error("Behavior profile number (" + std::to_string(i + 1) + ") has no matching snapshot at (" + path + "), starting with zero counts");
+        }
     }
-    return {.param_len = len[num_param],
-            .param_pointer =
-                    ((uint8_t*)&len
-                             [((falcosecurity::_internal::ss_plugin_event*)evt)
-                                      ->nparams]) +
-                    dataoffset};
 }
 
-std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const falcosecurity::event_reader &evt, const plugin_sinsp_filterchecks_field& field, const std::string& cwd)
+void anomalydetection::save_snapshots()
 {
-    using st = falcosecurity::state_value_type;
-
-    std::string tstr;
+    if (m_snapshot_dir.empty())
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < m_count_min_sketches.size() && i < m_profile_fingerprints.size(); ++i)
+    {
+        std::string path = get_snapshot_path(i);
+        if (!m_count_min_sketches[i]->save_snapshot(path, m_profile_fingerprints[i]))
+        {
+            log_error("Behavior profile number (" + std::to_string(i + 1) + ") failed to write its snapshot to (" + path + ")");
+        }
+    }
+}
+
+std::string anomalydetection::format_topk(uint32_t i, bool rare)
+{
+    // JSON array of {"profile": <behavior profile string>, "count": <current sketch estimate>}
+    nlohmann::json items = nlohmann::json::array();
+    auto* topk = m_count_min_sketches[i]->get_topk();
+    if (topk == nullptr)
+    {
+        return items.dump();
+    }
+    for (const auto& item : rare ? topk->get_rare() : topk->get_top())
+    {
+        uint64_t count = m_count_min_sketches[i]->estimate(item.hash);
+        if (rare && count > 1)
+        {
+            continue; // Seen again since
+        }
+        items.push_back({{"profile", item.label}, {"count", count}});
+    }
+    return items.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
+void anomalydetection::refresh_sketch_stats()
+{
+    for (uint32_t i = 0; i < m_count_min_sketches.size() && i < m_profile_metrics.size(); ++i)
+    {
+        auto stats = m_count_min_sketches[i]->get_stats();
+        metrics_store_double(m_profile_metrics[i].fill_ratio, stats.fill_ratio);
+        __atomic_store_n(&m_profile_metrics[i].counted_total, stats.total, __ATOMIC_RELAXED);
+    }
+}
+
+void anomalydetection::log_topk()
+{
+    for (uint32_t i = 0; i < m_count_min_sketches.size(); ++i)
+    {
+        if (m_count_min_sketches[i]->get_topk() != nullptr)
+        {
+            log_error("Behavior profile number (" + std::to_string(i + 1) + ") top behaviors " + format_topk(i, false) + " rare behaviors " + format_topk(i, true));
+        }
+    }
+}
+
+void anomalydetection::track_topk(const falcosecurity::event_reader& evt, const falcosecurity::table_reader& tr, uint32_t i, const XXH128_hash_t& hash)
+{
+    // Profile strings are only built when an item enters the top k or is first seen
+    auto* topk = m_count_min_sketches[i]->get_topk();
+    uint64_t count = estimate_count(i, hash) + 1;
+    // Staged updates are not in the sketch yet, see `flush_staged_updates`
+    count += m_staged_updates[i].count(hash);
+    if (count == 1)
+    {
+        topk->insert_rare(hash, get_profile_concat_str(evt, tr, i));
+    }
+    if (!topk->update(hash, count) && topk->admits(count))
+    {
+        topk->insert(hash, count, get_profile_concat_str(evt, tr, i));
+    }
+}
+
+uint64_t anomalydetection::estimate_count(uint32_t i, const XXH128_hash_t& hash) const
+{
+    // Sharded sketches also count the updates still queued for their workers, see `sharded_sketch::estimate_with_queued`
+    if (m_sharded_sketches[i])
+    {
+        return m_sharded_sketches[i]->estimate_with_queued(hash);
+    }
+    return m_count_min_sketches[i]->estimate(hash);
+}
+
+void anomalydetection::flush_staged_updates(uint32_t i)
+{
+    if (i < m_staged_updates.size() && !m_staged_updates[i].empty())
+    {
+        m_count_min_sketches[i]->update_batch(m_staged_updates[i].data(), m_staged_updates[i].size(), (uint64_t)1);
+        m_staged_updates[i].clear();
+    }
+}
+
+void anomalydetection::flush_staged_updates()
+{
+    for (uint32_t i = 0; i < m_staged_updates.size(); ++i)
+    {
+        flush_staged_updates(i);
+    }
+}
+
+void anomalydetection::exchange_fleet_sketches()
+{
+    // Export this node's sketches, then rebuild each fleet sketch from the recent exports of all nodes including this one
+    namespace fs = std::filesystem;
+    namespace num = plugin::anomalydetection::num;
+    auto stale_before = fs::file_time_type::clock::now() - std::chrono::milliseconds(3 * m_fleet_interval_ms);
+    for (uint32_t i = 0; i < m_count_min_sketches.size() && i < m_profile_fingerprints.size(); ++i)
+    {
+        std::string suffix = ".behavior_profile_" + std::to_string(i) + ".cmsw";
+        std::string path = m_fleet_dir + "/" + m_node_id + suffix;
+        {
+            std::string data = m_count_min_sketches[i]->serialize(m_profile_fingerprints[i]);
+            std::ofstream out(path + ".tmp", std::ios::binary | std::ios::trunc);
+            out.write(data.data(), data.size());
+            out.close();
+            std::error_code ec;
+            if (out)
+            {
+                fs::rename(path + ".tmp", path, ec);
+            }
+            if (!out || ec)
+            {
+                log_error("Behavior profile number (" + std::to_string(i + 1) + ") failed to export its sketch to (" + path + ")");
+            }
+        }
+
+        auto fleet = std::make_shared<num::cms<uint64_t>>(m_count_min_sketches[i]->get_d(), m_count_min_sketches[i]->get_w());
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(m_fleet_dir, ec))
+        {
+            std::string name = entry.path().filename().string();
+            std::error_code time_ec;
+            if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0
+                || entry.last_write_time(time_ec) < stale_before || time_ec)
+            {
+                continue;
+            }
+            std::ifstream in(entry.path(), std::ios::binary);
+            std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            if (!num::merge_serialized(*fleet, data, m_profile_fingerprints[i]))
+            {
+                log_error("Behavior profile number (" + std::to_string(i + 1) + ") ignores the mismatching fleet sketch (" + entry.path().string() + ")");
+            }
+        }
+        std::atomic_store(&m_fleet_sketches[i], std::shared_ptr<const num::cms<uint64_t>>(std::move(fleet)));
+    }
+}
+
+//////////////////////////
+// Metrics
+//////////////////////////
+
+const std::vector<falcosecurity::metric>& anomalydetection::get_metrics()
+{
+    m_metrics.clear();
+    auto add_u64 = [this](const std::string& name, uint64_t value, bool monotonic)
+    {
+        falcosecurity::metric m(name, monotonic ? falcosecurity::metric_type::METRIC_TYPE_MONOTONIC : falcosecurity::metric_type::METRIC_TYPE_NON_MONOTONIC);
+        m.set_value(value);
+        m_metrics.push_back(m);
+    };
+    auto add_d = [this](const std::string& name, double value)
+    {
+        falcosecurity::metric m(name, falcosecurity::metric_type::METRIC_TYPE_NON_MONOTONIC);
+        m.set_value(value);
+        m_metrics.push_back(m);
+    };
+    auto add_latency = [&add_u64](const std::string& name, const plugin::anomalydetection::num::log2_histogram& h)
+    {
+        add_u64(name + "_mean", h.get_mean(), false);
+        add_u64(name + "_p50", h.get_quantile(0.5), false);
+        add_u64(name + "_p99", h.get_quantile(0.99), false);
+    };
+
+    add_u64(METRIC_N_PARSED_EVENTS, metrics_load(m_parsed_events), true);
+    add_latency(METRIC_PARSE_LATENCY_NS, m_parse_latency);
+    add_u64(METRIC_N_EXTRACT_REQUESTS, metrics_load(m_extract_requests), true);
+    add_u64(METRIC_N_EXTRACT_FAILURES, metrics_load(m_extract_failures), true);
+    add_latency(METRIC_EXTRACT_LATENCY_NS, m_extract_latency);
+
+    for (uint32_t i = 0; i < m_count_min_sketches.size() && i < m_profile_metrics.size(); ++i)
+    {
+        std::string prefix = METRIC_PROFILE_PREFIX + std::to_string(i) + "_";
+        const auto& metrics = m_profile_metrics[i];
+        uint64_t updates = metrics_load(metrics.updates);
+        add_u64(prefix + "updates", updates, true);
+        add_u64(prefix + "empty_profiles", metrics_load(metrics.empty_profiles), true);
+        add_u64(prefix + "extraction_failures", metrics_load(metrics.extraction_failures), true);
+        add_d(prefix + "avg_profile_length", updates == 0 ? 0 : (double)metrics_load(metrics.profile_length_sum) / updates);
+
+        // Sizing of `rows_cols`: estimates overshoot by at most e / w * N with probability 1 - e^-d,
+        // and a never seen behavior profile gets a non-zero estimate with probability ~ fill_ratio^d
+        const auto& sketch = m_count_min_sketches[i];
+        double fill_ratio = metrics_load_double(metrics.fill_ratio); // Cached, see `refresh_sketch_stats`
+        add_d(prefix + "fill_ratio", fill_ratio);
+        add_d(prefix + "false_positive_rate", std::pow(fill_ratio, (double)sketch->get_d()));
+        add_u64(prefix + "error_bound", (uint64_t)std::ceil(std::exp(1.0) / sketch->get_w() * metrics_load(metrics.counted_total)), false);
+        add_u64(prefix + "size_bytes", sketch->get_size_bytes(), false);
+
+        if (auto topk = sketch->get_topk())
+        {
+            auto top = topk->get_top();
+            add_u64(prefix + "topk_max_count", top.empty() ? 0 : top.front().count, false);
+            add_u64(prefix + "rare_items", topk->get_rare().size(), false);
+        }
+        if (i < m_hlls.size() && m_hlls[i])
+        {
+            add_u64(prefix + "hll_distinct", m_hlls[i]->estimate(), false);
+        }
+        if (i < m_sharded_sketches.size() && m_sharded_sketches[i])
+        {
+            add_u64(prefix + "shard_pending_updates", m_sharded_sketches[i]->get_pending(), false);
+            add_u64(prefix + "shard_stalls", m_sharded_sketches[i]->get_stalls(), true);
+        }
+        if (i < m_partitioned_sketches.size() && m_partitioned_sketches[i])
+        {
+            add_u64(prefix + "partitions", m_partitioned_sketches[i]->get_partitions(), false);
+            add_u64(prefix + "partition_evictions", m_partitioned_sketches[i]->get_evictions(), true);
+            add_u64(prefix + "partition_size_bytes", m_partitioned_sketches[i]->get_size_bytes(), false);
+        }
+    }
+    return m_metrics;
+}
+
+//////////////////////////
+// Extract capability
+//////////////////////////
+
+std::vector<falcosecurity::field_info> anomalydetection::get_fields()
+{
+    using ft = falcosecurity::field_value_type;
+    const falcosecurity::field_info fields[] = {
+            {ft::FTYPE_UINT64, "anomaly.count_min_sketch", 
+             "Count Min Sketch Estimate",
+             "Count Min Sketch Estimate according to the specified behavior profile for a predefined set of {syscalls} events. Access different behavior profiles/sketches using indices. For instance, anomaly.count_min_sketch[0] retrieves the first behavior profile defined in the plugins' `init_config`.",
+             { // field arg
+                false, // key
+                true,  // index
+                false,
+             }},
+            {ft::FTYPE_STRING, "anomaly.count_min_sketch.profile", 
+             "Behavior Profile Concatenated String",
+             "Concatenated string according to the specified behavior profile (not preserving original order). Access different behavior profiles using indices. For instance, anomaly.count_min_sketch.profile[0] retrieves the first behavior profile defined in the plugins' `init_config`.",
+             { // field arg
+                false, // key
+                true,  // index
+                false,
+             }},
+            {ft::FTYPE_UINT64, "anomaly.count_min_sketch.fleet",
+             "Fleet-wide Count Min Sketch Estimate",
+             "Count Min Sketch Estimate according to the specified behavior profile, summed over the sketches of all nodes exchanged via the `fleet_dir` config (as of the last exchange, including this node). Returns 0 until the first exchange. For instance, anomaly.count_min_sketch.fleet[0] retrieves the fleet-wide estimate of the first behavior profile defined in the plugins' `init_config`.",
+             { // field arg
+                false, // key
+                true,  // index
+                false,
+             }},
+            {ft::FTYPE_STRING, "anomaly.count_min_sketch.topk",
+             "Heavy Hitter Behavior Profiles",
+             "JSON array of the most frequent behavior profile strings with their current count estimates, highest first, for behavior profiles configured with `topk`. For instance, anomaly.count_min_sketch.topk[0] retrieves the heavy hitters of the first behavior profile defined in the plugins' `init_config`.",
+             { // field arg
+                false, // key
+                true,  // index
+                false,
+             }},
+            {ft::FTYPE_STRING, "anomaly.count_min_sketch.rare",
+             "Rare Behavior Profiles",
+             "JSON array of the most recently first seen behavior profile strings that were seen exactly once since, most recent first, for behavior profiles configured with `rare_items`. For instance, anomaly.count_min_sketch.rare[0] retrieves the rare behaviors of the first behavior profile defined in the plugins' `init_config`.",
+             { // field arg
+                false, // key
+                true,  // index
+                false,
+             }},
+            {ft::FTYPE_UINT64, "anomaly.hll.distinct",
+             "Distinct Behavior Profiles Estimate",
+             "HyperLogLog estimate of the number of distinct behavior profile strings seen since the last reset, for behavior profiles configured with `hll_precision`. For instance, anomaly.hll.distinct[0] retrieves the distinct count of the first behavior profile defined in the plugins' `init_config`.",
+             { // field arg
+                false, // key
+                true,  // index
+                false,
+             }},
+             {ft::FTYPE_UINT64, "anomaly.falco.duration_ns", 
+             "Falco agent run duration in nanoseconds",
+             "Falco agent run duration in nanoseconds, which could be useful for ignoring some rare events at launch time while Falco is just starting to build up the counts in the sketch data structures (if applicable).",
+             { // field arg
+                false, // key
+                false,  // index
+                false,
+             }},
+    };
+    const int fields_size = sizeof(fields) / sizeof(fields[0]);
+    static_assert(fields_size == ANOMALYDETECTION_FIELD_MAX, "Wrong number of anomaly fields.");
+    return std::vector<falcosecurity::field_info>(fields, fields + fields_size);
+}
+
+bool anomalydetection::extract(const falcosecurity::extract_fields_input& in)
+{
+    sampled_latency latency(m_extract_latency, m_extract_requests);
+    if (!extract_field(in))
+    {
+        metrics_add(m_extract_failures, 1);
+        return false;
+    }
+    return true;
+}
+
+bool anomalydetection::extract_field(const falcosecurity::extract_fields_input& in)
+{
+    auto& req = in.get_extract_request();
+    auto& tr = in.get_table_reader();
+    auto& evt = in.get_event_reader();
+    switch(req.get_field_id())
+    {
+    case ANOMALYDETECTION_COUNT_MIN_SKETCH_COUNT:
+        {
+            int64_t thread_id = evt.get_tid();
+            uint64_t count_min_sketch_estimate = 0;
+            auto index = req.get_arg_index();
+            if(!m_count_min_sketch_enabled)
+            {
+                m_lasterr = "count_min_sketch disabled, but `anomaly.count_min_sketch` field referenced";
+                return false;
+            }
+            if(index >= m_n_sketches)
+            {
+                m_lasterr = "sketch index out of bounds";
+                return false;
+            }
+            const auto& profile = get_profile_hash(evt, tr, index);
+            if (profile.length > 0)
+            {
+                if (m_partitioned_sketches[index])
+                {
+                    count_min_sketch_estimate = m_partitioned_sketches[index]->estimate(get_partition_key(evt, tr, index), profile.hash);
+                } else
+                {
+                    flush_staged_updates(index); // Count the updates of this and the preceding events
+                    count_min_sketch_estimate = estimate_count(index, profile.hash);
+                }
+            }
+            req.set_value(count_min_sketch_estimate, true);
+            return true;
+        }
+    case ANOMALYDETECTION_COUNT_MIN_SKETCH_BEHAVIOR_PROFILE_CONCAT_STR:
+        {
+            int64_t thread_id = evt.get_tid();
+            uint64_t count_min_sketch_estimate = 0;
+            auto index = req.get_arg_index();
+            if(!m_count_min_sketch_enabled)
+            {
+                m_lasterr = "count_min_sketch disabled, but `anomaly.count_min_sketch` field referenced";
+                return false;
+            }
+            if(index >= m_n_sketches)
+            {
+                m_lasterr = "sketch index out of bounds";
+                return false;
+            }
+            req.set_value(get_profile_concat_str(evt, tr, index), true);
+            return true;
+        }  
+    case ANOMALYDETECTION_COUNT_MIN_SKETCH_FLEET_COUNT:
+        {
+            uint64_t count_min_sketch_estimate = 0;
+            auto index = req.get_arg_index();
+            if(!m_count_min_sketch_enabled)
+            {
+                m_lasterr = "count_min_sketch disabled, but `anomaly.count_min_sketch.fleet` field referenced";
+                return false;
+            }
+            if(index >= m_n_sketches || index >= m_fleet_sketches.size())
+            {
+                m_lasterr = "sketch index out of bounds";
+                return false;
+            }
+            auto fleet = std::atomic_load(&m_fleet_sketches[index]);
+            if (fleet)
+            {
+                const auto& profile = get_profile_hash(evt, tr, index);
+                if (profile.length > 0)
+                {
+                    count_min_sketch_estimate = fleet->estimate(profile.hash);
+                }
+            }
+            req.set_value(count_min_sketch_estimate, true);
+            return true;
+        }
+    case ANOMALYDETECTION_COUNT_MIN_SKETCH_TOPK:
+    case ANOMALYDETECTION_COUNT_MIN_SKETCH_RARE:
+        {
+            auto index = req.get_arg_index();
+            if(!m_count_min_sketch_enabled)
+            {
+                m_lasterr = "count_min_sketch disabled, but `anomaly.count_min_sketch` field referenced";
+                return false;
+            }
+            if(index >= m_n_sketches)
+            {
+                m_lasterr = "sketch index out of bounds";
+                return false;
+            }
+            flush_staged_updates(index);
+            req.set_value(format_topk(index, req.get_field_id() == ANOMALYDETECTION_COUNT_MIN_SKETCH_RARE), true);
+            return true;
+        }
+    case ANOMALYDETECTION_HLL_DISTINCT:
+        {
+            auto index = req.get_arg_index();
+            if(!m_count_min_sketch_enabled)
+            {
+                m_lasterr = "count_min_sketch disabled, but `anomaly.hll.distinct` field referenced";
+                return false;
+            }
+            if(index >= m_hlls.size() || !m_hlls[index])
+            {
+                m_lasterr = "behavior profile index out of bounds or without `hll_precision`";
+                return false;
+            }
+            req.set_value(m_hlls[index]->estimate(), true);
+            return true;
+        }
+    case ANOMALYDETECTION_FALCO_DURATION_NS:
+        {
+            auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            req.set_value((uint64_t)(now - m_falco_start_ts_epoch_ns), true);
+        }
+        return true;
+    default:
+        m_lasterr = "unknown extraction request";
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////
+// Parse capability
+//////////////////////////
+
+// Adopted from the k8smeta plugin, index all params of a sinsp event in one pass over the lengths array
+// instead of summing the lengths of the preceding params on every param access.
+// Param lengths are uint16: the plugin only parses and extracts from the syscall events of `supported_codes_any_profile`
+// and the state events of `is_state_event_code`, none of which is a large payload (uint32 lengths) event.
+static inline void index_syscall_evt_params(void* evt, evt_param_index& index)
+{
+    // pointer to the lengths array inside the event.
+    auto len = (uint16_t*)((uint8_t*)evt +
+                   sizeof(falcosecurity::_internal::ss_plugin_event));
+    uint32_t nparams = ((falcosecurity::_internal::ss_plugin_event*)evt)->nparams;
+    uint8_t* data = (uint8_t*)&len[nparams];
+    index.nparams = std::min<uint32_t>(nparams, PPM_MAX_EVENT_PARAMS);
+    uint32_t dataoffset = 0;
+    for(uint32_t j = 0; j < index.nparams; j++)
+    {
+        index.param_len[j] = len[j];
+        index.param_pointer[j] = data + dataoffset;
+        dataoffset += len[j];
+    }
+}
+
+const evt_param_index& anomalydetection::get_evt_params(const falcosecurity::event_reader &evt)
+{
+    // Parsing and extraction of the same event reuse the index
+    if (m_evt_params.evtnum != evt.get_num())
+    {
+        index_syscall_evt_params(evt.get_buf(), m_evt_params);
+        m_evt_params.evtnum = evt.get_num();
+    }
+    return m_evt_params;
+}
+
+std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const falcosecurity::event_reader &evt, const plugin_sinsp_filterchecks_field& field, const std::string& cwd)
+{
+    using st = falcosecurity::state_value_type;
+
+    std::string tstr;
     uint64_t tuint64 = UINT64_MAX;
     uint32_t tuint32 = UINT32_MAX;
     int64_t tint64 = -1;
@@ -612,8 +1491,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         case PPME_SOCKET_ACCEPT_5_X:
         case PPME_SOCKET_ACCEPT4_6_X:
         {
-            auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                0);
+            auto res_param = get_evt_params(evt).get(0);
             if (res_param.param_pointer == nullptr)
             {
                 return tstr;
@@ -624,8 +1502,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         }
         case PPME_SOCKET_CONNECT_X:
         {
-            auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                2);
+            auto res_param = get_evt_params(evt).get(2);
             if (res_param.param_pointer == nullptr)
             {
                 return tstr;
@@ -648,8 +1525,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         case PPME_SYSCALL_OPEN_X:
         case PPME_SYSCALL_CREAT_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                1);
+                auto res_param = get_evt_params(evt).get(1);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -668,8 +1544,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         case PPME_SYSCALL_OPENAT_2_X:
         case PPME_SYSCALL_OPENAT2_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                2);
+                auto res_param = get_evt_params(evt).get(2);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -681,8 +1556,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
             break;
         case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                3);
+                auto res_param = get_evt_params(evt).get(3);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -696,8 +1570,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         case PPME_SOCKET_CONNECT_X:
         {
             // todo fix/expose via plugin API fallbacks as we lack access to sockinfo and it's highly more sophisticated / complex
-            // auto res_param = get_syscall_evt_param(evt.get_buf(),
-            //                                     1);
+            // auto res_param = get_evt_params(evt).get(1);
             // if (res_param.param_pointer == nullptr)
             // {
             //     return tstr;
@@ -716,8 +1589,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         case PPME_SYSCALL_OPEN_X:
         case PPME_SYSCALL_CREAT_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                5);
+                auto res_param = get_evt_params(evt).get(5);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -729,8 +1601,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         case PPME_SYSCALL_OPENAT_2_X:
         case PPME_SYSCALL_OPENAT2_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                7);
+                auto res_param = get_evt_params(evt).get(7);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -741,8 +1612,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
             break;
         case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                5);
+                auto res_param = get_evt_params(evt).get(5);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -763,8 +1633,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         case PPME_SYSCALL_OPEN_X:
         case PPME_SYSCALL_CREAT_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                4);
+                auto res_param = get_evt_params(evt).get(4);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -776,8 +1645,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         case PPME_SYSCALL_OPENAT_2_X:
         case PPME_SYSCALL_OPENAT2_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                6);
+                auto res_param = get_evt_params(evt).get(6);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -788,8 +1656,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
             break;
         case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                4);
+                auto res_param = get_evt_params(evt).get(4);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -810,8 +1677,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         case PPME_SYSCALL_OPEN_X:
         case PPME_SYSCALL_CREAT_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                1);
+                auto res_param = get_evt_params(evt).get(1);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -822,8 +1688,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
         case PPME_SYSCALL_OPENAT_2_X:
         case PPME_SYSCALL_OPENAT2_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                2);
+                auto res_param = get_evt_params(evt).get(2);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -833,8 +1698,7 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
             break;
         case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
             {
-                auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                3);
+                auto res_param = get_evt_params(evt).get(3);
                 if (res_param.param_pointer == nullptr)
                 {
                     return tstr;
@@ -853,1248 +1717,1105 @@ std::string anomalydetection::extract_filterchecks_evt_params_fallbacks(const fa
     return tstr;
 }
 
-bool anomalydetection::extract_filterchecks_concat_profile(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, const std::vector<plugin_sinsp_filterchecks_field>& fields, std::string& behavior_profile_concat_str)
-{
-    using st = falcosecurity::state_value_type;
-
-    int64_t thread_id = evt.get_tid();
-    std::string tstr;
-    std::optional<falcosecurity::table_entry> thread_entry_opt;
-    try
-    {
-        thread_entry_opt = m_thread_table.get_entry(tr, thread_id);
-    } catch (const std::exception& e)
-    {
-        for (const auto& field : fields)
-        {
-            behavior_profile_concat_str += extract_filterchecks_evt_params_fallbacks(evt, field);
-        }
-        return true;
-    }
-    auto& thread_entry = thread_entry_opt.value();
+//
+// Behavior profile field extractors
+//
 
-    // Create a concatenated string formed out of each field per behavior profile
-    // No concept of null fields (instead its always an empty string) compared to libsinsp
+std::vector<profile_extractor> anomalydetection::compile_profile_extractors(const std::vector<plugin_sinsp_filterchecks_field>& fields)
+{
+    // Resolve the extractor function, table field accessors and lineage depth of each field once,
+    // the event parsing then runs a tight loop over the compiled extractors without re-dispatching on the field id.
+    // Fields without an extractor always yield an empty string and are dropped.
+    std::vector<profile_extractor> extractors;
     for (const auto& field : fields)
     {
-        tstr.clear();
-        uint64_t tuint64 = UINT64_MAX;
-        uint32_t tuint32 = UINT32_MAX;
-        int64_t tint64 = -1;
-        bool tbool;
-        int64_t ptid = -1;
+        profile_extractor ex;
+        ex.field = field;
+        uint32_t depth = field.argid > 0 ? (uint32_t)field.argid : 0;
         switch(field.id)
         {
         case plugin_sinsp_filterchecks::TYPE_CONTAINER_ID:
-            m_container_id.read_value(tr, thread_entry, tstr);
+            ex.fn = &anomalydetection::extract_thread_str;
+            ex.value = &m_container_id;
             break;
         case plugin_sinsp_filterchecks::TYPE_NAME:
-            m_comm.read_value(tr, thread_entry, tstr);
+        case plugin_sinsp_filterchecks::TYPE_EXE:
+        case plugin_sinsp_filterchecks::TYPE_EXEPATH:
+            ex.fn = &anomalydetection::extract_thread_str;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_NAME ? &m_comm : field.id == plugin_sinsp_filterchecks::TYPE_EXE ? &m_exe : &m_exepath;
             break;
         case plugin_sinsp_filterchecks::TYPE_PNAME:
-        {
-            m_ptid.read_value(tr, thread_entry, ptid);
-            auto lineage = m_thread_table.get_entry(tr, ptid);
-            m_comm.read_value(tr, lineage, tstr);
+        case plugin_sinsp_filterchecks::TYPE_PEXE:
+        case plugin_sinsp_filterchecks::TYPE_PEXEPATH:
+            ex.fn = &anomalydetection::extract_lineage_str;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_PNAME ? &m_comm : field.id == plugin_sinsp_filterchecks::TYPE_PEXE ? &m_exe : &m_exepath;
+            ex.depth = 1;
             break;
-        }
         case plugin_sinsp_filterchecks::TYPE_ANAME:
-        {
+        case plugin_sinsp_filterchecks::TYPE_AEXE:
+        case plugin_sinsp_filterchecks::TYPE_AEXEPATH:
             // todo: check implications of main thread as it's part of the libs implementation
-            if(field.argid < 1)
-            {
-                m_comm.read_value(tr, thread_entry, tstr);
-                break;
-            }
-            m_ptid.read_value(tr, thread_entry, ptid);
-            for(uint32_t j = 0; j < field.argid; j++)
-            {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    if(j == (field.argid - 1))
-                    {
-                        m_comm.read_value(tr, lineage, tstr);
-                        break;
-                    }
-                    if(ptid == 1)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                }
-                catch(const std::exception& e)
-                {
-                }
-            }
+            ex.fn = depth > 0 ? &anomalydetection::extract_lineage_str : &anomalydetection::extract_thread_str;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_ANAME ? &m_comm : field.id == plugin_sinsp_filterchecks::TYPE_AEXE ? &m_exe : &m_exepath;
+            ex.depth = depth;
+            break;
+        case plugin_sinsp_filterchecks::TYPE_CWD:
+            ex.fn = &anomalydetection::extract_thread_str;
+            ex.value = &m_cwd;
             break;
-        }
         case plugin_sinsp_filterchecks::TYPE_ARGS:
-        {
-            const char* arg = nullptr;
-            auto args_table = m_thread_table.get_subtable(tr, m_args, thread_entry, st::SS_PLUGIN_ST_INT64);
-            args_table.iterate_entries(tr, [this, &tr, &arg, &tstr](const falcosecurity::table_entry& e)
-                {
-                    arg = nullptr;
-                    m_args_value.read_value(tr, e, arg);
-                    if (!tstr.empty())
-                    {
-                        tstr += " ";
-                    }
-                    if (arg)
-                    {
-                        tstr += arg;
-                    }
-                    return true;
-                });
+            ex.fn = &anomalydetection::extract_args;
             break;
-        }
         case plugin_sinsp_filterchecks::TYPE_CMDNARGS:
-        {
-            const char* arg = nullptr;
-            size_t c = 0;
-            auto args_table = m_thread_table.get_subtable(tr, m_args, thread_entry, st::SS_PLUGIN_ST_INT64);
-            args_table.iterate_entries(tr, [this, &c](const falcosecurity::table_entry& e)
-                {
-                    c++;
-                    return true;
-                });
-            tstr = std::to_string(c);
+            ex.fn = &anomalydetection::extract_cmdnargs;
             break;
-        }
         case plugin_sinsp_filterchecks::TYPE_CMDLENARGS:
-        {
-            const char* arg = nullptr;
-            size_t c = 0;
-            auto args_table = m_thread_table.get_subtable(tr, m_args, thread_entry, st::SS_PLUGIN_ST_INT64);
-            args_table.iterate_entries(tr, [this, &tr, &arg, &c](const falcosecurity::table_entry& e)
-                {
-                    arg = nullptr;
-                    m_args_value.read_value(tr, e, arg);
-                    c+=std::strlen(arg);
-                    return true;
-                });
-            tstr = std::to_string(c);
+            ex.fn = &anomalydetection::extract_cmdlenargs;
             break;
-        }
         case plugin_sinsp_filterchecks::TYPE_CMDLINE:
-        {
-            m_comm.read_value(tr, thread_entry, tstr);
-            const char* arg = nullptr;
-            auto args_table = m_thread_table.get_subtable(tr, m_args, thread_entry, st::SS_PLUGIN_ST_INT64);
-            args_table.iterate_entries(tr, [this, &tr, &arg, &tstr](const falcosecurity::table_entry& e)
-                {
-                    arg = nullptr;
-                    m_args_value.read_value(tr, e, arg);
-                    if (!tstr.empty())
-                    {
-                        tstr += " ";
-                    }
-                    if (arg)
-                    {
-                        tstr += arg;
-                    }
-                    return true;
-                });
-            break;
-        }
         case plugin_sinsp_filterchecks::TYPE_PCMDLINE:
-        {
-            m_ptid.read_value(tr, thread_entry, ptid);
-            auto lineage = m_thread_table.get_entry(tr, ptid);
-            m_comm.read_value(tr, lineage, tstr);
-            const char* arg = nullptr;
-            auto args_table = m_thread_table.get_subtable(tr, m_args, lineage, st::SS_PLUGIN_ST_INT64);
-            args_table.iterate_entries(tr, [this, &tr, &arg, &tstr](const falcosecurity::table_entry& e)
-                {
-                    arg = nullptr;
-                    m_args_value.read_value(tr, e, arg);
-                    if (!tstr.empty())
-                    {
-                        tstr += " ";
-                    }
-                    if (arg)
-                    {
-                        tstr += arg;
-                    }
-                    return true;
-                });
-            break;
-        }
         case plugin_sinsp_filterchecks::TYPE_ACMDLINE:
-        {
-            if(field.argid < 1)
-            {
-                m_comm.read_value(tr, thread_entry, tstr);
-                const char* arg = nullptr;
-                auto args_table = m_thread_table.get_subtable(tr, m_args, thread_entry, st::SS_PLUGIN_ST_INT64);
-                args_table.iterate_entries(tr, [this, &tr, &arg, &tstr](const falcosecurity::table_entry& e)
-                    {
-                        arg = nullptr;
-                        m_args_value.read_value(tr, e, arg);
-                        if (!tstr.empty())
-                        {
-                            tstr += " ";
-                        }
-                        if (arg)
-                        {
-                            tstr += arg;
-                        }
-                        return true;
-                    });
-                break;
-            }
-            m_ptid.read_value(tr, thread_entry, ptid);
-            for(uint32_t j = 0; j < field.argid; j++)
-            {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    if(j == (field.argid - 1))
-                    {
-                        m_comm.read_value(tr, lineage, tstr);
-                        const char* arg = nullptr;
-                        auto args_table = m_thread_table.get_subtable(tr, m_args, lineage, st::SS_PLUGIN_ST_INT64);
-                        args_table.iterate_entries(tr, [this, &tr, &arg, &tstr](const falcosecurity::table_entry& e)
-                            {
-                                arg = nullptr;
-                                m_args_value.read_value(tr, e, arg);
-                                if (!tstr.empty())
-                                {
-                                    tstr += " ";
-                                }
-                                if (arg)
-                                {
-                                    tstr += arg;
-                                }
-                                return true;
-                            });
-                        break;
-                    }
-                    if(ptid == 1)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                }
-                catch(const std::exception& e)
-                {
-                }
-            }
-            break;
-        }
         case plugin_sinsp_filterchecks::TYPE_EXELINE:
-        {
-            m_exe.read_value(tr, thread_entry, tstr);
-            const char* arg = nullptr;
-            auto args_table = m_thread_table.get_subtable(tr, m_args, thread_entry, st::SS_PLUGIN_ST_INT64);
-            args_table.iterate_entries(tr, [this, &tr, &arg, &tstr](const falcosecurity::table_entry& e)
-                {
-                    arg = nullptr;
-                    m_args_value.read_value(tr, e, arg);
-                    if (!tstr.empty())
-                    {
-                        tstr += " ";
-                    }
-                    if (arg)
-                    {
-                        tstr += arg;
-                    }
-                    return true;
-                });
+            ex.fn = &anomalydetection::extract_cmdline;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_EXELINE ? &m_exe : &m_comm;
+            ex.depth = field.id == plugin_sinsp_filterchecks::TYPE_PCMDLINE ? 1 : field.id == plugin_sinsp_filterchecks::TYPE_ACMDLINE ? depth : 0;
             break;
-        }
-        case plugin_sinsp_filterchecks::TYPE_EXE:
-            m_exe.read_value(tr, thread_entry, tstr);
+        case plugin_sinsp_filterchecks::TYPE_TTY:
+            ex.fn = &anomalydetection::extract_thread_num<uint32_t>;
+            ex.value = &m_tty;
             break;
-        case plugin_sinsp_filterchecks::TYPE_PEXE:
-        {
-            m_ptid.read_value(tr, thread_entry, ptid);
-            auto lineage = m_thread_table.get_entry(tr, ptid);
-            m_exe.read_value(tr, lineage, tstr);
+        case plugin_sinsp_filterchecks::TYPE_PID:
+        case plugin_sinsp_filterchecks::TYPE_VPID:
+        case plugin_sinsp_filterchecks::TYPE_SID:
+        case plugin_sinsp_filterchecks::TYPE_VPGID:
+            ex.fn = &anomalydetection::extract_thread_num<int64_t>;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_PID ? &m_pid : field.id == plugin_sinsp_filterchecks::TYPE_VPID ? &m_vpid : field.id == plugin_sinsp_filterchecks::TYPE_SID ? &m_sid : &m_vpgid;
             break;
-        }
-        case plugin_sinsp_filterchecks::TYPE_AEXE:
-        {
-            if(field.argid < 1)
-            {
-                m_exe.read_value(tr, thread_entry, tstr);
-                break;
-            }
-            m_ptid.read_value(tr, thread_entry, ptid);
-            for(uint32_t j = 0; j < field.argid; j++)
-            {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    if(j == (field.argid - 1))
-                    {
-                        m_exe.read_value(tr, lineage, tstr);
-                        break;
-                    }
-                    if(ptid == 1)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                }
-                catch(const std::exception& e)
-                {
-                }
-            }
+        case plugin_sinsp_filterchecks::TYPE_PPID:
+        case plugin_sinsp_filterchecks::TYPE_PVPID:
+            ex.fn = &anomalydetection::extract_lineage_int64;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_PPID ? &m_pid : &m_vpid;
+            ex.depth = 1;
             break;
-        }
-        case plugin_sinsp_filterchecks::TYPE_EXEPATH:
-            m_exepath.read_value(tr, thread_entry, tstr);
+        case plugin_sinsp_filterchecks::TYPE_APID:
+            ex.fn = depth > 0 ? &anomalydetection::extract_lineage_int64 : &anomalydetection::extract_thread_num<int64_t>;
+            ex.value = &m_pid;
+            ex.depth = depth;
             break;
-        case plugin_sinsp_filterchecks::TYPE_PEXEPATH:
-        {
-            m_ptid.read_value(tr, thread_entry, ptid);
-            auto lineage = m_thread_table.get_entry(tr, ptid);
-            m_exepath.read_value(tr, lineage, tstr);
+        case plugin_sinsp_filterchecks::TYPE_SNAME:
+        case plugin_sinsp_filterchecks::TYPE_SID_EXE:
+        case plugin_sinsp_filterchecks::TYPE_SID_EXEPATH:
+            ex.fn = &anomalydetection::extract_leader_str;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_SNAME ? &m_comm : field.id == plugin_sinsp_filterchecks::TYPE_SID_EXE ? &m_exe : &m_exepath;
+            ex.group = &m_sid;
+            ex.depth = 9;
             break;
-        }
-        case plugin_sinsp_filterchecks::TYPE_AEXEPATH:
-        {
-            if(field.argid < 1)
-            {
-                m_exepath.read_value(tr, thread_entry, tstr);
-                break;
-            }
-            m_ptid.read_value(tr, thread_entry, ptid);
-            for(uint32_t j = 0; j < field.argid; j++)
-            {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    if(j == (field.argid - 1))
-                    {
-                        m_exepath.read_value(tr, lineage, tstr);
-                        break;
-                    }
-                    if(ptid == 1)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                }
-                catch(const std::exception& e)
-                {
-                }
-            }
+        case plugin_sinsp_filterchecks::TYPE_VPGID_NAME:
+        case plugin_sinsp_filterchecks::TYPE_VPGID_EXE:
+        case plugin_sinsp_filterchecks::TYPE_VPGID_EXEPATH:
+            ex.fn = &anomalydetection::extract_leader_str;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_VPGID_NAME ? &m_comm : field.id == plugin_sinsp_filterchecks::TYPE_VPGID_EXE ? &m_exe : &m_exepath;
+            ex.group = &m_vpgid;
+            ex.depth = 5;
+            break;
+        case plugin_sinsp_filterchecks::TYPE_ENV:
+            ex.fn = &anomalydetection::extract_env;
+            break;
+        case plugin_sinsp_filterchecks::TYPE_IS_EXE_WRITABLE:
+        case plugin_sinsp_filterchecks::TYPE_IS_EXE_UPPER_LAYER:
+        case plugin_sinsp_filterchecks::TYPE_IS_EXE_FROM_MEMFD:
+            ex.fn = &anomalydetection::extract_thread_num<bool>;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_IS_EXE_WRITABLE ? &m_exe_writable : field.id == plugin_sinsp_filterchecks::TYPE_IS_EXE_UPPER_LAYER ? &m_exe_upper_layer : &m_exe_from_memfd;
+            break;
+        case plugin_sinsp_filterchecks::TYPE_EXE_INO:
+        case plugin_sinsp_filterchecks::TYPE_EXE_INO_CTIME:
+        case plugin_sinsp_filterchecks::TYPE_EXE_INO_MTIME:
+            ex.fn = &anomalydetection::extract_thread_num<uint64_t>;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_EXE_INO ? &m_exe_ino : field.id == plugin_sinsp_filterchecks::TYPE_EXE_INO_CTIME ? &m_exe_ino_ctime : &m_exe_ino_mtime;
+            break;
+        case plugin_sinsp_filterchecks::TYPE_IS_SID_LEADER:
+        case plugin_sinsp_filterchecks::TYPE_IS_VPGID_LEADER:
+            ex.fn = &anomalydetection::extract_is_leader;
+            ex.group = field.id == plugin_sinsp_filterchecks::TYPE_IS_SID_LEADER ? &m_sid : &m_vpgid;
+            break;
+
+        //
+        // fd related
+        //
+
+        case plugin_sinsp_filterchecks::TYPE_FDNUM:
+            ex.fn = &anomalydetection::extract_fdnum;
+            break;
+        case plugin_sinsp_filterchecks::TYPE_FDNAME:
+            ex.fn = &anomalydetection::extract_fdname;
+            m_dirfd_cache_enabled = true;
+            break;
+        case plugin_sinsp_filterchecks::TYPE_DIRECTORY:
+        case plugin_sinsp_filterchecks::TYPE_FILENAME:
+            ex.fn = &anomalydetection::extract_fd_dir_filename;
+            m_dirfd_cache_enabled = true;
             break;
-        }
-        case plugin_sinsp_filterchecks::TYPE_CWD:
-            m_cwd.read_value(tr, thread_entry, tstr);
+        case plugin_sinsp_filterchecks::TYPE_INO:
+            ex.fn = &anomalydetection::extract_fd_value<uint64_t>;
+            ex.value = &m_fd_ino_value;
             break;
-        case plugin_sinsp_filterchecks::TYPE_TTY:
-            m_tty.read_value(tr, thread_entry, tuint32);
-            tstr = std::to_string(tuint32);
+        case plugin_sinsp_filterchecks::TYPE_DEV:
+            ex.fn = &anomalydetection::extract_fd_value<uint32_t>;
+            ex.value = &m_fd_dev_value;
             break;
-        case plugin_sinsp_filterchecks::TYPE_PID:
-            m_pid.read_value(tr, thread_entry, tint64);
-            tstr = std::to_string(tint64);
+        case plugin_sinsp_filterchecks::TYPE_FDNAMERAW:
+            ex.fn = &anomalydetection::extract_fd_value<std::string>;
+            ex.value = &m_fd_nameraw_value;
             break;
-        case plugin_sinsp_filterchecks::TYPE_PPID:
-            {
-                m_ptid.read_value(tr, thread_entry, ptid);
-                auto lineage = m_thread_table.get_entry(tr, ptid);
-                m_pid.read_value(tr, lineage, tint64);
-                tstr = std::to_string(tint64);
-                break;
-            }
-        case plugin_sinsp_filterchecks::TYPE_APID:
-        {
-            if(field.argid < 1)
+
+        //
+        // Custom behavior profile short-cut fields
+        //
+
+        case plugin_sinsp_filterchecks::TYPE_CUSTOM_ANAME_LINEAGE_CONCAT:
+        case plugin_sinsp_filterchecks::TYPE_CUSTOM_AEXE_LINEAGE_CONCAT:
+        case plugin_sinsp_filterchecks::TYPE_CUSTOM_AEXEPATH_LINEAGE_CONCAT:
+            if (depth < 1)
             {
-                m_pid.read_value(tr, thread_entry, tint64);
-                tstr = std::to_string(tint64);
                 break;
             }
-            m_ptid.read_value(tr, thread_entry, ptid);
-            for(uint32_t j = 0; j < field.argid; j++)
-            {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    if(j == (field.argid - 1))
-                    {
-                        m_pid.read_value(tr, lineage, tint64);
-                        tstr = std::to_string(tint64);
-                        break;
-                    }
-                    if(ptid == 1)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                }
-                catch(const std::exception& e)
-                {
-                }
-            }
+            ex.fn = &anomalydetection::extract_lineage_concat;
+            ex.value = field.id == plugin_sinsp_filterchecks::TYPE_CUSTOM_ANAME_LINEAGE_CONCAT ? &m_comm : field.id == plugin_sinsp_filterchecks::TYPE_CUSTOM_AEXE_LINEAGE_CONCAT ? &m_exe : &m_exepath;
+            ex.depth = depth;
             break;
-        }
-        case plugin_sinsp_filterchecks::TYPE_VPID:
-            m_vpid.read_value(tr, thread_entry, tint64);
-            tstr = std::to_string(tint64);
+        case plugin_sinsp_filterchecks::TYPE_CUSTOM_FDNAME_PART1:
+        case plugin_sinsp_filterchecks::TYPE_CUSTOM_FDNAME_PART2:
+            ex.fn = &anomalydetection::extract_fdname_part;
             break;
-        case plugin_sinsp_filterchecks::TYPE_PVPID:
-            {
-                m_ptid.read_value(tr, thread_entry, ptid);
-                auto lineage = m_thread_table.get_entry(tr, ptid);
-                m_vpid.read_value(tr, lineage, tint64);
-                tstr = std::to_string(tint64);
-                break;
-            }
-        case plugin_sinsp_filterchecks::TYPE_SID:
-            m_sid.read_value(tr, thread_entry, tint64);
-            tstr = std::to_string(tint64);
+        default:
             break;
-        case plugin_sinsp_filterchecks::TYPE_SNAME:
+        }
+        if (ex.fn != nullptr && ex.depth > 0 && ex.depth <= LINEAGE_CACHE_MAX_DEPTH && ex.group == nullptr)
         {
-            int64_t sid;
-            m_sid.read_value(tr, thread_entry, sid);
-            m_ptid.read_value(tr, thread_entry, ptid);
-            falcosecurity::table_entry last_entry(nullptr, nullptr, nullptr);
-            falcosecurity::table_entry* leader = &thread_entry;
-            for(uint32_t j = 0; j < 9; j++)
+            ex.lineage = get_lineage_cache_field(ex.value);
+            if (ex.lineage != nullptr)
             {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    m_sid.read_value(tr, lineage, tint64);
-                    if(sid != tint64)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                    last_entry = std::move(lineage);
-                    leader = &last_entry;
-                }
-                catch(const std::exception& e)
+                m_lineage_depth = std::max(m_lineage_depth, ex.depth);
+                if (std::find(m_lineage_values.begin(), m_lineage_values.end(), ex.value) == m_lineage_values.end())
                 {
+                    m_lineage_values.push_back(ex.value);
                 }
             }
-            m_comm.read_value(tr, *leader, tstr);
-            break;
         }
-        case plugin_sinsp_filterchecks::TYPE_SID_EXE:
+        if (ex.fn != nullptr)
         {
-            int64_t sid;
-            m_sid.read_value(tr, thread_entry, sid);
-            m_ptid.read_value(tr, thread_entry, ptid);
-            falcosecurity::table_entry last_entry(nullptr, nullptr, nullptr);
-            falcosecurity::table_entry* leader = &thread_entry;
-            for(uint32_t j = 0; j < 9; j++)
-            {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    m_sid.read_value(tr, lineage, tint64);
-                    if(sid != tint64)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                    last_entry = std::move(lineage);
-                    leader = &last_entry;
-                }
-                catch(const std::exception& e)
-                {
-                }
-            }
-            m_exe.read_value(tr, *leader, tstr);
-            break;
+            std::string key = std::to_string(field.id) + ":" + std::to_string(field.argid) + ":" + field.argname;
+            ex.slot = m_extraction_slots.emplace(key, (uint32_t)m_extraction_slots.size()).first->second;
+            extractors.emplace_back(std::move(ex));
         }
-        case plugin_sinsp_filterchecks::TYPE_SID_EXEPATH:
+    }
+    return extractors;
+}
+
+bool anomalydetection::is_state_event_code(ppm_event_code code) const
+{
+    // Event codes `parse_event` tracks regardless of the behavior profiles, keep in sync with its first switch
+    switch(code)
+    {
+    case PPME_SYSCALL_OPEN_X:
+    case PPME_SOCKET_ACCEPT_5_X:
+    case PPME_SOCKET_ACCEPT4_6_X:
+    case PPME_SYSCALL_CREAT_X:
+    case PPME_SYSCALL_OPENAT_2_X:
+    case PPME_SYSCALL_OPENAT2_X:
+    case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
+    case PPME_SOCKET_CONNECT_X:
+        return true;
+    case PPME_SYSCALL_CLONE_20_X:
+    case PPME_SYSCALL_CLONE3_X:
+    case PPME_SYSCALL_FORK_20_X:
+    case PPME_SYSCALL_VFORK_20_X:
+        return m_lineage_depth > 0;
+    case PPME_SYSCALL_EXECVE_19_X:
+    case PPME_SYSCALL_EXECVEAT_X:
+        return m_lineage_depth > 0 || m_dirfd_cache_enabled;
+    case PPME_SYSCALL_CLOSE_E:
+    case PPME_SYSCALL_CLOSE_X:
+    case PPME_SYSCALL_DUP_1_X:
+    case PPME_SYSCALL_DUP2_X:
+    case PPME_SYSCALL_DUP3_X:
+    case PPME_PROCEXIT_1_E:
+        return m_dirfd_cache_enabled;
+    default:
+        return false;
+    }
+}
+
+std::optional<falcosecurity::table_entry> anomalydetection::get_lineage_entry(const falcosecurity::table_reader& tr, const falcosecurity::table_entry& thread_entry, uint32_t depth)
+{
+    // Walk up `depth` ancestors, stops at init or at the first missing ancestor
+    int64_t ptid = -1;
+    m_ptid.read_value(tr, thread_entry, ptid);
+    for(uint32_t j = 0; j < depth; j++)
+    {
+        try
         {
-            int64_t sid;
-            m_sid.read_value(tr, thread_entry, sid);
-            m_ptid.read_value(tr, thread_entry, ptid);
-            falcosecurity::table_entry last_entry(nullptr, nullptr, nullptr);
-            falcosecurity::table_entry* leader = &thread_entry;
-            for(uint32_t j = 0; j < 9; j++)
+            auto lineage = m_thread_table.get_entry(tr, ptid);
+            if(j == (depth - 1))
             {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    m_sid.read_value(tr, lineage, tint64);
-                    if(sid != tint64)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                    last_entry = std::move(lineage);
-                    leader = &last_entry;
-                }
-                catch(const std::exception& e)
-                {
-                }
+                return lineage;
             }
-            m_exepath.read_value(tr, *leader, tstr);
-            break;
-        }
-        case plugin_sinsp_filterchecks::TYPE_VPGID:
-            m_vpgid.read_value(tr, thread_entry, tint64);
-            tstr = std::to_string(tint64);
-            break;
-        case plugin_sinsp_filterchecks::TYPE_VPGID_NAME:
-        {
-            int64_t vpgid;
-            m_vpgid.read_value(tr, thread_entry, vpgid);
-            m_ptid.read_value(tr, thread_entry, ptid);
-            falcosecurity::table_entry last_entry(nullptr, nullptr, nullptr);
-            falcosecurity::table_entry* leader = &thread_entry;
-            for(uint32_t j = 0; j < 5; j++)
+            if(ptid == 1)
             {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    m_vpgid.read_value(tr, lineage, tint64);
-                    if(vpgid != tint64)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                    last_entry = std::move(lineage);
-                    leader = &last_entry;
-                }
-                catch(const std::exception& e)
-                {
-                }
+                break;
             }
-            m_comm.read_value(tr, *leader, tstr);
-            break;
+            m_ptid.read_value(tr, lineage, ptid);
         }
-        case plugin_sinsp_filterchecks::TYPE_VPGID_EXE:
+        catch(const std::exception& e)
         {
-            int64_t vpgid;
-            m_vpgid.read_value(tr, thread_entry, vpgid);
-            m_ptid.read_value(tr, thread_entry, ptid);
-            falcosecurity::table_entry last_entry(nullptr, nullptr, nullptr);
-            falcosecurity::table_entry* leader = &thread_entry;
-            for(uint32_t j = 0; j < 5; j++)
-            {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    m_vpgid.read_value(tr, lineage, tint64);
-                    if(vpgid != tint64)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                    last_entry = std::move(lineage);
-                    leader = &last_entry;
-                }
-                catch(const std::exception& e)
-                {
-                }
-            }
-            m_exe.read_value(tr, *leader, tstr);
             break;
         }
-        case plugin_sinsp_filterchecks::TYPE_VPGID_EXEPATH:
+    }
+    return std::nullopt;
+}
+
+falcosecurity::table_field* anomalydetection::get_lineage_cache_field(const falcosecurity::table_field* value)
+{
+    if (value == &m_comm)
+    {
+        return &m_lineage_comm;
+    }
+    if (value == &m_exe)
+    {
+        return &m_lineage_exe;
+    }
+    if (value == &m_exepath)
+    {
+        return &m_lineage_exepath;
+    }
+    if (value == &m_pid)
+    {
+        return &m_lineage_pid;
+    }
+    return nullptr;
+}
+
+std::string anomalydetection::read_lineage_value(const falcosecurity::table_reader& tr, const falcosecurity::table_entry& entry, falcosecurity::table_field* value)
+{
+    std::string tstr;
+    if (value == &m_pid)
+    {
+        int64_t pid = -1;
+        value->read_value(tr, entry, pid);
+        tstr = std::to_string(pid);
+    }
+    else
+    {
+        value->read_value(tr, entry, tstr);
+    }
+    return tstr;
+}
+
+std::string anomalydetection::build_lineage(const falcosecurity::table_reader& tr, const falcosecurity::table_entry& entry, falcosecurity::table_field* value)
+{
+    // Live walk with the same stop conditions as `get_lineage_entry`, used for threads that predate the plugin
+    std::string lineage = read_lineage_value(tr, entry, value);
+    int64_t ptid = -1;
+    m_ptid.read_value(tr, entry, ptid);
+    for(uint32_t j = 0; j < m_lineage_depth; j++)
+    {
+        try
         {
-            int64_t vpgid;
-            m_vpgid.read_value(tr, thread_entry, vpgid);
-            m_ptid.read_value(tr, thread_entry, ptid);
-            falcosecurity::table_entry last_entry(nullptr, nullptr, nullptr);
-            falcosecurity::table_entry* leader = &thread_entry;
-            for(uint32_t j = 0; j < 5; j++)
+            auto ancestor = m_thread_table.get_entry(tr, ptid);
+            lineage += LINEAGE_SEPARATOR;
+            lineage += read_lineage_value(tr, ancestor, value);
+            if(ptid == 1)
             {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    m_vpgid.read_value(tr, lineage, tint64);
-                    if(vpgid != tint64)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                    last_entry = std::move(lineage);
-                    leader = &last_entry;
-                }
-                catch(const std::exception& e)
-                {
-                }
+                break;
             }
-            m_exepath.read_value(tr, *leader, tstr);
+            m_ptid.read_value(tr, ancestor, ptid);
+        }
+        catch(const std::exception& e)
+        {
             break;
         }
-        case plugin_sinsp_filterchecks::TYPE_ENV:
+    }
+    return lineage;
+}
+
+void anomalydetection::update_lineage_cache(const falcosecurity::table_reader& tr, const falcosecurity::table_writer& tw, int64_t thread_id)
+{
+    // Each thread caches its own value followed by the cached lineage of its parent, captured at clone / exec time.
+    // Ancestor lookups in `extract` then cost one field read instead of one thread table lookup per level.
+    // Only the fields the behavior profiles reference are cached, see `m_lineage_values`.
+    if (m_lineage_depth == 0)
+    {
+        return;
+    }
+    auto thread_entry = m_thread_table.get_entry(tr, thread_id);
+    int64_t ptid = -1;
+    m_ptid.read_value(tr, thread_entry, ptid);
+    m_lineage_ptid.write_value(tw, thread_entry, ptid);
+    std::optional<falcosecurity::table_entry> parent;
+    bool parent_cached = false; // Parent cache built and its parent unchanged since
+    int64_t parent_ptid = -1;
+    try
+    {
+        parent.emplace(m_thread_table.get_entry(tr, ptid));
+        int64_t parent_cached_ptid = -1;
+        m_ptid.read_value(tr, parent.value(), parent_ptid);
+        m_lineage_ptid.read_value(tr, parent.value(), parent_cached_ptid);
+        parent_cached = parent_ptid == parent_cached_ptid;
+        if (!parent_cached)
+        {
+            m_lineage_ptid.write_value(tw, parent.value(), parent_ptid);
+        }
+    }
+    catch(const std::exception& e)
+    {
+    }
+
+    for (auto* value : m_lineage_values)
+    {
+        auto* cache = get_lineage_cache_field(value);
+        std::string lineage = read_lineage_value(tr, thread_entry, value);
+        if (parent.has_value())
         {
-            const char* env = nullptr;
-            auto env_table = m_thread_table.get_subtable(tr, m_env, thread_entry, st::SS_PLUGIN_ST_INT64);
-            auto argname = field.argname;
-            if(!argname.empty())
+            std::string parent_lineage;
+            if (parent_cached)
             {
-                size_t nlen = argname.length();
-                env_table.iterate_entries(tr, [this, &tr, &env, &tstr, &nlen, &argname](const falcosecurity::table_entry& e)
-                {
-                    env = nullptr;
-                    std::string env_var;
-                    m_env_value.read_value(tr, e, env);
-                    if (env != nullptr)
-                    {
-                        env_var = std::string(env);
-                    }
-                    if((env_var.length() > (nlen + 1)) && (env_var[nlen] == '=') &&
-			!env_var.compare(0, nlen, argname))
-                    {
-                        size_t first = env_var.find_first_not_of(' ', nlen + 1);
-                        size_t last = env_var.find_last_not_of(' ');
-                        tstr = env_var.substr(first, last - first + 1);
-                    }
-                    return true;
-                });
-            } else
+                cache->read_value(tr, parent.value(), parent_lineage);
+            }
+            if (parent_lineage.empty())
             {
-                env_table.iterate_entries(tr, [this, &tr, &env, &tstr](const falcosecurity::table_entry& e)
-                    {
-                        env = nullptr;
-                        m_env_value.read_value(tr, e, env);
-                        if (!tstr.empty())
-                        {
-                            tstr += " ";
-                        }
-                        if (env)
-                        {
-                            tstr += env;
-                        }
-                        return true;
-                    });
+                parent_lineage = build_lineage(tr, parent.value(), value);
+                cache->write_value(tw, parent.value(), parent_lineage);
             }
-            break;
+            lineage += LINEAGE_SEPARATOR;
+            lineage += parent_lineage;
         }
-        case plugin_sinsp_filterchecks::TYPE_IS_EXE_WRITABLE:
+
+        // Keep the thread itself plus at most `m_lineage_depth` ancestors
+        size_t pos = 0;
+        for (uint32_t j = 0; j <= m_lineage_depth && pos != std::string::npos; j++)
         {
-            m_exe_writable.read_value(tr, thread_entry, tbool);
-            tstr = std::to_string(tbool);
-            break;
+            pos = lineage.find(LINEAGE_SEPARATOR, j == 0 ? 0 : pos + 1);
         }
-        case plugin_sinsp_filterchecks::TYPE_IS_EXE_UPPER_LAYER:
+        if (pos != std::string::npos)
         {
-            m_exe_upper_layer.read_value(tr, thread_entry, tbool);
-            tstr = std::to_string(tbool);
-            break;
+            lineage.resize(pos);
         }
-        case plugin_sinsp_filterchecks::TYPE_IS_EXE_FROM_MEMFD:
+        cache->write_value(tw, thread_entry, lineage);
+    }
+}
+
+bool anomalydetection::read_lineage_cache(profile_extraction_ctx& ctx, const profile_extractor& ex, bool concat, std::string& tstr)
+{
+    // Returns false on a cache miss, the caller then walks the thread table.
+    // Ancestors come from the cache, the thread itself is always read live.
+    if (ex.lineage == nullptr)
+    {
+        return false;
+    }
+    // Re-parented since cached (e.g. its parent exited), the cached ancestors are no longer the live ones
+    int64_t ptid = -1;
+    int64_t cached_ptid = -1;
+    m_ptid.read_value(ctx.tr, ctx.thread_entry, ptid);
+    m_lineage_ptid.read_value(ctx.tr, ctx.thread_entry, cached_ptid);
+    if (ptid != cached_ptid)
+    {
+        return false;
+    }
+    const char* cached = nullptr;
+    ex.lineage->read_value(ctx.tr, ctx.thread_entry, cached);
+    if (cached == nullptr || *cached == '\0')
+    {
+        return false;
+    }
+    std::string_view lineage(cached);
+    size_t start = lineage.find(LINEAGE_SEPARATOR);
+    for(uint32_t j = 1; j <= ex.depth && start != std::string_view::npos; j++)
+    {
+        start++;
+        size_t end = lineage.find(LINEAGE_SEPARATOR, start);
+        auto segment = lineage.substr(start, end == std::string_view::npos ? end : end - start);
+        if (concat)
         {
-            m_exe_from_memfd.read_value(tr, thread_entry, tbool);
-            tstr = std::to_string(tbool);
-            break;
+            tstr += segment;
         }
-        case plugin_sinsp_filterchecks::TYPE_EXE_INO:
+        else if (j == ex.depth)
         {
-            m_exe_ino.read_value(tr, thread_entry, tuint64);
-            tstr = std::to_string(tuint64);
-            break;
+            tstr = segment;
         }
-        case plugin_sinsp_filterchecks::TYPE_EXE_INO_CTIME:
+        start = end;
+    }
+    return true;
+}
+
+falcosecurity::table_entry* anomalydetection::get_lastevent_fd_entry(profile_extraction_ctx& ctx)
+{
+    // Resolved at most once per event and behavior profile
+    if (!ctx.fd_resolved)
+    {
+        ctx.fd_resolved = true;
+        try
         {
-            m_exe_ino_ctime.read_value(tr, thread_entry, tuint64);
-            tstr = std::to_string(tuint64);
-            break;
+            using st = falcosecurity::state_value_type;
+            auto fd_table = m_thread_table.get_subtable(
+            ctx.tr, m_fds, ctx.thread_entry,
+            st::SS_PLUGIN_ST_INT64);
+            int64_t fd = -1;
+            m_lastevent_fd_field.read_value(ctx.tr, ctx.thread_entry, fd);
+            ctx.fd_entry.emplace(fd_table.get_entry(ctx.tr, fd));
         }
-        case plugin_sinsp_filterchecks::TYPE_EXE_INO_MTIME:
+        catch(const std::exception& e)
         {
-            m_exe_ino_mtime.read_value(tr, thread_entry, tuint64);
-            tstr = std::to_string(tuint64);
-            break;
         }
-        case plugin_sinsp_filterchecks::TYPE_IS_SID_LEADER:
+    }
+    return ctx.fd_entry.has_value() ? &ctx.fd_entry.value() : nullptr;
+}
+
+void anomalydetection::append_args(const falcosecurity::table_reader& tr, const falcosecurity::table_entry& entry, std::string& tstr)
+{
+    using st = falcosecurity::state_value_type;
+    const char* arg = nullptr;
+    auto args_table = m_thread_table.get_subtable(tr, m_args, entry, st::SS_PLUGIN_ST_INT64);
+    args_table.iterate_entries(tr, [this, &tr, &arg, &tstr](const falcosecurity::table_entry& e)
         {
-            uint64_t vpid;
-            m_sid.read_value(tr, thread_entry, tint64);
-            m_vpid.read_value(tr, thread_entry, vpid);
-            tbool = tint64 == vpid;
-            tstr = std::to_string(tbool);
-            break;
-        }
-        case plugin_sinsp_filterchecks::TYPE_IS_VPGID_LEADER:
+            arg = nullptr;
+            m_args_value.read_value(tr, e, arg);
+            if (!tstr.empty())
+            {
+                tstr += " ";
+            }
+            if (arg)
+            {
+                tstr += arg;
+            }
+            return true;
+        });
+}
+
+bool anomalydetection::extract_thread_str(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    ex.value->read_value(ctx.tr, ctx.thread_entry, tstr);
+    return true;
+}
+
+bool anomalydetection::extract_lineage_str(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    if (read_lineage_cache(ctx, ex, false, tstr))
+    {
+        return true;
+    }
+    auto lineage = get_lineage_entry(ctx.tr, ctx.thread_entry, ex.depth);
+    if (lineage.has_value())
+    {
+        ex.value->read_value(ctx.tr, lineage.value(), tstr);
+    }
+    return true;
+}
+
+template<typename T>
+bool anomalydetection::extract_thread_num(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    T value{};
+    ex.value->read_value(ctx.tr, ctx.thread_entry, value);
+    tstr = std::to_string(value);
+    return true;
+}
+
+bool anomalydetection::extract_lineage_int64(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    if (read_lineage_cache(ctx, ex, false, tstr))
+    {
+        return true;
+    }
+    auto lineage = get_lineage_entry(ctx.tr, ctx.thread_entry, ex.depth);
+    if (lineage.has_value())
+    {
+        int64_t value = -1;
+        ex.value->read_value(ctx.tr, lineage.value(), value);
+        tstr = std::to_string(value);
+    }
+    return true;
+}
+
+bool anomalydetection::extract_args(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    append_args(ctx.tr, ctx.thread_entry, tstr);
+    return true;
+}
+
+bool anomalydetection::extract_cmdnargs(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    using st = falcosecurity::state_value_type;
+    size_t c = 0;
+    auto args_table = m_thread_table.get_subtable(ctx.tr, m_args, ctx.thread_entry, st::SS_PLUGIN_ST_INT64);
+    args_table.iterate_entries(ctx.tr, [&c](const falcosecurity::table_entry& e)
         {
-            uint64_t vpid;
-            m_vpgid.read_value(tr, thread_entry, tint64);
-            m_vpid.read_value(tr, thread_entry, vpid);
-            tbool = tint64 == vpid;
-            tstr = std::to_string(tbool);
-            break;
-        }
+            c++;
+            return true;
+        });
+    tstr = std::to_string(c);
+    return true;
+}
 
+bool anomalydetection::extract_cmdlenargs(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    using st = falcosecurity::state_value_type;
+    const char* arg = nullptr;
+    size_t c = 0;
+    auto& tr = ctx.tr;
+    auto args_table = m_thread_table.get_subtable(tr, m_args, ctx.thread_entry, st::SS_PLUGIN_ST_INT64);
+    args_table.iterate_entries(tr, [this, &tr, &arg, &c](const falcosecurity::table_entry& e)
+        {
+            arg = nullptr;
+            m_args_value.read_value(tr, e, arg);
+            if (arg)
+            {
+                c+=std::strlen(arg);
+            }
+            return true;
+        });
+    tstr = std::to_string(c);
+    return true;
+}
 
-        //
-        // fd related
-        //
+bool anomalydetection::extract_cmdline(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    // comm (exe for exeline) followed by the args of the thread itself or of one of its ancestors
+    if (ex.depth < 1)
+    {
+        ex.value->read_value(ctx.tr, ctx.thread_entry, tstr);
+        append_args(ctx.tr, ctx.thread_entry, tstr);
+        return true;
+    }
+    auto lineage = get_lineage_entry(ctx.tr, ctx.thread_entry, ex.depth);
+    if (lineage.has_value())
+    {
+        ex.value->read_value(ctx.tr, lineage.value(), tstr);
+        append_args(ctx.tr, lineage.value(), tstr);
+    }
+    return true;
+}
 
-        case plugin_sinsp_filterchecks::TYPE_FDNUM:
+bool anomalydetection::extract_leader_str(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    // Walk up at most `depth` ancestors as long as they share the session or process group id of the thread
+    auto& tr = ctx.tr;
+    int64_t group_id;
+    int64_t tint64 = -1;
+    int64_t ptid = -1;
+    ex.group->read_value(tr, ctx.thread_entry, group_id);
+    m_ptid.read_value(tr, ctx.thread_entry, ptid);
+    falcosecurity::table_entry last_entry(nullptr, nullptr, nullptr);
+    falcosecurity::table_entry* leader = &ctx.thread_entry;
+    for(uint32_t j = 0; j < ex.depth; j++)
+    {
+        try
         {
-            switch(evt.get_type())
-            {
-            case PPME_SYSCALL_OPEN_X:
-            case PPME_SOCKET_ACCEPT_5_X:
-            case PPME_SOCKET_ACCEPT4_6_X:
-            case PPME_SYSCALL_CREAT_X:
-            case PPME_SOCKET_CONNECT_X:
-            case PPME_SYSCALL_OPENAT_2_X:
-            case PPME_SYSCALL_OPENAT2_X:
-            case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
+            auto lineage = m_thread_table.get_entry(tr, ptid);
+            ex.group->read_value(tr, lineage, tint64);
+            if(group_id != tint64)
             {
-                m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                tstr = std::to_string(tint64);
-                if (tstr.empty())
-                {
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field);
-                }
                 break;
             }
-            default:
-                // Clear the entire profile when invoking the fd related profile for non fd syscalls
-                behavior_profile_concat_str.clear();
-            }
+            m_ptid.read_value(tr, lineage, ptid);
+            last_entry = std::move(lineage);
+            leader = &last_entry;
+        }
+        catch(const std::exception& e)
+        {
             break;
         }
-        case plugin_sinsp_filterchecks::TYPE_FDNAME:
+    }
+    ex.value->read_value(tr, *leader, tstr);
+    return true;
+}
+
+bool anomalydetection::extract_is_leader(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    int64_t group_id = -1;
+    int64_t vpid = -1;
+    ex.group->read_value(ctx.tr, ctx.thread_entry, group_id);
+    m_vpid.read_value(ctx.tr, ctx.thread_entry, vpid);
+    tstr = std::to_string(group_id == vpid);
+    return true;
+}
+
+bool anomalydetection::extract_env(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    using st = falcosecurity::state_value_type;
+    auto& tr = ctx.tr;
+    const char* env = nullptr;
+    auto env_table = m_thread_table.get_subtable(tr, m_env, ctx.thread_entry, st::SS_PLUGIN_ST_INT64);
+    const auto& argname = ex.field.argname;
+    if(!argname.empty())
+    {
+        size_t nlen = argname.length();
+        env_table.iterate_entries(tr, [this, &tr, &env, &tstr, &nlen, &argname](const falcosecurity::table_entry& e)
         {
-            switch(evt.get_type())
+            env = nullptr;
+            m_env_value.read_value(tr, e, env);
+            if (env == nullptr)
             {
-            case PPME_SOCKET_ACCEPT_5_X:
-            case PPME_SOCKET_ACCEPT4_6_X:
-            case PPME_SOCKET_CONNECT_X:
-            case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
-            {
-                try
-                {
-                    auto fd_table = m_thread_table.get_subtable(
-                    tr, m_fds, thread_entry,
-                    st::SS_PLUGIN_ST_INT64);
-                    m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                    auto fd_entry = fd_table.get_entry(tr, tint64);
-                    m_fd_name_value.read_value(tr, fd_entry, tstr);
-                }
-                catch(const std::exception& e)
-                {
-                }
-                if (tstr.empty())
-                {
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field);
-                }
-                break;
+                return true;
             }
-            case PPME_SYSCALL_OPEN_X:
-            case PPME_SYSCALL_CREAT_X:
+            std::string_view env_var(env);
+            if((env_var.length() > (nlen + 1)) && (env_var[nlen] == '=') &&
+                !env_var.compare(0, nlen, argname))
             {
-                try
-                {
-                    auto fd_table = m_thread_table.get_subtable(
-                    tr, m_fds, thread_entry,
-                    st::SS_PLUGIN_ST_INT64);
-                    m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                    auto fd_entry = fd_table.get_entry(tr, tint64);
-                    m_fd_name_value.read_value(tr, fd_entry, tstr);
-                }
-                catch(const std::exception& e)
-                {
-                }
-                if (tstr.empty())
-                {
-                    std::string cwd;
-                    m_cwd.read_value(tr, thread_entry, cwd);
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field, cwd);
-                }
-                break;
+                size_t first = env_var.find_first_not_of(' ', nlen + 1);
+                size_t last = env_var.find_last_not_of(' ');
+                tstr = env_var.substr(first, last - first + 1);
             }
-            case PPME_SYSCALL_OPENAT_2_X:
-            case PPME_SYSCALL_OPENAT2_X:
+            return true;
+        });
+    } else
+    {
+        env_table.iterate_entries(tr, [this, &tr, &env, &tstr](const falcosecurity::table_entry& e)
             {
-                try
+                env = nullptr;
+                m_env_value.read_value(tr, e, env);
+                if (!tstr.empty())
                 {
-                    auto fd_table = m_thread_table.get_subtable(
-                    tr, m_fds, thread_entry,
-                    st::SS_PLUGIN_ST_INT64);
-                    m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                    auto fd_entry = fd_table.get_entry(tr, tint64);
-                    m_fd_name_value.read_value(tr, fd_entry, tstr);
+                    tstr += " ";
                 }
-                catch(const std::exception& e)
+                if (env)
                 {
+                    tstr += env;
                 }
-                if (tstr.empty())
-                {
-                    auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                1);
-                    std::string cwd;
-                    if (res_param.param_pointer != nullptr)
-                    {
-                        int64_t dirfd = *(uint64_t*)(res_param.param_pointer);
-                        try
-                        {
-                            auto fd_table = m_thread_table.get_subtable(
-                            tr, m_fds, thread_entry,
-                            st::SS_PLUGIN_ST_INT64);
-                            auto fd_entry = fd_table.get_entry(tr, dirfd);
-                            if (dirfd == PPM_AT_FDCWD)
-                            {
-                                m_cwd.read_value(tr, thread_entry, cwd);
+                return true;
+            });
+    }
+    return true;
+}
 
-                            } else
-                            {
-                                m_fd_name_value.read_value(tr, fd_entry, cwd);
-                            }
-                        }
-                        catch(const std::exception& e)
-                        {
-                        }
-                    }
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field, cwd);
-                }
+bool anomalydetection::extract_lineage_concat(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    auto& tr = ctx.tr;
+    int64_t ptid = -1;
+    ex.value->read_value(tr, ctx.thread_entry, tstr);
+    if (read_lineage_cache(ctx, ex, true, tstr))
+    {
+        return true;
+    }
+    m_ptid.read_value(tr, ctx.thread_entry, ptid);
+    std::string tstr2;
+    for(uint32_t j = 0; j < ex.depth; j++)
+    {
+        try
+        {
+            auto lineage = m_thread_table.get_entry(tr, ptid);
+            ex.value->read_value(tr, lineage, tstr2);
+            tstr += tstr2;
+            tstr2.clear();
+            if(j == (ex.depth - 1))
+            {
                 break;
             }
-            default:
-                // Clear the entire profile when invoking the fd related profile for non fd syscalls
-                behavior_profile_concat_str.clear();
+            if(ptid == 1)
+            {
                 break;
             }
+            m_ptid.read_value(tr, lineage, ptid);
+        }
+        catch(const std::exception& e)
+        {
             break;
         }
-        case plugin_sinsp_filterchecks::TYPE_DIRECTORY:
-        case plugin_sinsp_filterchecks::TYPE_FILENAME:
+    }
+    return true;
+}
+
+bool anomalydetection::extract_fdnum(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    switch(ctx.evt.get_type())
+    {
+    case PPME_SYSCALL_OPEN_X:
+    case PPME_SOCKET_ACCEPT_5_X:
+    case PPME_SOCKET_ACCEPT4_6_X:
+    case PPME_SYSCALL_CREAT_X:
+    case PPME_SOCKET_CONNECT_X:
+    case PPME_SYSCALL_OPENAT_2_X:
+    case PPME_SYSCALL_OPENAT2_X:
+    case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
+    {
+        int64_t fd = -1;
+        m_lastevent_fd_field.read_value(ctx.tr, ctx.thread_entry, fd);
+        tstr = std::to_string(fd);
+        return true;
+    }
+    default:
+        // Clear the entire profile when invoking the fd related profile for non fd syscalls
+        return false;
+    }
+}
+
+std::string_view anomalydetection::resolve_fd_path(profile_extraction_ctx& ctx)
+{
+    // fd name of the last event fd, falls back to the event params resolved against the cwd or dirfd.
+    // Resolved at most once per event, into buffers reused across events
+    auto& cached = m_fd_path;
+    if (cached.evtnum == ctx.evt.get_num())
+    {
+        return cached.path;
+    }
+    cached.evtnum = UINT64_MAX; // Only set once resolved, a failed table read is retried
+    cached.path.clear();
+    auto fd_entry = get_lastevent_fd_entry(ctx);
+    if (fd_entry != nullptr)
+    {
+        try
         {
-            switch(evt.get_type())
-            {
-            case PPME_SYSCALL_OPEN_X:
-            case PPME_SYSCALL_CREAT_X:
-            {
-                try
-                {
-                    auto fd_table = m_thread_table.get_subtable(
-                    tr, m_fds, thread_entry,
-                    st::SS_PLUGIN_ST_INT64);
-                    m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                    auto fd_entry = fd_table.get_entry(tr, tint64);
-                    m_fd_name_value.read_value(tr, fd_entry, tstr);
-                }
-                catch(const std::exception& e)
-                {
-                }
-                if (tstr.empty())
-                {
-                    std::string cwd;
-                    m_cwd.read_value(tr, thread_entry, cwd);
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field, cwd);
-                }
-                size_t pos = tstr.find_last_of('/');
-                if (pos != std::string::npos)
-                {
-                    if (field.id == plugin_sinsp_filterchecks::TYPE_DIRECTORY)
-                    {
-                        tstr = tstr.substr(0, pos);
-                    } else
-                    {
+            m_fd_name_value.read_value(ctx.tr, *fd_entry, cached.path);
+        }
+        catch(const std::exception& e)
+        {
+        }
+    }
+    if (!cached.path.empty())
+    {
+        cached.evtnum = ctx.evt.get_num();
+        return cached.path;
+    }
+    const auto& params = get_evt_params(ctx.evt);
+    sinsp_param name_param = {0, nullptr};
+    std::string_view base;
+    switch(ctx.evt.get_type())
+    {
+    case PPME_SYSCALL_OPEN_X:
+    case PPME_SYSCALL_CREAT_X:
+    {
+        name_param = params.get(1);
+        cached.cwd.clear();
+        m_cwd.read_value(ctx.tr, ctx.thread_entry, cached.cwd);
+        base = cached.cwd;
+        break;
+    }
+    case PPME_SYSCALL_OPENAT_2_X:
+    case PPME_SYSCALL_OPENAT2_X:
+    {
+        name_param = params.get(2);
+        auto dirfd_param = params.get(1);
+        if (dirfd_param.param_pointer != nullptr)
+        {
+            base = get_dirfd_path(ctx, *(int64_t*)(dirfd_param.param_pointer));
+        }
+        break;
+    }
+    case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
+        name_param = params.get(3);
+        break;
+    default:
+        // todo fix/expose via plugin API fallbacks as we lack access to sockinfo and it's highly more sophisticated / complex
+        break;
+    }
+    if (name_param.param_pointer != nullptr)
+    {
+        // concatenate_paths takes care of resolving the path, absolute paths ignore the base
+        plugin_anomalydetection::utils::concatenate_paths(base, (const char*)(name_param.param_pointer), cached.path);
+    }
+    cached.evtnum = ctx.evt.get_num();
+    return cached.path;
+}
 
-                        tstr = tstr.substr(pos + 1);
-                    }
-                }
-                break;
-            }
-            case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
-            {
-                try
-                {
-                    auto fd_table = m_thread_table.get_subtable(
-                    tr, m_fds, thread_entry,
-                    st::SS_PLUGIN_ST_INT64);
-                    m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                    auto fd_entry = fd_table.get_entry(tr, tint64);
-                    m_fd_name_value.read_value(tr, fd_entry, tstr);
-                }
-                catch(const std::exception& e)
-                {
-                }
-                if (tstr.empty())
-                {
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field);
-                }
-                size_t pos = tstr.find_last_of('/');
-                if (pos != std::string::npos)
-                {
-                    if (field.id == plugin_sinsp_filterchecks::TYPE_DIRECTORY)
-                    {
-                        tstr = tstr.substr(0, pos);
-                    } else
-                    {
+dirfd_cache_entry& anomalydetection::get_dirfd_cache_slot(int64_t pid, int64_t fd)
+{
+    return m_dirfd_cache[XXH3_64bits_withSeed(&fd, sizeof(fd), (uint64_t)pid) & (DIRFD_CACHE_SIZE - 1)];
+}
 
-                        tstr = tstr.substr(pos + 1);
-                    }
-                }
-                break;
-            }
-            case PPME_SYSCALL_OPENAT_2_X:
-            case PPME_SYSCALL_OPENAT2_X:
-            {
-                try
-                {
-                    auto fd_table = m_thread_table.get_subtable(
-                    tr, m_fds, thread_entry,
-                    st::SS_PLUGIN_ST_INT64);
-                    m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                    auto fd_entry = fd_table.get_entry(tr, tint64);
-                    m_fd_name_value.read_value(tr, fd_entry, tstr);
-                }
-                catch(const std::exception& e)
-                {
-                }
-                if (tstr.empty())
-                {
-                    auto res_param = get_syscall_evt_param(evt.get_buf(),
-                                                1);
-                    std::string cwd;
-                    if (res_param.param_pointer != nullptr)
-                    {
-                        int64_t dirfd = *(uint64_t*)(res_param.param_pointer);
-                        try
-                        {
-                            auto fd_table = m_thread_table.get_subtable(
-                            tr, m_fds, thread_entry,
-                            st::SS_PLUGIN_ST_INT64);
-                            auto fd_entry = fd_table.get_entry(tr, dirfd);
-                            if (dirfd == PPM_AT_FDCWD)
-                            {
-                                m_cwd.read_value(tr, thread_entry, cwd);
+std::string_view anomalydetection::get_dirfd_path(profile_extraction_ctx& ctx, int64_t dirfd)
+{
+    // Hot dirfds (e.g. of directory walks) skip the fd table lookup, misses are only cached once resolved
+    if (dirfd == PPM_AT_FDCWD)
+    {
+        m_fd_path.cwd.clear();
+        try
+        {
+            m_cwd.read_value(ctx.tr, ctx.thread_entry, m_fd_path.cwd);
+        }
+        catch(const std::exception& e)
+        {
+        }
+        return m_fd_path.cwd;
+    }
+    int64_t pid = -1;
+    m_pid.read_value(ctx.tr, ctx.thread_entry, pid);
+    auto& slot = get_dirfd_cache_slot(pid, dirfd);
+    if (slot.pid == pid && slot.fd == dirfd)
+    {
+        return slot.path;
+    }
+    slot.pid = -1;
+    slot.fd = -1;
+    slot.path.clear();
+    try
+    {
+        using st = falcosecurity::state_value_type;
+        auto fd_table = m_thread_table.get_subtable(
+        ctx.tr, m_fds, ctx.thread_entry,
+        st::SS_PLUGIN_ST_INT64);
+        auto dirfd_entry = fd_table.get_entry(ctx.tr, dirfd);
+        m_fd_name_value.read_value(ctx.tr, dirfd_entry, slot.path);
+    }
+    catch(const std::exception& e)
+    {
+    }
+    if (!slot.path.empty())
+    {
+        slot.pid = pid;
+        slot.fd = dirfd;
+        m_dirfd_cache_fills++;
+    }
+    return slot.path;
+}
 
-                            } else
-                            {
-                                m_fd_name_value.read_value(tr, fd_entry, cwd);
-                            }
-                        }
-                        catch(const std::exception& e)
-                        {
-                        }
-                    }
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field, cwd);
-                }
-                size_t pos = tstr.find_last_of('/');
-                if (pos != std::string::npos)
-                {
-                    if (field.id == plugin_sinsp_filterchecks::TYPE_DIRECTORY)
-                    {
-                        tstr = tstr.substr(0, pos);
-                    } else
-                    {
+void anomalydetection::invalidate_dirfd_cache(const falcosecurity::table_reader& tr, const falcosecurity::table_entry& thread_entry, int64_t fd)
+{
+    // Drop the cached path of `fd` once it is closed or replaced, or all paths of the process if `fd` is -1 (exec, exit).
+    // Processes sharing their fd table (clone with CLONE_FILES) without sharing the pid are not tracked
+    if (m_dirfd_cache_fills == 0 || (fd < 0 && fd != -1))
+    {
+        return;
+    }
+    int64_t pid = -1;
+    m_pid.read_value(tr, thread_entry, pid);
+    if (fd >= 0)
+    {
+        auto& slot = get_dirfd_cache_slot(pid, fd);
+        if (slot.pid == pid && slot.fd == fd)
+        {
+            slot.pid = -1;
+            slot.fd = -1;
+        }
+        return;
+    }
+    for (auto& slot : m_dirfd_cache)
+    {
+        if (slot.pid == pid)
+        {
+            slot.pid = -1;
+            slot.fd = -1;
+        }
+    }
+}
+
+bool anomalydetection::extract_fdname(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    switch(ctx.evt.get_type())
+    {
+    case PPME_SOCKET_ACCEPT_5_X:
+    case PPME_SOCKET_ACCEPT4_6_X:
+    case PPME_SOCKET_CONNECT_X:
+    case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
+    case PPME_SYSCALL_OPEN_X:
+    case PPME_SYSCALL_CREAT_X:
+    case PPME_SYSCALL_OPENAT_2_X:
+    case PPME_SYSCALL_OPENAT2_X:
+        tstr.assign(resolve_fd_path(ctx));
+        return true;
+    default:
+        // Clear the entire profile when invoking the fd related profile for non fd syscalls
+        return false;
+    }
+}
+
+bool anomalydetection::extract_fd_dir_filename(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    switch(ctx.evt.get_type())
+    {
+    case PPME_SYSCALL_OPEN_X:
+    case PPME_SYSCALL_CREAT_X:
+    case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
+    case PPME_SYSCALL_OPENAT_2_X:
+    case PPME_SYSCALL_OPENAT2_X:
+    {
+        resolve_fd_path(ctx);
+        tstr.assign(ex.field.id == plugin_sinsp_filterchecks::TYPE_DIRECTORY ? m_fd_path.directory() : m_fd_path.filename());
+        return true;
+    }
+    case PPME_SOCKET_ACCEPT_5_X:
+    case PPME_SOCKET_ACCEPT4_6_X:
+    case PPME_SOCKET_CONNECT_X:
+        return true;
+    default:
+        // Clear the entire profile when invoking the fd related profile for non fd syscalls
+        return false;
+    }
+}
 
-                        tstr = tstr.substr(pos + 1);
-                    }
-                }
-                break;
-            }
-            case PPME_SOCKET_ACCEPT_5_X:
-            case PPME_SOCKET_ACCEPT4_6_X:
-            case PPME_SOCKET_CONNECT_X:
-            {
-                break;
-            }
-            default:
-                // Clear the entire profile when invoking the fd related profile for non fd syscalls
-                behavior_profile_concat_str.clear();
-                break;
-            }
-            break;
-        }
-        case plugin_sinsp_filterchecks::TYPE_INO:
+template<typename T>
+bool anomalydetection::extract_fd_value(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    switch(ctx.evt.get_type())
+    {
+    case PPME_SYSCALL_OPEN_X:
+    case PPME_SYSCALL_CREAT_X:
+    case PPME_SYSCALL_OPENAT_2_X:
+    case PPME_SYSCALL_OPENAT2_X:
+    case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
+    {
+        auto fd_entry = get_lastevent_fd_entry(ctx);
+        if (fd_entry != nullptr)
         {
-            switch(evt.get_type())
-            {
-            case PPME_SYSCALL_OPEN_X:
-            case PPME_SYSCALL_CREAT_X:
-            case PPME_SYSCALL_OPENAT_2_X:
-            case PPME_SYSCALL_OPENAT2_X:
-            case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
+            try
             {
-                try
-                {
-                    auto fd_table = m_thread_table.get_subtable(
-                    tr, m_fds, thread_entry,
-                    st::SS_PLUGIN_ST_INT64);
-                    m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                    auto fd_entry = fd_table.get_entry(tr, tint64);
-                    m_fd_ino_value.read_value(tr, fd_entry, tint64);
-                    tstr = std::to_string(tint64);
-                }
-                catch(const std::exception& e)
+                if constexpr (std::is_same_v<T, std::string>)
                 {
-                }
-                if (tstr.empty())
+                    ex.value->read_value(ctx.tr, *fd_entry, tstr);
+                } else
                 {
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field);
+                    T value{};
+                    ex.value->read_value(ctx.tr, *fd_entry, value);
+                    tstr = std::to_string(value);
                 }
-                break;
             }
-            case PPME_SOCKET_ACCEPT_5_X:
-            case PPME_SOCKET_ACCEPT4_6_X:
-            case PPME_SOCKET_CONNECT_X:
+            catch(const std::exception& e)
             {
-                break;
-            }
-            default:
-                // Clear the entire profile when invoking the fd related profile for non fd syscalls
-                behavior_profile_concat_str.clear();
-                break;
             }
-            break;
         }
-        case plugin_sinsp_filterchecks::TYPE_DEV:
+        if (tstr.empty())
         {
-            switch(evt.get_type())
-            {
-            case PPME_SYSCALL_OPEN_X:
-            case PPME_SYSCALL_CREAT_X:
-            case PPME_SYSCALL_OPENAT_2_X:
-            case PPME_SYSCALL_OPENAT2_X:
-            case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
-            {
-                try
-                {
-                    auto fd_table = m_thread_table.get_subtable(
-                    tr, m_fds, thread_entry,
-                    st::SS_PLUGIN_ST_INT64);
-                    m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                    auto fd_entry = fd_table.get_entry(tr, tint64);
-                    m_fd_dev_value.read_value(tr, fd_entry, tuint32);
-                    tstr = std::to_string(tuint32);
-                }
-                catch(const std::exception& e)
-                {
-                }
-                if (tstr.empty())
-                {
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field);
-                }
-                break;
-            }
-            case PPME_SOCKET_ACCEPT_5_X:
-            case PPME_SOCKET_ACCEPT4_6_X:
-            case PPME_SOCKET_CONNECT_X:
-            {
-                break;
-            }
-            default:
-                // Clear the entire profile when invoking the fd related profile for non fd syscalls
-                behavior_profile_concat_str.clear();
-                break;
-            }
-            break;
+            tstr = extract_filterchecks_evt_params_fallbacks(ctx.evt, ex.field);
         }
-        case plugin_sinsp_filterchecks::TYPE_FDNAMERAW:
+        return true;
+    }
+    case PPME_SOCKET_ACCEPT_5_X:
+    case PPME_SOCKET_ACCEPT4_6_X:
+    case PPME_SOCKET_CONNECT_X:
+        return true;
+    default:
+        // Clear the entire profile when invoking the fd related profile for non fd syscalls
+        return false;
+    }
+}
+
+bool anomalydetection::extract_fdname_part(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr)
+{
+    switch(ctx.evt.get_type())
+    {
+    case PPME_SYSCALL_OPEN_X:
+    case PPME_SYSCALL_CREAT_X:
+    case PPME_SYSCALL_OPENAT_2_X:
+    case PPME_SYSCALL_OPENAT2_X:
+    case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
+        return true;
+    case PPME_SOCKET_ACCEPT_5_X:
+    case PPME_SOCKET_ACCEPT4_6_X:
+    case PPME_SOCKET_CONNECT_X:
+    {
+        auto path = resolve_fd_path(ctx);
+        const std::string_view delimiter = "->";
+        size_t pos = path.find(delimiter);
+        if (pos == std::string_view::npos)
         {
-            switch(evt.get_type())
-            {
-            case PPME_SYSCALL_OPEN_X:
-            case PPME_SYSCALL_CREAT_X:
-            case PPME_SYSCALL_OPENAT_2_X:
-            case PPME_SYSCALL_OPENAT2_X:
-            case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
-            {
-                try
-                {
-                    auto fd_table = m_thread_table.get_subtable(
-                    tr, m_fds, thread_entry,
-                    st::SS_PLUGIN_ST_INT64);
-                    m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                    auto fd_entry = fd_table.get_entry(tr, tint64);
-                    m_fd_nameraw_value.read_value(tr, fd_entry, tstr);
-                }
-                catch(const std::exception& e)
-                {
-                }
-                if (tstr.empty())
-                {
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field);
-                }
-                break;
-            }
-            case PPME_SOCKET_ACCEPT_5_X:
-            case PPME_SOCKET_ACCEPT4_6_X:
-            case PPME_SOCKET_CONNECT_X:
-            {
-                break;
-            }
-            default:
-                // Clear the entire profile when invoking the fd related profile for non fd syscalls
-                behavior_profile_concat_str.clear();
-                break;
-            }
-            break;
+            tstr.clear();
+        } else if (ex.field.id == plugin_sinsp_filterchecks::TYPE_CUSTOM_FDNAME_PART1)
+        {
+            tstr.assign(path.substr(0, pos));
+        } else
+        {
+            tstr.assign(path.substr(pos + delimiter.length()));
         }
+        return true;
+    }
+    default:
+        // Clear the entire profile when invoking the fd related profile for non fd syscalls
+        return false;
+    }
+}
 
-        //
-        // Custom behavior profile short-cut fields
-        //
-
-        case plugin_sinsp_filterchecks::TYPE_CUSTOM_ANAME_LINEAGE_CONCAT:
+template<typename OnValue, typename OnClear>
+void anomalydetection::for_each_profile_field(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, const std::vector<profile_extractor>& extractors, OnValue&& on_value, OnClear&& on_clear)
+{
+    int64_t thread_id = evt.get_tid();
+    std::optional<falcosecurity::table_entry> thread_entry_opt;
+    try
+    {
+        thread_entry_opt = m_thread_table.get_entry(tr, thread_id);
+    } catch (const std::exception& e)
+    {
+        for (const auto& ex : extractors)
         {
-            if(field.argid < 1)
-            {
-                break;
-            }
-            m_comm.read_value(tr, thread_entry, tstr);
-            m_ptid.read_value(tr, thread_entry, ptid);
-            std::string tstr2;
-            for(uint32_t j = 0; j < field.argid; j++)
-            {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    m_comm.read_value(tr, lineage, tstr2);
-                    tstr += tstr2;
-                    tstr2.clear();
-                    if(j == (field.argid - 1))
-                    {
-                        break;
-                    }
-                    if(ptid == 1)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                }
-                catch(const std::exception& e)
-                {
-                }
-            }
-            break;
+            on_value(extract_filterchecks_evt_params_fallbacks(evt, ex.field));
         }
-        case plugin_sinsp_filterchecks::TYPE_CUSTOM_AEXE_LINEAGE_CONCAT:
+        return;
+    }
+
+    // No concept of null fields (instead its always an empty string) compared to libsinsp
+    // Fields shared with previously extracted behavior profiles of the same event are read from the cache
+    profile_extraction_ctx ctx{evt, tr, thread_entry_opt.value()};
+    uint64_t evtnum = evt.get_num();
+    for (const auto& ex : extractors)
+    {
+        auto& cached = m_field_cache[ex.slot];
+        if (cached.evtnum != evtnum)
         {
-            if(field.argid < 1)
-            {
-                break;
-            }
-            m_exe.read_value(tr, thread_entry, tstr);
-            m_ptid.read_value(tr, thread_entry, ptid);
-            std::string tstr2;
-            for(uint32_t j = 0; j < field.argid; j++)
-            {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    m_exe.read_value(tr, lineage, tstr2);
-                    tstr += tstr2;
-                    tstr2.clear();
-                    if(j == (field.argid - 1))
-                    {
-                        break;
-                    }
-                    if(ptid == 1)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                }
-                catch(const std::exception& e)
-                {
-                }
-            }
-            break;
+            cached.value.clear();
+            cached.applies = (this->*ex.fn)(ctx, ex, cached.value);
+            cached.evtnum = evtnum;
         }
-        case plugin_sinsp_filterchecks::TYPE_CUSTOM_AEXEPATH_LINEAGE_CONCAT:
+        if (!cached.applies)
         {
-            if(field.argid < 1)
-            {
-                break;
-            }
-            m_exepath.read_value(tr, thread_entry, tstr);
-            m_ptid.read_value(tr, thread_entry, ptid);
-            std::string tstr2;
-            for(uint32_t j = 0; j < field.argid; j++)
-            {
-                try
-                {
-                    auto lineage = m_thread_table.get_entry(tr, ptid);
-                    m_exepath.read_value(tr, lineage, tstr2);
-                    tstr += tstr2;
-                    tstr2.clear();
-                    if(j == (field.argid - 1))
-                    {
-                        break;
-                    }
-                    if(ptid == 1)
-                    {
-                        break;
-                    }
-                    m_ptid.read_value(tr, lineage, ptid);
-                }
-                catch(const std::exception& e)
-                {
-                }
-            }
-            break;
+            on_clear();
+            continue;
         }
-        case plugin_sinsp_filterchecks::TYPE_CUSTOM_FDNAME_PART1:
-        case plugin_sinsp_filterchecks::TYPE_CUSTOM_FDNAME_PART2:
-        {
-            switch(evt.get_type())
-            {
-            case PPME_SYSCALL_OPEN_X:
-            case PPME_SYSCALL_CREAT_X:
-            case PPME_SYSCALL_OPENAT_2_X:
-            case PPME_SYSCALL_OPENAT2_X:
-            case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
-            {
-                break;
-            }
-            case PPME_SOCKET_ACCEPT_5_X:
-            case PPME_SOCKET_ACCEPT4_6_X:
-            case PPME_SOCKET_CONNECT_X:
-            {
-                try
-                {
-                    auto fd_table = m_thread_table.get_subtable(
-                    tr, m_fds, thread_entry,
-                    st::SS_PLUGIN_ST_INT64);
-                    m_lastevent_fd_field.read_value(tr, thread_entry, tint64);
-                    auto fd_entry = fd_table.get_entry(tr, tint64);
-                    m_fd_name_value.read_value(tr, fd_entry, tstr);
-                }
-                catch(const std::exception& e)
-                {
-                }
-                if (tstr.empty())
-                {
-                    tstr = extract_filterchecks_evt_params_fallbacks(evt, field);
-                }
-                std::string delimiter = "->";
-                size_t pos = tstr.find(delimiter);
-                if (pos != std::string::npos) 
-                {
-                    if (field.id == plugin_sinsp_filterchecks::TYPE_CUSTOM_FDNAME_PART1)
-                    {
-                        tstr = tstr.substr(0, pos);
+        on_value(cached.value);
+    }
+}
 
-                    } else
-                    {
-                        tstr = tstr.substr(pos + delimiter.length());
-                    }
-                } else
-                {
-                    tstr.clear();
-                }
-                break;
-            }
-            default:
-                // Clear the entire profile when invoking the fd related profile for non fd syscalls
-                behavior_profile_concat_str.clear();
-                break;
-            }
-            break;
-        }
+bool anomalydetection::extract_filterchecks_concat_profile(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, const std::vector<profile_extractor>& extractors, std::string& behavior_profile_concat_str)
+{
+    // Create a concatenated string formed out of each field per behavior profile
+    for_each_profile_field(evt, tr, extractors,
+        [&behavior_profile_concat_str](const std::string& value) { behavior_profile_concat_str += value; },
+        [&behavior_profile_concat_str]() { behavior_profile_concat_str.clear(); });
+    return true;
+}
 
-        default:
-            break;
-        }
-        behavior_profile_concat_str += tstr;
+uint64_t anomalydetection::hash_filterchecks_profile(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, const std::vector<profile_extractor>& extractors, XXH128_hash_t& hash)
+{
+    plugin::anomalydetection::num::profile_hasher hasher;
+    for_each_profile_field(evt, tr, extractors,
+        [&hasher](const std::string& value) { hasher.update(value); },
+        [&hasher]() { hasher.reset(); });
+    hash = hasher.digest();
+    return hasher.get_length();
+}
+
+const std::string& anomalydetection::get_profile_concat_str(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, uint32_t index)
+{
+    // Only built when `anomaly.count_min_sketch.profile` is requested, the field values are reused from the parsing of the same event
+    auto& cached = m_profile_cache[index];
+    if (cached.str_evtnum != evt.get_num())
+    {
+        cached.value.clear();
+        extract_filterchecks_concat_profile(evt, tr, m_behavior_profiles_extractors[index], cached.value);
+        cached.str_evtnum = evt.get_num();
     }
-    return true;
+    return cached.value;
+}
+
+const profile_cache_entry& anomalydetection::get_profile_hash(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, uint32_t index)
+{
+    // Parsing runs before extraction, `extract` hence reuses the hash computed while parsing the same event
+    auto& cached = m_profile_cache[index];
+    if (cached.evtnum != evt.get_num())
+    {
+        cached.length = hash_filterchecks_profile(evt, tr, m_behavior_profiles_extractors[index], cached.hash);
+        cached.evtnum = evt.get_num();
+    }
+    return cached;
+}
+
+uint64_t anomalydetection::get_partition_key(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, uint32_t index)
+{
+    auto& cached = m_profile_cache[index];
+    if (cached.partition_evtnum != evt.get_num())
+    {
+        XXH128_hash_t hash;
+        hash_filterchecks_profile(evt, tr, m_partition_extractors[index], hash);
+        cached.partition_key = hash.low64;
+        cached.partition_evtnum = evt.get_num();
+    }
+    return cached.partition_key;
 }
 
 bool anomalydetection::parse_event(const falcosecurity::parse_event_input& in)
@@ -2107,6 +2828,7 @@ bool anomalydetection::parse_event(const falcosecurity::parse_event_input& in)
     {
         return true;
     }
+    sampled_latency latency(m_parse_latency, m_parsed_events);
 
     auto& evt = in.get_event_reader();
     auto& tr = in.get_table_reader();
@@ -2128,8 +2850,7 @@ bool anomalydetection::parse_event(const falcosecurity::parse_event_input& in)
     case PPME_SYSCALL_OPENAT2_X:
     case PPME_SYSCALL_OPEN_BY_HANDLE_AT_X:
     {
-        auto res_param = get_syscall_evt_param(in.get_event_reader().get_buf(),
-                                           0);
+        auto res_param = get_evt_params(evt).get(0);
         if (res_param.param_pointer == nullptr)
         {
             return false;
@@ -2138,12 +2859,13 @@ bool anomalydetection::parse_event(const falcosecurity::parse_event_input& in)
         int64_t fd = *(int64_t*)(res_param.param_pointer);
         auto thread_entry = m_thread_table.get_entry(tr, thread_id);
         m_lastevent_fd_field.write_value(tw, thread_entry, fd);
+        // The new fd may reuse the number of a cached dirfd whose close was not seen
+        invalidate_dirfd_cache(tr, thread_entry, fd);
         break;
     }
     case PPME_SOCKET_CONNECT_X: // fd param 2
     {
-        auto res_param = get_syscall_evt_param(in.get_event_reader().get_buf(),
-                                           2);
+        auto res_param = get_evt_params(evt).get(2);
         if (res_param.param_pointer == nullptr)
         {
             return false;
@@ -2153,35 +2875,120 @@ bool anomalydetection::parse_event(const falcosecurity::parse_event_input& in)
         m_lastevent_fd_field.write_value(tw, thread_entry, fd);
         break;
     }
-    default:
+    case PPME_SYSCALL_CLONE_20_X:
+    case PPME_SYSCALL_CLONE3_X:
+    case PPME_SYSCALL_FORK_20_X:
+    case PPME_SYSCALL_VFORK_20_X:
+    case PPME_SYSCALL_EXECVE_19_X:
+    case PPME_SYSCALL_EXECVEAT_X:
+    {
+        // New or re-executed thread, refresh its lineage cache
+        try
+        {
+            if (m_lineage_depth > 0)
+            {
+                update_lineage_cache(tr, tw, thread_id);
+            }
+            auto evt_type = evt.get_type();
+            if (evt_type == PPME_SYSCALL_EXECVE_19_X || evt_type == PPME_SYSCALL_EXECVEAT_X)
+            {
+                // Close-on-exec dirfds are gone after a successful exec
+                auto res_param = get_evt_params(evt).get(0);
+                if (res_param.param_pointer != nullptr && *(int64_t*)(res_param.param_pointer) == 0)
+                {
+                    invalidate_dirfd_cache(tr, m_thread_table.get_entry(tr, thread_id), -1);
+                }
+            }
+        }
+        catch(const std::exception& e)
+        {
+        }
         break;
     }
-
-    // Loop over behavior profiles, extract profile fields and update the count_min_sketch counts.
-    int i = 0;
-    std::string behavior_profile_concat_str;
-    for(const auto& set : m_behavior_profiles_event_codes)
+    case PPME_SYSCALL_CLOSE_E: // fd param 0
+    case PPME_SYSCALL_CLOSE_X: // fd param 1, if sent on exit by the driver
+    case PPME_SYSCALL_DUP_1_X: // new fd param 0
+    case PPME_SYSCALL_DUP2_X:
+    case PPME_SYSCALL_DUP3_X:
+    case PPME_PROCEXIT_1_E:
     {
-        if(set.find((ppm_event_code)evt.get_type()) != set.end())
+        auto evt_type = evt.get_type();
+        auto fd_param = get_evt_params(evt).get(evt_type == PPME_SYSCALL_CLOSE_X ? 1 : 0);
+        try
         {
-            if(thread_id <= 0)
+            if (evt_type == PPME_PROCEXIT_1_E)
             {
-                return false;
+                invalidate_dirfd_cache(tr, m_thread_table.get_entry(tr, thread_id), -1);
+            } else if (fd_param.param_pointer != nullptr)
+            {
+                invalidate_dirfd_cache(tr, m_thread_table.get_entry(tr, thread_id), *(int64_t*)(fd_param.param_pointer));
             }
-            try
+        }
+        catch(const std::exception& e)
+        {
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    // Loop over the behavior profiles applied to this event code, extract profile fields and update the count_min_sketch counts.
+    uint16_t evt_type = evt.get_type();
+    if (evt_type >= m_event_code_profiles.size())
+    {
+        return true;
+    }
+    for(uint32_t i : m_event_code_profiles[evt_type])
+    {
+        if(thread_id <= 0)
+        {
+            return false;
+        }
+        try
+        {
+            if (i < m_n_sketches)
             {
-                behavior_profile_concat_str.clear();
-                if (i < m_n_sketches && extract_filterchecks_concat_profile(evt, tr, m_behavior_profiles_fields[i], behavior_profile_concat_str) && !behavior_profile_concat_str.empty())
+                const auto& profile = get_profile_hash(evt, tr, i);
+                auto& metrics = m_profile_metrics[i];
+                if (profile.length == 0)
+                {
+                    metrics_add(metrics.empty_profiles, 1);
+                } else
                 {
-                    m_count_min_sketches.lock()->at(i).get()->update(behavior_profile_concat_str, (uint64_t)1);
+                    metrics_add(metrics.updates, 1);
+                    metrics_add(metrics.profile_length_sum, profile.length);
+                    if (m_count_min_sketches[i]->get_topk() != nullptr)
+                    {
+                        track_topk(evt, tr, i, profile.hash);
+                    }
+                    if (m_hlls[i])
+                    {
+                        m_hlls[i]->update(profile.hash);
+                    }
+                    if (m_partitioned_sketches[i])
+                    {
+                        // LRU and TTL in event time, no clock read per event
+                        m_partitioned_sketches[i]->update(get_partition_key(evt, tr, i), profile.hash, (uint64_t)1, evt.get_ts());
+                    }
+                    // Staged and applied in batches, see `flush_staged_updates`
+                    auto& staged = m_staged_updates[i];
+                    staged.push(profile.hash);
+                    if (staged.size() >= m_update_batch_size)
+                    {
+                        flush_staged_updates(i);
+                    }
                 }
             }
-            catch(falcosecurity::plugin_exception e)
+        }
+        catch(falcosecurity::plugin_exception e)
+        {
+            if (i < m_profile_metrics.size())
             {
-                return false;
+                metrics_add(m_profile_metrics[i].extraction_failures, 1);
             }
+            return false;
         }
-        i++;
     }
     return true;
 }
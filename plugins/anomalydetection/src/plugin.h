@@ -18,10 +18,17 @@ limitations under the License.
 #pragma once
 
 #include "num/cms.h"
+#include "num/cms_window.h"
+#include "num/sketch.h"
+#include "num/hll.h"
+#include "num/partitioned_sketch.h"
+#include "num/sharded_sketch.h"
+#include "num/staged_batch.h"
+#include "num/profile_hasher.h"
 #include "plugin_consts.h"
 #include "plugin_utils.h"
-#include "plugin_mutex.h"
 #include "plugin_thread_manager.h"
+#include "plugin_metrics.h"
 #include "plugin_sinsp_filterchecks.h"
 
 #include <falcosecurity/sdk.h>
@@ -33,17 +40,116 @@ limitations under the License.
 #include <unordered_map>
 #include <unordered_set>
 #include <sstream>
+#include <optional>
 
 #define UINT32_MAX (4294967295U)
 #define PPM_AT_FDCWD -100
 #define SECOND_TO_NS 1000000000ULL
+#define LINEAGE_SEPARATOR '\x1f'
+#define LINEAGE_CACHE_MAX_DEPTH 32
+#define DIRFD_CACHE_SIZE 512 // Power of two
 
 struct sinsp_param
 {
-    uint16_t param_len;
+    uint32_t param_len;
     uint8_t* param_pointer;
 };
 
+// Param offsets of the event with number `evtnum`, built once per event by `get_evt_params`
+struct evt_param_index
+{
+    uint64_t evtnum = UINT64_MAX;
+    uint32_t nparams = 0;
+    uint32_t param_len[PPM_MAX_EVENT_PARAMS];
+    uint8_t* param_pointer[PPM_MAX_EVENT_PARAMS];
+
+    // Returns a null param pointer for params the event does not have
+    sinsp_param get(uint32_t num_param) const
+    {
+        if (num_param >= nparams)
+        {
+            return {0, nullptr};
+        }
+        return {param_len[num_param], param_pointer[num_param]};
+    }
+};
+
+class anomalydetection;
+
+// Per event state shared by the extractors of a behavior profile
+struct profile_extraction_ctx
+{
+    const falcosecurity::event_reader& evt;
+    const falcosecurity::table_reader& tr;
+    falcosecurity::table_entry& thread_entry;
+    std::optional<falcosecurity::table_entry> fd_entry; // Resolved from the last event fd on first use
+    bool fd_resolved = false;
+};
+
+// A behavior profile field compiled at config time, table field accessors and lineage depth are bound up front
+struct profile_extractor
+{
+    // Writes the field value to `tstr`, returns false if the field does not apply to the event which clears the profile
+    using extract_fn = bool (anomalydetection::*)(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+
+    extract_fn fn = nullptr;
+    falcosecurity::table_field* value = nullptr; // Thread or fd table field holding the value
+    falcosecurity::table_field* group = nullptr; // Session or process group id table field of leader lookups
+    falcosecurity::table_field* lineage = nullptr; // Plugin owned lineage cache of `value`, see `update_lineage_cache`
+    uint32_t depth = 0; // Number of ancestors to walk, 0 for the thread itself
+    uint32_t slot = 0; // Per event field value cache slot, shared by identical fields across behavior profiles
+    plugin_sinsp_filterchecks_field field;
+};
+
+// Value extracted for the event with number `evtnum`, reused by all behavior profiles and by `extract` within that event
+struct extraction_cache_entry
+{
+    uint64_t evtnum = UINT64_MAX;
+    bool applies = true;
+    std::string value;
+};
+
+// Streaming hash of a behavior profile for the event with number `evtnum`, the concatenated string is only built on request
+struct profile_cache_entry
+{
+    uint64_t evtnum = UINT64_MAX;
+    XXH128_hash_t hash = {0, 0};
+    uint64_t length = 0; // Total length of the field values, 0 for an empty profile
+    uint64_t str_evtnum = UINT64_MAX;
+    std::string value;
+    uint64_t partition_evtnum = UINT64_MAX;
+    uint64_t partition_key = 0; // Hash of the `partition_by` field values
+};
+
+// Path of the last event fd resolved for the event with number `evtnum`, shared by the fd name, directory and filename fields.
+// The buffers are reused across events, the directory and filename are views into `path`
+struct fd_path_cache_entry
+{
+    uint64_t evtnum = UINT64_MAX;
+    std::string path;
+    std::string cwd; // Scratch buffer of the cwd the event's relative path is resolved against
+
+    std::string_view directory() const
+    {
+        size_t pos = path.find_last_of('/');
+        return pos == std::string::npos ? std::string_view(path) : std::string_view(path).substr(0, pos);
+    }
+
+    std::string_view filename() const
+    {
+        size_t pos = path.find_last_of('/');
+        return pos == std::string::npos ? std::string_view(path) : std::string_view(path).substr(pos + 1);
+    }
+};
+
+// Path of the directory fd `fd` of process `pid`, slot of the direct mapped dirfd cache of the openat fallbacks
+struct dirfd_cache_entry
+{
+    int64_t pid = -1;
+    int64_t fd = -1;
+    std::string path;
+};
+
 class anomalydetection
 {
     public:
@@ -54,6 +160,10 @@ class anomalydetection
     {
         ANOMALYDETECTION_COUNT_MIN_SKETCH_COUNT = 0,
         ANOMALYDETECTION_COUNT_MIN_SKETCH_BEHAVIOR_PROFILE_CONCAT_STR,
+        ANOMALYDETECTION_COUNT_MIN_SKETCH_FLEET_COUNT,
+        ANOMALYDETECTION_COUNT_MIN_SKETCH_TOPK,
+        ANOMALYDETECTION_COUNT_MIN_SKETCH_RARE,
+        ANOMALYDETECTION_HLL_DISTINCT,
         ANOMALYDETECTION_FALCO_DURATION_NS,
         ANOMALYDETECTION_FIELD_MAX
     };
@@ -62,7 +172,17 @@ class anomalydetection
     // General plugin API
     //////////////////////////
 
-    virtual ~anomalydetection() = default;
+    virtual ~anomalydetection()
+    {
+        // Stop the periodic workers first, then persist the final counts
+        m_thread_manager.stop_threads();
+        flush_staged_updates();
+        for (auto& sketch : m_count_min_sketches)
+        {
+            sketch->flush();
+        }
+        save_snapshots();
+    }
 
     std::string get_name() { return PLUGIN_NAME; }
 
@@ -90,6 +210,9 @@ class anomalydetection
 
     static void log_error(std::string err_mess);
 
+    // Hot path counters and sampled latencies, the sketch occupancy is the last cached by `refresh_sketch_stats`
+    const std::vector<falcosecurity::metric>& get_metrics();
+
     //////////////////////////
     // Extract capability
     //////////////////////////
@@ -117,13 +240,17 @@ class anomalydetection
     }
 
     // required; standard plugin API
+    // Invoked after `init`, subscribes to the event codes of the behavior profiles and to the codes
+    // maintaining the plugin's own thread state only, never returns an empty list (meaning all events)
     std::vector<falcosecurity::event_type> get_parse_event_types()
     {
         std::vector<falcosecurity::event_type> event_types;
-        // Temporary workaround
-        for (int i = PPME_GENERIC_E; i <= PPM_EVENT_MAX; ++i) 
+        for (int i = PPME_GENERIC_E; i < PPM_EVENT_MAX; ++i)
         {
-            event_types.push_back(static_cast<falcosecurity::event_type>(i));
+            if (is_state_event_code((ppm_event_code)i) || (i < (int)m_event_code_profiles.size() && !m_event_code_profiles[i].empty()))
+            {
+                event_types.push_back(static_cast<falcosecurity::event_type>(i));
+            }
         }
         return event_types;
     }
@@ -132,11 +259,72 @@ class anomalydetection
     bool parse_event(const falcosecurity::parse_event_input& in);
 
     // Custom helper functions within event parsing
-    bool extract_filterchecks_concat_profile(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, const std::vector<plugin_sinsp_filterchecks_field>& fields, std::string& behavior_profile_concat_str);
+    bool extract_filterchecks_concat_profile(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, const std::vector<profile_extractor>& extractors, std::string& behavior_profile_concat_str);
+    uint64_t hash_filterchecks_profile(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, const std::vector<profile_extractor>& extractors, XXH128_hash_t& hash);
     std::string extract_filterchecks_evt_params_fallbacks(const falcosecurity::event_reader &evt, const plugin_sinsp_filterchecks_field& field, const std::string& cwd = "");
+    std::vector<profile_extractor> compile_profile_extractors(const std::vector<plugin_sinsp_filterchecks_field>& fields);
+    const std::string& get_profile_concat_str(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, uint32_t index);
+    const evt_param_index& get_evt_params(const falcosecurity::event_reader &evt);
+    const profile_cache_entry& get_profile_hash(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, uint32_t index);
+    uint64_t get_partition_key(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, uint32_t index);
     
     private:
 
+    bool extract_field(const falcosecurity::extract_fields_input& in);
+
+    // Behavior profile field extractors, see `compile_profile_extractors`
+    template<typename OnValue, typename OnClear>
+    void for_each_profile_field(const falcosecurity::event_reader &evt, const falcosecurity::table_reader &tr, const std::vector<profile_extractor>& extractors, OnValue&& on_value, OnClear&& on_clear);
+    bool is_state_event_code(ppm_event_code code) const;
+    std::string get_snapshot_path(uint32_t i) const;
+    void load_snapshots();
+    void save_snapshots();
+    void exchange_fleet_sketches();
+    void flush_staged_updates(uint32_t i);
+    uint64_t estimate_count(uint32_t i, const XXH128_hash_t& hash) const;
+    void track_topk(const falcosecurity::event_reader& evt, const falcosecurity::table_reader& tr, uint32_t i, const XXH128_hash_t& hash);
+    std::string format_topk(uint32_t i, bool rare);
+    void log_topk();
+    void refresh_sketch_stats();
+    void flush_staged_updates();
+    std::optional<falcosecurity::table_entry> get_lineage_entry(const falcosecurity::table_reader& tr, const falcosecurity::table_entry& thread_entry, uint32_t depth);
+    falcosecurity::table_field* get_lineage_cache_field(const falcosecurity::table_field* value);
+    std::string read_lineage_value(const falcosecurity::table_reader& tr, const falcosecurity::table_entry& entry, falcosecurity::table_field* value);
+    std::string build_lineage(const falcosecurity::table_reader& tr, const falcosecurity::table_entry& entry, falcosecurity::table_field* value);
+    void update_lineage_cache(const falcosecurity::table_reader& tr, const falcosecurity::table_writer& tw, int64_t thread_id);
+    bool read_lineage_cache(profile_extraction_ctx& ctx, const profile_extractor& ex, bool concat, std::string& tstr);
+    falcosecurity::table_entry* get_lastevent_fd_entry(profile_extraction_ctx& ctx);
+    void append_args(const falcosecurity::table_reader& tr, const falcosecurity::table_entry& entry, std::string& tstr);
+    std::string_view resolve_fd_path(profile_extraction_ctx& ctx);
+    std::string_view get_dirfd_path(profile_extraction_ctx& ctx, int64_t dirfd);
+    dirfd_cache_entry& get_dirfd_cache_slot(int64_t pid, int64_t fd);
+    void invalidate_dirfd_cache(const falcosecurity::table_reader& tr, const falcosecurity::table_entry& thread_entry, int64_t fd);
+    bool extract_thread_str(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_lineage_str(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    template<typename T>
+    bool extract_thread_num(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_lineage_int64(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_args(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_cmdnargs(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_cmdlenargs(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_cmdline(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_leader_str(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_is_leader(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_env(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_lineage_concat(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_fdnum(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_fdname(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_fd_dir_filename(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    template<typename T>
+    bool extract_fd_value(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+    bool extract_fdname_part(profile_extraction_ctx& ctx, const profile_extractor& ex, std::string& tstr);
+
+    // Create the sketch of behavior profile i, dims are either (rows, cols) or (gamma, eps)
+    template<typename... Dims>
+    std::shared_ptr<plugin::anomalydetection::num::sketch> make_sketch(uint32_t i, Dims... dims);
+    template<typename T, typename... Dims>
+    std::shared_ptr<plugin::anomalydetection::num::sketch> make_typed_sketch(uint32_t i, Dims... dims);
+
     // Manages plugin side threads, such as resetting the count min sketch data structures
     ThreadManager m_thread_manager;
 
@@ -152,11 +340,66 @@ class anomalydetection
     std::vector<std::vector<double>> m_gamma_eps;
     std::vector<std::vector<uint64_t>> m_rows_cols; // If set supersedes m_gamma_eps
     std::vector<std::vector<plugin_sinsp_filterchecks_field>> m_behavior_profiles_fields;
+    std::vector<std::vector<profile_extractor>> m_behavior_profiles_extractors;
+    std::unordered_map<std::string, uint32_t> m_extraction_slots; // (field id, argid, argname) -> field value cache slot
+    std::vector<extraction_cache_entry> m_field_cache; // Per event field values, indexed by slot
+    uint32_t m_lineage_depth = 0; // Max ancestor depth of the lineage fields of all behavior profiles, 0 disables the lineage cache
+    std::vector<falcosecurity::table_field*> m_lineage_values; // Thread table fields whose lineage the behavior profiles read, only these are cached
+    std::vector<profile_cache_entry> m_profile_cache; // Per event behavior profile hashes and concatenated strings, indexed by profile
+    evt_param_index m_evt_params; // Param offsets of the current event, shared by `parse_event` and the fd fallbacks
+    fd_path_cache_entry m_fd_path; // Last event fd path of the current event
+    std::vector<dirfd_cache_entry> m_dirfd_cache = std::vector<dirfd_cache_entry>(DIRFD_CACHE_SIZE); // (pid, dirfd) -> path, see `get_dirfd_path`
+    uint64_t m_dirfd_cache_fills = 0; // Invalidation is skipped until the first fill
+    bool m_dirfd_cache_enabled = false; // Set if a behavior profile resolves fd paths, subscribes to the close, dup, exec and exit events
     std::vector<std::unordered_set<ppm_event_code>> m_behavior_profiles_event_codes;
+    std::vector<std::vector<uint32_t>> m_event_code_profiles; // Dense dispatch table, event code -> indices of the behavior profiles applied to it
     std::vector<uint64_t> m_reset_timers;
+    std::vector<uint32_t> m_window_slices; // Sliding window sketch slices per behavior profile, 0 for a plain count min sketch
+    std::vector<uint32_t> m_topk; // Heavy hitters tracked per behavior profile, 0 if disabled
+    std::vector<uint32_t> m_rare_items; // First seen items tracked per behavior profile, 0 if disabled
+    std::vector<uint32_t> m_hll_precisions; // HyperLogLog precision per behavior profile, 0 if disabled
+    std::vector<uint64_t> m_novelty_filter_capacities; // Expected distinct behavior profiles of each novelty filter, 0 if disabled
+    std::vector<std::vector<profile_extractor>> m_partition_extractors; // `partition_by` fields per behavior profile, empty if not partitioned
+    std::vector<std::vector<uint64_t>> m_partition_rows_cols; // Dimensions of each partition's sketch
+    std::vector<uint32_t> m_max_partitions;
+    std::vector<uint64_t> m_partition_ttl_ms; // 0 if partitions are only evicted when `m_max_partitions` is reached
+    uint64_t m_topk_dump_interval_ms = 0;
+    uint64_t m_stats_interval_ms = 10000; // Refresh interval of the cached sketch occupancy metrics, disabled if 0
+    bool m_periodic_workers = true; // Wall clock driven resets, rotations, evictions, snapshots, dumps and fleet exchanges
+    plugin::anomalydetection::num::cms_options m_cms_options;
+    uint32_t m_counter_bits = 64; // Width of the sketch counters, one of 8, 16, 32, 64
+    uint32_t m_update_batch_size = 16; // Profile hashes staged per sketch before they are applied in one `update_batch`
+    uint32_t m_shards = 1; // Shards and worker threads per sketch, 1 updates the sketches on the event parsing thread
+    uint64_t m_shard_queue_capacity = 16384; // Queued updates per shard before the event parsing thread waits for the worker
+    std::string m_snapshot_dir; // Directory of the sketch snapshots, disabled if empty
+    uint64_t m_snapshot_interval_ms = 0; // Periodic snapshots in addition to the one on shutdown, disabled if 0
+    std::vector<uint64_t> m_profile_fingerprints; // Hash of each behavior profile definition, guards snapshot reloads and fleet merges
+    std::string m_fleet_dir; // Directory shared by the fleet to exchange sketches, disabled if empty
+    uint64_t m_fleet_interval_ms = 60000;
+    std::string m_node_id; // Name of this node's sketch files in `m_fleet_dir`
+
+    // Metrics, see `get_metrics`
+    std::vector<falcosecurity::metric> m_metrics;
+    std::vector<profile_metrics> m_profile_metrics;
+    uint64_t m_parsed_events = 0;
+    uint64_t m_extract_requests = 0;
+    uint64_t m_extract_failures = 0;
+    plugin::anomalydetection::num::log2_histogram m_parse_latency;
+    plugin::anomalydetection::num::log2_histogram m_extract_latency;
 
     // Plugin managed state table specific to the count_min_sketch use case
-    plugin_anomalydetection::Mutex<std::vector<std::shared_ptr<plugin::anomalydetection::num::cms<uint64_t>>>> m_count_min_sketches;
+    // Lock-free: the vector is only modified in `init` while no reset worker runs, the sketch counters
+    // are relaxed atomics so the event parsing, extraction and periodic resets never wait on each other
+    std::vector<std::shared_ptr<plugin::anomalydetection::num::sketch>> m_count_min_sketches;
+    // Per behavior profile hashes not yet applied to its sketch, only accessed by the event parsing / extraction thread
+    std::vector<plugin::anomalydetection::num::staged_batch> m_staged_updates;
+    // Distinct behavior profile estimators, nullptr for behavior profiles without `hll_precision`
+    std::vector<std::shared_ptr<plugin::anomalydetection::num::hll>> m_hlls;
+    // Per partition (e.g. per container) sketches, nullptr for behavior profiles without `partition_by`
+    std::vector<std::shared_ptr<plugin::anomalydetection::num::partitioned_sketch>> m_partitioned_sketches;
+    std::vector<std::shared_ptr<plugin::anomalydetection::num::sharded_sketch>> m_sharded_sketches; // Same sketches as `m_count_min_sketches` if sharded, else nullptr
+    // Read-only fleet-wide sketches, rebuilt by the fleet worker and swapped in via `std::atomic_store`
+    std::vector<std::shared_ptr<const plugin::anomalydetection::num::cms<uint64_t>>> m_fleet_sketches;
 
     // required; standard plugin API
     std::string m_lasterr;
@@ -220,6 +463,11 @@ class anomalydetection
 
     /* Custom write/read fields*/
     falcosecurity::table_field m_lastevent_fd_field; // todo fix/expose via plugin API
+    falcosecurity::table_field m_lineage_comm; ///< comm of the thread and its ancestors, see `update_lineage_cache`
+    falcosecurity::table_field m_lineage_exe; ///< exe of the thread and its ancestors
+    falcosecurity::table_field m_lineage_exepath; ///< exepath of the thread and its ancestors
+    falcosecurity::table_field m_lineage_pid; ///< pid of the thread and its ancestors
+    falcosecurity::table_field m_lineage_ptid; ///< ptid of the thread when its lineage was cached, a re-parented thread misses the cache
 };
 
 // required; standard plugin API
@@ -33,3 +33,14 @@ limitations under the License.
 ///////////////////////////
 
 #define THREAD_TABLE_NAME "threads"
+
+/////////////////////////
+// Metrics
+/////////////////////////
+
+#define METRIC_N_PARSED_EVENTS "n_parsed_events"
+#define METRIC_PARSE_LATENCY_NS "parse_event_latency_ns" // suffixed with _mean, _p50, _p99
+#define METRIC_N_EXTRACT_REQUESTS "n_extract_requests"
+#define METRIC_N_EXTRACT_FAILURES "n_extract_failures"
+#define METRIC_EXTRACT_LATENCY_NS "extract_latency_ns" // suffixed with _mean, _p50, _p99
+#define METRIC_PROFILE_PREFIX "count_min_sketch_" // followed by the behavior profile index and the metric name
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "num/histogram.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+// Latencies are sampled for one in PLUGIN_METRICS_LATENCY_SAMPLE_RATE calls (power of two), two clock reads per sample
+#define PLUGIN_METRICS_LATENCY_SAMPLE_RATE 64
+
+// Counters are only written by the event parsing / extraction thread and read by `get_metrics`
+inline void metrics_add(uint64_t& counter, uint64_t n)
+{
+    __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+inline uint64_t metrics_load(const uint64_t& counter)
+{
+    return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+// Gauges refreshed by a periodic worker, stored as the bits of the double
+inline void metrics_store_double(uint64_t& gauge, double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    __atomic_store_n(&gauge, bits, __ATOMIC_RELAXED);
+}
+
+inline double metrics_load_double(const uint64_t& gauge)
+{
+    uint64_t bits = __atomic_load_n(&gauge, __ATOMIC_RELAXED);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Hot path counters of one behavior profile
+struct profile_metrics
+{
+    uint64_t updates = 0; // Behavior profiles counted by the sketch
+    uint64_t empty_profiles = 0; // Events of the behavior profile's event codes whose profile came out empty, never counted
+    uint64_t extraction_failures = 0; // Profile extractions aborted by an exception
+    uint64_t profile_length_sum = 0; // Summed length of the counted behavior profile strings
+    // Occupancy of the sketch, a scan of all counters, refreshed every `stats_interval_ms` by a periodic worker
+    uint64_t fill_ratio = 0; // Bits of `cms_stats::fill_ratio`, see `metrics_load_double`
+    uint64_t counted_total = 0; // `cms_stats::total`
+};
+
+// Count a call and time it if it is sampled
+class sampled_latency
+{
+private:
+    plugin::anomalydetection::num::log2_histogram* histogram_ = nullptr;
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    sampled_latency(plugin::anomalydetection::num::log2_histogram& histogram, uint64_t& calls)
+    {
+        uint64_t n = metrics_load(calls);
+        metrics_add(calls, 1);
+        if ((n & (PLUGIN_METRICS_LATENCY_SAMPLE_RATE - 1)) == 0)
+        {
+            histogram_ = &histogram;
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~sampled_latency()
+    {
+        if (histogram_)
+        {
+            histogram_->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+        }
+    }
+
+    sampled_latency(const sampled_latency&) = delete;
+    sampled_latency& operator=(const sampled_latency&) = delete;
+};
@@ -18,15 +18,18 @@ limitations under the License.
 
 #pragma once
 
-#include "num/cms.h"
-#include "plugin_mutex.h"
+#include "num/sketch.h"
 
 #include <iostream>
+#include <mutex>
+#include <condition_variable>
 #include <thread>
 #include <chrono>
 #include <atomic>
 #include <vector>
 #include <memory>
+#include <algorithm>
+#include <functional>
 
 class ThreadManager {
 public:
@@ -39,31 +42,47 @@ public:
 
     void stop_threads()
     {
+        std::vector<std::thread> threads;
         {
             std::lock_guard<std::mutex> lock(m_thread_mutex);
             m_stop_requested = true;
+            threads.swap(m_threads);
         }
+        // Wake up sleeping workers, join outside of the lock the workers need to observe the stop request
+        m_stop_cv.notify_all();
+        for (auto& t : threads)
+        {
+            if (t.joinable())
+            {
+                t.join();
+            }
+        }
+    }
 
+    void start_periodic_count_min_sketch_reset_worker(int id, uint64_t interval_ms, const std::vector<std::shared_ptr<plugin::anomalydetection::num::sketch>>& count_min_sketches)
+    {
+        if (interval_ms > 100 && id >= 0 && id < count_min_sketches.size() && count_min_sketches.at(id))
         {
-            std::lock_guard<std::mutex> lock(m_thread_mutex);
-            for (auto& t : m_threads)
+            // Sliding window sketches expire one of their k slices every interval / k
+            uint64_t tick_ms = std::max<uint64_t>(1, interval_ms / count_min_sketches.at(id)->get_slices());
+            auto worker = [id, tick_ms, &count_min_sketches, this]() {
+                periodic_count_min_sketch_reset_worker(id, tick_ms, count_min_sketches);
+            };
+
+            std::thread worker_thread(worker);
             {
-                if (t.joinable())
-                {
-                    t.join();
-                }
+                std::lock_guard<std::mutex> lock(m_thread_mutex);
+                m_threads.push_back(std::move(worker_thread));
             }
-            m_threads.clear();
         }
     }
 
-    template<typename T>
-    void start_periodic_count_min_sketch_reset_worker(int id, uint64_t interval_ms, plugin_anomalydetection::Mutex<std::vector<std::shared_ptr<plugin::anomalydetection::num::cms<T>>>>& count_min_sketches)
+    void start_periodic_task_worker(uint64_t interval_ms, std::function<void()> task)
     {
-        if (interval_ms > 100)
+        if (interval_ms > 100 && task)
         {
-            auto worker = [id, interval_ms, &count_min_sketches, this]() {
-                periodic_count_min_sketch_reset_worker<T>(id, interval_ms, count_min_sketches);
+            auto worker = [interval_ms, task, this]() {
+                periodic_task_worker(interval_ms, task);
             };
 
             std::thread worker_thread(worker);
@@ -78,37 +97,59 @@ public:
 private:
     std::vector<std::thread> m_threads;
     std::mutex m_thread_mutex;
+    std::condition_variable m_stop_cv;
 
-    template<typename T>
-    void reset_sketches_worker(int id, plugin_anomalydetection::Mutex<std::vector<std::shared_ptr<plugin::anomalydetection::num::cms<T>>>>& count_min_sketches)
+    void reset_sketches_worker(int id, const std::vector<std::shared_ptr<plugin::anomalydetection::num::sketch>>& count_min_sketches)
     {
-        auto sketches = count_min_sketches.lock();
-        if (id >= 0 && id < sketches->size())
+        // No lock needed, the sketches vector only changes while no worker runs and the
+        // counters are reset with relaxed atomic stores that never block the event parsing.
+        // Double buffered sketches clear their standby buffer here and swap it in at the interval boundary,
+        // sliding window sketches only clear their oldest slice.
+        if (id >= 0 && id < count_min_sketches.size())
         {
-            auto& sketch_ptr = sketches->at(id);
+            auto& sketch_ptr = count_min_sketches.at(id);
             if (sketch_ptr)
             {
-                sketch_ptr->reset();
+                sketch_ptr->rotate();
             }
         }
     }
 
-    template<typename T>
-    void periodic_count_min_sketch_reset_worker(int id, uint64_t interval_ms, plugin_anomalydetection::Mutex<std::vector<std::shared_ptr<plugin::anomalydetection::num::cms<T>>>>& count_min_sketches)
+    void periodic_count_min_sketch_reset_worker(int id, uint64_t interval_ms, const std::vector<std::shared_ptr<plugin::anomalydetection::num::sketch>>& count_min_sketches)
     {
         std::chrono::milliseconds interval(interval_ms);
         while (true)
         {
-            std::this_thread::sleep_for(interval);
             {
-                std::lock_guard<std::mutex> lock(m_thread_mutex);
-                if (m_stop_requested)
+                std::unique_lock<std::mutex> lock(m_thread_mutex);
+                if (m_stop_cv.wait_for(lock, interval, [this]() { return m_stop_requested.load(); }))
+                    break;
+            }
+
+            try
+            {
+                reset_sketches_worker(id, count_min_sketches);
+            } catch (const std::exception& e)
+            {
+            }
+        }
+    }
+
+    void periodic_task_worker(uint64_t interval_ms, const std::function<void()>& task)
+    {
+        // Tasks such as snapshots read the counters with relaxed loads, concurrent updates may or may not be included
+        std::chrono::milliseconds interval(interval_ms);
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_thread_mutex);
+                if (m_stop_cv.wait_for(lock, interval, [this]() { return m_stop_requested.load(); }))
                     break;
             }
 
             try
             {
-                reset_sketches_worker<T>(id, count_min_sketches);
+                task();
             } catch (const std::exception& e)
             {
             }
@@ -37,6 +37,9 @@ namespace plugin_anomalydetection::utils
     // Adopted from falcosecurity/libs, custom hand-rolled for performance reasons
     std::string concatenate_paths(std::string_view path1, std::string_view path2);
 
+    // Same as above, writes to `out` so that hot paths reuse its buffer, returns a view of `out`
+    std::string_view concatenate_paths(std::string_view path1, std::string_view path2, std::string& out);
+
     // Temporary workaround; not as robust as libsinsp/eventformatter; 
     // ideally the plugin API exposes more libsinsp functionality in the near-term
     //
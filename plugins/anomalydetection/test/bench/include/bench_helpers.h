@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <num/xxhash_ext.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace bench
+{
+
+// Power of two number of distinct keys cycled through by the sketch benchmarks, larger than the L1 / L2 caches' worth of buckets
+static constexpr size_t KEYS = 1 << 16;
+
+inline std::vector<XXH128_hash_t> make_hashes(size_t n, uint64_t seed = 42)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<XXH128_hash_t> hashes(n);
+    for (auto& h : hashes)
+    {
+        h.low64 = rng();
+        h.high64 = rng();
+    }
+    return hashes;
+}
+
+} // namespace bench
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <sinsp_with_test_input.h>
+#include <helpers/threads_helpers.h>
+#include <plugin_test_var.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+Throughput of the compiled plugin, driven through the `libsinsp` test harness like the unit tests: the events go
+through the plugin's `parse_event` (dispatch table, lineage cache, field extractors, sketch updates) and the rule
+fields through its `extract`. Synthetic process trees `depth` levels below init exercise the lineage fields.
+Disabled by default, see `make run-plugin-benchmarks`.
+*/
+
+// Events of the measured loop, each iteration adds one open or one execve (enter and exit)
+static constexpr uint64_t BENCH_ITERATIONS = 200000;
+
+// Leaf processes of the synthetic trees, the events cycle through them
+static constexpr uint32_t BENCH_LEAVES = 64;
+
+class anomalydetection_bench : public sinsp_with_test_input
+{
+protected:
+    std::shared_ptr<sinsp_plugin> m_plugin;
+    filter_check_list m_pl_flist;
+    std::vector<int64_t> m_leaves;
+
+    /*
+    The three behavior profiles of the README example: execve with lineage fields, open with file descriptor fields
+    and execve with the cmdline.
+    */
+    static std::string make_config(uint32_t depth, uint32_t update_batch_size)
+    {
+        std::string d = std::to_string(depth);
+        return "{\"count_min_sketch\":{\"enabled\":true,\"n_sketches\":3,\"update_batch_size\":" + std::to_string(update_batch_size) + ","
+               "\"gamma_eps\":[[0.001,0.0001],[0.001,0.0001],[0.001,0.0001]],\"behavior_profiles\":["
+               "{\"fields\":\"%container.id %custom.proc.aname.lineage.join[" + d + "] %custom.proc.aexepath.lineage.join[" + d + "] %proc.tty\",\"event_codes\":[293]},"
+               "{\"fields\":\"%container.id %proc.name %custom.proc.aexepath.lineage.join[" + d + "] %fd.name\",\"event_codes\":[3]},"
+               "{\"fields\":\"%container.id %proc.cmdline\",\"event_codes\":[293]}]}}";
+    }
+
+    void init_plugin(uint32_t depth, uint32_t update_batch_size)
+    {
+        m_plugin = m_inspector.register_plugin(PLUGIN_PATH);
+        ASSERT_TRUE(m_plugin.get());
+        std::string err;
+        ASSERT_TRUE(m_plugin->init(make_config(depth, update_batch_size), err)) << "err: " << err;
+        m_pl_flist.add_filter_check(m_inspector.new_generic_filtercheck());
+        m_pl_flist.add_filter_check(sinsp_plugin::new_filtercheck(m_plugin));
+    }
+
+    // `BENCH_LEAVES` chains of `depth` processes below init, each cloned and exec'ed by its parent
+    void make_trees(uint32_t depth)
+    {
+        int64_t next_tid = 100;
+        for (uint32_t leaf = 0; leaf < BENCH_LEAVES; ++leaf)
+        {
+            int64_t parent = INIT_TID;
+            for (uint32_t level = 0; level < depth; ++level)
+            {
+                int64_t tid = next_tid++;
+                std::string comm = "proc" + std::to_string(level % 7);
+                generate_clone_x_event(0, tid, tid, parent);
+                generate_execve_enter_and_exit_event(0, tid, tid, tid, parent, "/usr/bin/" + comm, comm, "/usr/local/lib/containers/bin/" + comm);
+                parent = tid;
+            }
+            m_leaves.push_back(parent);
+        }
+    }
+
+    void report(const char* name, uint32_t depth, uint64_t n_events, std::chrono::steady_clock::duration elapsed)
+    {
+        double s = std::chrono::duration<double>(elapsed).count();
+        double rate = s > 0 ? n_events / s : 0.0;
+        printf("%s depth=%u events=%lu elapsed_s=%.3f events_per_second=%.0f\n", name, depth, (unsigned long)n_events, s, rate);
+        RecordProperty("events_per_second", std::to_string((uint64_t)rate));
+    }
+
+    /*
+    One in four events is an execve of a leaf, the others open a file. Rules only read the estimates of the execve
+    behavior profiles, each execve extracts them, which applies their staged updates first.
+    */
+    void run_events_per_second(uint32_t depth, uint32_t update_batch_size)
+    {
+        init_plugin(depth, update_batch_size);
+        add_default_init_thread();
+        open_inspector();
+        make_trees(depth);
+
+        std::vector<std::string> fd_names;
+        for (uint32_t i = 0; i < 1024; ++i)
+        {
+            fd_names.push_back("/var/lib/app/data/" + std::to_string(i % 97) + "/file" + std::to_string(i) + ".db");
+        }
+        std::string count;
+        uint64_t n_events = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t n = 0; n < BENCH_ITERATIONS; ++n)
+        {
+            int64_t tid = m_leaves[n % m_leaves.size()];
+            if (n % 4 == 0)
+            {
+                auto evt = generate_execve_enter_and_exit_event(0, tid, tid, tid, tid - 1, "/usr/bin/leaf", "leaf", "/usr/local/lib/containers/bin/leaf");
+                count = get_field_as_string(evt, "anomaly.count_min_sketch[0]", m_pl_flist);
+                count = get_field_as_string(evt, "anomaly.count_min_sketch[2]", m_pl_flist);
+                n_events += 2;
+            } else
+            {
+                add_event_advance_ts(increasing_ts(), tid, PPME_SYSCALL_OPEN_X, 6, (int64_t)(3 + n % 64), fd_names[n % fd_names.size()].c_str(), (uint32_t)0, (uint32_t)0, (uint32_t)0, (uint64_t)n);
+                n_events += 1;
+            }
+        }
+        ASSERT_FALSE(count.empty());
+        report(::testing::UnitTest::GetInstance()->current_test_info()->name(), depth, n_events, std::chrono::steady_clock::now() - start);
+    }
+};
+
+TEST_F(anomalydetection_bench, DISABLED_plugin_anomalydetection_bench_events_per_second_depth_8)
+{
+    run_events_per_second(8, 16);
+}
+
+TEST_F(anomalydetection_bench, DISABLED_plugin_anomalydetection_bench_events_per_second_depth_32)
+{
+    run_events_per_second(32, 16);
+}
+
+TEST_F(anomalydetection_bench, DISABLED_plugin_anomalydetection_bench_events_per_second_depth_32_unbatched)
+{
+    run_events_per_second(32, 1);
+}
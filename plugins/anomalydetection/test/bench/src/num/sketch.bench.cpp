@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <benchmark/benchmark.h>
+#include <bench_helpers.h>
+#include <num/cms.h>
+#include <num/cms_window.h>
+#include <num/sketch.h>
+#include <num/hll.h>
+#include <num/sharded_sketch.h>
+
+namespace num = plugin::anomalydetection::num;
+
+// Rows x Cols grid, from L1 resident to sketches far larger than the LLC (7 x 2^22 x 8 bytes = 224 MB)
+static void sketch_dims(benchmark::internal::Benchmark* b)
+{
+    b->ArgNames({"d", "w"});
+    b->ArgsProduct({{3, 5, 7}, {1 << 10, 1 << 14, 1 << 18, 1 << 22}});
+}
+
+static num::cms_options bench_options(bool simd = true)
+{
+    num::cms_options options;
+    options.concurrency = num::cms_concurrency::SINGLE_WRITER; // As configured by the plugin
+    options.simd = simd;
+    return options;
+}
+
+template<typename T>
+static void BM_cms_update(benchmark::State& state)
+{
+    num::cms<T> sketch((uint64_t)state.range(0), (uint64_t)state.range(1), bench_options());
+    auto hashes = bench::make_hashes(bench::KEYS);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        sketch.update(hashes[i++ & (bench::KEYS - 1)], 1);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["bytes"] = sketch.get_size_bytes();
+}
+
+template<typename T>
+static void BM_cms_update_batch(benchmark::State& state)
+{
+    static constexpr size_t batch = 16; // Default `update_batch_size`
+    num::cms<T> sketch((uint64_t)state.range(0), (uint64_t)state.range(1), bench_options());
+    auto hashes = bench::make_hashes(bench::KEYS);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        sketch.update_batch(&hashes[i], batch, 1);
+        i = (i + batch) & (bench::KEYS - 1);
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+
+template<typename T, bool simd>
+static void BM_cms_estimate(benchmark::State& state)
+{
+    num::cms<T> sketch((uint64_t)state.range(0), (uint64_t)state.range(1), bench_options(simd));
+    auto hashes = bench::make_hashes(bench::KEYS);
+    for (const auto& h : hashes)
+    {
+        sketch.update(h, 1);
+    }
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(sketch.estimate(hashes[i++ & (bench::KEYS - 1)]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_cms_update, uint8_t)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_update, uint16_t)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_update, uint32_t)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_update, uint64_t)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_update_batch, uint32_t)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_update_batch, uint64_t)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_estimate, uint8_t, false)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_estimate, uint16_t, false)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_estimate, uint32_t, false)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_estimate, uint32_t, true)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_estimate, uint64_t, false)->Apply(sketch_dims);
+BENCHMARK_TEMPLATE(BM_cms_estimate, uint64_t, true)->Apply(sketch_dims);
+
+// Sliding window estimates sum all slices
+static void BM_cms_window_estimate(benchmark::State& state)
+{
+    num::cms_window<uint32_t> window((uint64_t)3, (uint64_t)1 << 14, (uint32_t)state.range(0), bench_options());
+    auto hashes = bench::make_hashes(bench::KEYS);
+    for (const auto& h : hashes)
+    {
+        window.update(h, 1);
+    }
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(window.estimate(hashes[i++ & (bench::KEYS - 1)]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_cms_window_estimate)->ArgName("slices")->Arg(2)->Arg(8)->Arg(32);
+
+// Estimates of never seen keys, the common case of novelty rules, with and without the novelty filter
+static void BM_sketch_estimate_unseen(benchmark::State& state)
+{
+    num::sketch_impl<num::cms<uint64_t>> sketch((uint64_t)7, (uint64_t)1 << 20, bench_options());
+    if (state.range(0))
+    {
+        sketch.enable_novelty_filter(bench::KEYS);
+    }
+    for (const auto& h : bench::make_hashes(bench::KEYS))
+    {
+        sketch.update(h, 1);
+    }
+    auto unseen = bench::make_hashes(bench::KEYS, 7);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(sketch.estimate(unseen[i++ & (bench::KEYS - 1)]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_sketch_estimate_unseen)->ArgName("novelty_filter")->Arg(0)->Arg(1);
+
+// Event parsing thread throughput of a 224 MB sketch, updated in place (shards 1) or by that many shard workers,
+// the measured time includes applying all queued updates
+static void BM_sharded_sketch_update(benchmark::State& state)
+{
+    static constexpr size_t batch = 16; // Default `update_batch_size`
+    uint64_t shards = (uint64_t)state.range(0);
+    std::shared_ptr<num::sketch> sketch;
+    if (shards > 1)
+    {
+        sketch = std::make_shared<num::sharded_sketch>([shards]() {
+            return std::make_shared<num::sketch_impl<num::cms<uint64_t>>>((uint64_t)7, ((uint64_t)1 << 22) / shards, bench_options());
+        }, (uint32_t)shards, 16384);
+    } else
+    {
+        sketch = std::make_shared<num::sketch_impl<num::cms<uint64_t>>>((uint64_t)7, (uint64_t)1 << 22, bench_options());
+    }
+    auto hashes = bench::make_hashes(bench::KEYS);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        sketch->update_batch(&hashes[i], batch, 1);
+        i = (i + batch) & (bench::KEYS - 1);
+    }
+    sketch->flush();
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_sharded_sketch_update)->ArgName("shards")->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+static void BM_hll_update(benchmark::State& state)
+{
+    num::hll hll((uint32_t)state.range(0));
+    auto hashes = bench::make_hashes(bench::KEYS);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        hll.update(hashes[i++ & (bench::KEYS - 1)]);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_hll_update)->ArgName("p")->Arg(12)->Arg(18);
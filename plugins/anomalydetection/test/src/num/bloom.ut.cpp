@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/bloom.h>
+#include <num/cms.h>
+#include <num/cms_window.h>
+#include <num/sketch.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_bloom)
+{
+    namespace num = plugin::anomalydetection::num;
+    uint64_t capacity = 8192;
+    num::blocked_bloom bloom(capacity);
+    EXPECT_EQ(bloom.get_blocks(), capacity * num::BLOOM_BITS_PER_KEY / 512);
+    EXPECT_EQ(bloom.get_size_bytes(), bloom.get_blocks() * 64);
+    EXPECT_EQ(num::blocked_bloom::get_size_bytes(capacity), bloom.get_size_bytes());
+    EXPECT_EQ(num::blocked_bloom::get_size_bytes(1), 64);
+
+    for (uint64_t i = 0; i < capacity; ++i)
+    {
+        bloom.insert(num::sketch::hash("seen" + std::to_string(i)));
+    }
+    // No false negatives
+    for (uint64_t i = 0; i < capacity; ++i)
+    {
+        EXPECT_TRUE(bloom.maybe_contains(num::sketch::hash("seen" + std::to_string(i))));
+    }
+    uint64_t false_positives = 0;
+    for (uint64_t i = 0; i < capacity; ++i)
+    {
+        false_positives += bloom.maybe_contains(num::sketch::hash("new" + std::to_string(i)));
+    }
+    EXPECT_LT(false_positives, capacity / 100);
+
+    bloom.clear();
+    EXPECT_FALSE(bloom.maybe_contains(num::sketch::hash("seen0")));
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_novelty_filter)
+{
+    namespace num = plugin::anomalydetection::num;
+    auto hash = num::sketch::hash("falco");
+
+    // Plain sketch, rotations drop all counts
+    num::sketch_impl<num::cms<uint64_t>> sketch((uint64_t)3, (uint64_t)1000);
+    sketch.enable_novelty_filter(1000);
+    EXPECT_EQ(sketch.estimate(hash), 0);
+    EXPECT_FALSE(sketch.get_novelty_filter()->maybe_seen(hash));
+    sketch.update(hash, 3);
+    EXPECT_EQ(sketch.estimate(hash), 3);
+    sketch.rotate();
+    EXPECT_FALSE(sketch.get_novelty_filter()->maybe_seen(hash));
+    sketch.update_batch(&hash, 1, 2);
+    EXPECT_EQ(sketch.estimate(hash), 2);
+    sketch.reset();
+    EXPECT_FALSE(sketch.get_novelty_filter()->maybe_seen(hash));
+
+    // Sliding window, the filter keeps every key of an unexpired slice
+    uint32_t slices = 4;
+    num::sketch_impl<num::cms_window<uint64_t>> window((uint64_t)3, (uint64_t)1000, slices);
+    window.enable_novelty_filter(1000);
+    for (uint32_t round = 0; round < 3 * slices; ++round)
+    {
+        auto key = num::sketch::hash("round" + std::to_string(round));
+        window.update(key, 1);
+        for (uint32_t age = 0; age < slices; ++age)
+        {
+            auto old_key = num::sketch::hash("round" + std::to_string(round - std::min(round, age)));
+            EXPECT_EQ(window.estimate(old_key), 1);
+        }
+        window.rotate();
+    }
+
+    // Restored counts bypass the filter until they expire
+    std::string path = (std::filesystem::temp_directory_path() / "anomalydetection_bloom.ut.cms").string();
+    sketch.update(hash, 5);
+    ASSERT_TRUE(sketch.save_snapshot(path, 42));
+    num::sketch_impl<num::cms<uint64_t>> restored((uint64_t)3, (uint64_t)1000);
+    restored.enable_novelty_filter(1000);
+    ASSERT_TRUE(restored.load_snapshot(path, 42));
+    EXPECT_EQ(restored.estimate(hash), 5);
+    restored.rotate();
+    EXPECT_EQ(restored.estimate(hash), 0);
+    EXPECT_FALSE(restored.get_novelty_filter()->maybe_seen(hash));
+    std::remove(path.c_str());
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_novelty_filter_concurrent_reset)
+{
+    namespace num = plugin::anomalydetection::num;
+    // Large filter, so each clear takes long enough for updates to race with it, and a wide sketch, so the estimates
+    // of dropped keys are not raised by collisions with the keys counted since
+    num::cms_options options;
+    options.concurrency = num::cms_concurrency::SINGLE_WRITER;
+    options.double_buffered = true;
+    num::sketch_impl<num::cms<uint32_t>> sketch((uint64_t)3, (uint64_t)1 << 18, options);
+    sketch.enable_novelty_filter(1 << 20);
+    std::atomic<uint64_t> started{0};
+    std::atomic<uint64_t> completed{0};
+    std::atomic<bool> done{false};
+
+    // Reset worker
+    std::thread resetter([&]()
+    {
+        while (!done)
+        {
+            started++;
+            sketch.reset();
+            completed++;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    // Keys updated while a reset was in progress, checked once it is over: a key counted by the sketch must never be
+    // answered "never seen"
+    std::vector<XXH128_hash_t> raced;
+    uint64_t checked = 0;
+    for (uint64_t n = 0; completed.load() < 100; ++n)
+    {
+        auto hash = num::sketch::hash("key" + std::to_string(n));
+        uint64_t before = completed.load();
+        bool in_progress = started.load() != before;
+        sketch.update(hash, 1);
+        if (in_progress || started.load() != before)
+        {
+            raced.push_back(hash);
+        }
+        uint64_t s = started.load();
+        if (raced.empty() || s != completed.load())
+        {
+            continue;
+        }
+        for (const auto& key : raced)
+        {
+            bool seen = sketch.get_novelty_filter()->maybe_seen(key);
+            uint64_t count = sketch.get().estimate(key);
+            if (started.load() == s)
+            {
+                EXPECT_TRUE(count == 0 || seen);
+                checked++;
+            }
+        }
+        raced.clear();
+    }
+    done = true;
+    resetter.join();
+    EXPECT_GT(checked, 0);
+}
@@ -19,9 +19,12 @@ limitations under the License.
 #include <sinsp_with_test_input.h>
 #include <helpers/threads_helpers.h>
 #include <num/cms.h>
+#include <num/cms_window.h>
 #include <plugin_test_var.h>
 #include <test_helpers.h>
 
+#include <thread>
+
 TEST(plugin_anomalydetection, plugin_anomalydetection_cms_dim)
 {
     double gamma = 0.001;
@@ -63,6 +66,262 @@ TEST(plugin_anomalydetection, plugin_anomalydetection_cms_update_estimate)
     EXPECT_EQ(cms.estimate(test_str2), 0);
 }
 
+TEST(plugin_anomalydetection, plugin_anomalydetection_cms_hash_once)
+{
+    plugin::anomalydetection::num::cms<uint64_t> cms((uint64_t)7, (uint64_t)27183);
+
+    std::string_view test_str = "falco";
+    auto hash = plugin::anomalydetection::num::cms<uint64_t>::hash_XXH3_128(test_str);
+
+    // Each Row must probe its own bucket derived from the single 128 bit hash
+    for (uint64_t row = 1; row < cms.get_d(); ++row)
+    {
+        EXPECT_NE(cms.get_index(hash, row), cms.get_index(hash, row - 1));
+        EXPECT_LT(cms.get_index(hash, row), cms.get_w());
+    }
+
+    // String and pre-hashed APIs are interchangeable
+    cms.update(test_str, 2);
+    cms.update(hash, 1);
+    EXPECT_EQ(cms.estimate(hash), 3);
+    EXPECT_EQ(cms.estimate(test_str), 3);
+    EXPECT_EQ(cms.update_estimate(test_str, 1), 4);
+    EXPECT_EQ(cms.estimate(std::string_view()), 0);
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_cms_flat_pow2)
+{
+    plugin::anomalydetection::num::cms_options options;
+    options.pow2_cols = true;
+    options.huge_pages = true;
+    plugin::anomalydetection::num::cms<uint64_t> cms((uint64_t)7, (uint64_t)27183, options);
+
+    EXPECT_EQ(cms.get_d(), 7);
+    EXPECT_EQ(cms.get_w(), 32768);
+    EXPECT_DOUBLE_EQ(cms.get_eps(), std::exp(1) / 32768);
+
+    std::string test_str = "falco";
+    cms.update(test_str, 5);
+    EXPECT_EQ(cms.estimate(test_str), 5);
+    auto hash = plugin::anomalydetection::num::cms<uint64_t>::hash_XXH3_128(test_str);
+    for (uint64_t row = 0; row < cms.get_d(); ++row)
+    {
+        EXPECT_EQ(cms.get_item(row, cms.get_index(hash, row)), 5);
+    }
+    cms.reset();
+    EXPECT_EQ(cms.estimate(test_str), 0);
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_cms_concurrency)
+{
+    plugin::anomalydetection::num::cms_options options;
+    options.concurrency = plugin::anomalydetection::num::cms_concurrency::MULTI_WRITER;
+    plugin::anomalydetection::num::cms<uint64_t> cms((uint64_t)5, (uint64_t)1024, options);
+
+    std::string test_str = "falco";
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; ++t)
+    {
+        writers.emplace_back([&cms, &test_str]() {
+            for (int i = 0; i < 10000; ++i)
+            {
+                cms.update(test_str, 1);
+            }
+        });
+    }
+    for (auto& t : writers)
+    {
+        t.join();
+    }
+    EXPECT_EQ(cms.estimate(test_str), 40000);
+
+    // Resets never block a concurrent single writer
+    options.concurrency = plugin::anomalydetection::num::cms_concurrency::SINGLE_WRITER;
+    plugin::anomalydetection::num::cms<uint64_t> cms_single((uint64_t)5, (uint64_t)1024, options);
+    std::thread writer([&cms_single, &test_str]() {
+        for (int i = 0; i < 100000; ++i)
+        {
+            cms_single.update(test_str, 1);
+        }
+    });
+    for (int i = 0; i < 100; ++i)
+    {
+        cms_single.reset();
+    }
+    writer.join();
+    EXPECT_LE(cms_single.estimate(test_str), 100000);
+    cms_single.reset();
+    EXPECT_EQ(cms_single.estimate(test_str), 0);
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_cms_double_buffered)
+{
+    plugin::anomalydetection::num::cms_options options;
+    options.double_buffered = true;
+    options.concurrency = plugin::anomalydetection::num::cms_concurrency::SINGLE_WRITER;
+    plugin::anomalydetection::num::cms<uint64_t> cms((uint64_t)7, (uint64_t)27183, options);
+
+    EXPECT_TRUE(cms.is_double_buffered());
+    EXPECT_EQ(cms.get_size_bytes(), 2 * plugin::anomalydetection::num::cms<uint64_t>::get_size_bytes(7, 27183));
+
+    std::string test_str = "falco";
+    cms.update(test_str, 3);
+    EXPECT_EQ(cms.estimate(test_str), 3);
+
+    // Clearing the standby buffer leaves the active counts untouched
+    cms.clear_standby();
+    EXPECT_EQ(cms.estimate(test_str), 3);
+
+    // The reset swaps in the cleared standby buffer
+    cms.reset();
+    EXPECT_EQ(cms.estimate(test_str), 0);
+    cms.update(test_str, 1);
+    EXPECT_EQ(cms.estimate(test_str), 1);
+
+    // The previously active buffer is cleared before it is swapped back in
+    cms.reset();
+    EXPECT_EQ(cms.estimate(test_str), 0);
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_cms_counters)
+{
+    std::string test_str = "falco";
+
+    // Small counters saturate instead of wrapping around
+    plugin::anomalydetection::num::cms<uint8_t> cms_u8((uint64_t)7, (uint64_t)27183);
+    EXPECT_EQ(cms_u8.get_size_bytes(), 7 * 27183);
+    cms_u8.update(test_str, 200);
+    EXPECT_EQ(cms_u8.update_estimate(test_str, 100), 255);
+    EXPECT_EQ(cms_u8.estimate(test_str), 255);
+
+    plugin::anomalydetection::num::cms_options options;
+    options.concurrency = plugin::anomalydetection::num::cms_concurrency::MULTI_WRITER;
+    plugin::anomalydetection::num::cms<uint16_t> cms_u16((uint64_t)7, (uint64_t)27183, options);
+    cms_u16.update(test_str, 65000);
+    cms_u16.update(test_str, 1000);
+    EXPECT_EQ(cms_u16.estimate(test_str), 65535);
+
+    // Conservative update never overestimates more than the regular update
+    options.concurrency = plugin::anomalydetection::num::cms_concurrency::NONE;
+    options.conservative_update = true;
+    plugin::anomalydetection::num::cms<uint32_t> cms_cu((uint64_t)3, (uint64_t)16, options);
+    plugin::anomalydetection::num::cms<uint32_t> cms_regular((uint64_t)3, (uint64_t)16);
+    EXPECT_TRUE(cms_cu.is_conservative_update());
+    uint64_t error_cu = 0;
+    uint64_t error_regular = 0;
+    for (int i = 0; i < 200; ++i)
+    {
+        std::string item = "item" + std::to_string(i);
+        cms_cu.update(item, i % 5 + 1);
+        cms_regular.update(item, i % 5 + 1);
+    }
+    for (int i = 0; i < 200; ++i)
+    {
+        std::string item = "item" + std::to_string(i);
+        EXPECT_GE(cms_cu.estimate(item), i % 5 + 1);
+        EXPECT_LE(cms_cu.estimate(item), cms_regular.estimate(item));
+        error_cu += cms_cu.estimate(item) - (i % 5 + 1);
+        error_regular += cms_regular.estimate(item) - (i % 5 + 1);
+    }
+    EXPECT_LT(error_cu, error_regular);
+    uint32_t updated_estimate = cms_cu.update_estimate(test_str, 2);
+    EXPECT_EQ(updated_estimate, cms_cu.estimate(test_str));
+}
+
+template<typename T>
+static void expect_simd_matches_scalar(uint64_t d, uint64_t w)
+{
+    plugin::anomalydetection::num::cms_options scalar_options;
+    scalar_options.simd = false;
+    plugin::anomalydetection::num::cms<T> cms_simd(d, w);
+    plugin::anomalydetection::num::cms<T> cms_scalar(d, w, scalar_options);
+    EXPECT_FALSE(cms_scalar.is_simd());
+    for (int i = 0; i < 500; ++i)
+    {
+        std::string item = "item" + std::to_string(i % 123);
+        cms_simd.update(item, i % 7 + 1);
+        cms_scalar.update(item, i % 7 + 1);
+    }
+    // Saturated counters exercise the unsigned comparisons of the horizontal min
+    cms_simd.update("saturated", std::numeric_limits<T>::max());
+    cms_scalar.update("saturated", std::numeric_limits<T>::max());
+    for (int i = 0; i < 200; ++i)
+    {
+        std::string item = "item" + std::to_string(i);
+        EXPECT_EQ(cms_simd.estimate(item), cms_scalar.estimate(item));
+    }
+    EXPECT_EQ(cms_simd.estimate("saturated"), cms_scalar.estimate("saturated"));
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_cms_simd)
+{
+    // Every padding remainder of the 4 gather lanes, plus the plain loop beyond the batched Rows
+    for (uint64_t d : {1, 2, 3, 4, 5, 7, 8, 16, 17})
+    {
+        expect_simd_matches_scalar<uint64_t>(d, 97);
+        expect_simd_matches_scalar<uint32_t>(d, 97);
+        expect_simd_matches_scalar<uint16_t>(d, 97);
+    }
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_cms_update_batch)
+{
+    // Batched updates count exactly like one update per key, for any batch length and with conservative updates
+    for (bool conservative_update : {false, true})
+    {
+        for (uint64_t d : {3, 17})
+        {
+            plugin::anomalydetection::num::cms_options options;
+            options.conservative_update = conservative_update;
+            plugin::anomalydetection::num::cms<uint32_t> cms_batch(d, (uint64_t)101, options);
+            plugin::anomalydetection::num::cms<uint32_t> cms_single(d, (uint64_t)101, options);
+            std::vector<XXH128_hash_t> hashes;
+            for (int i = 0; i < 300; ++i)
+            {
+                hashes.push_back(plugin::anomalydetection::num::cms<uint32_t>::hash_XXH3_128("item" + std::to_string(i % 37)));
+                cms_single.update(hashes.back(), 2);
+            }
+            size_t start = 0;
+            for (size_t n : {0, 1, 7, 8, 9, 64, 211})
+            {
+                cms_batch.update_batch(hashes.data() + start, n, 2);
+                start += n;
+            }
+            ASSERT_EQ(start, hashes.size());
+            for (int i = 0; i < 37; ++i)
+            {
+                std::string item = "item" + std::to_string(i);
+                EXPECT_EQ(cms_batch.estimate(item), cms_single.estimate(item));
+            }
+        }
+    }
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_cms_stats)
+{
+    plugin::anomalydetection::num::cms<uint32_t> cms((uint64_t)4, (uint64_t)100);
+    auto stats = cms.get_stats();
+    EXPECT_EQ(stats.fill_ratio, 0);
+    EXPECT_EQ(stats.total, 0);
+
+    // One key fills one counter per Row
+    cms.update("falco", 5);
+    stats = cms.get_stats();
+    EXPECT_DOUBLE_EQ(stats.fill_ratio, 0.01);
+    EXPECT_EQ(stats.total, 5);
+    cms.update("sysdig", 2);
+    EXPECT_EQ(cms.get_stats().total, 7);
+
+    // The fill ratio of a sliding window is the one of the union of its slices
+    plugin::anomalydetection::num::cms_window<uint32_t> window((uint64_t)4, (uint64_t)100, 2);
+    window.update("falco", 1);
+    window.rotate();
+    window.update("falco", 1);
+    stats = window.get_stats();
+    EXPECT_NEAR(stats.fill_ratio, 1 - 0.99 * 0.99, 1e-12);
+    EXPECT_EQ(stats.total, 2);
+}
+
 TEST_F(sinsp_with_test_input, plugin_anomalydetection_filterchecks_fields)
 {
     std::shared_ptr<sinsp_plugin> plugin_owner;
@@ -214,6 +473,30 @@ TEST_F(sinsp_with_test_input, plugin_anomalydetection_filterchecks_fields_fd_nul
     fdinfo->m_name_raw.clear();
     ASSERT_EQ(get_field_as_string(evt, "anomaly.count_min_sketch.profile[1]", pl_flist), "1100/tmp/subdir1/the_file/tmp/subdir1the_file0777subdir1//../the_file");
 
+    // The cached dirfd path is dropped once the dirfd is closed and its number reused
+    evt = NULL;
+    new_fd = 101;
+    add_event_advance_ts(increasing_ts(), 1, PPME_SYSCALL_CLOSE_E, 1, fd);
+    add_event_advance_ts(increasing_ts(), 1, PPME_SYSCALL_CLOSE_X, 1, (int64_t)0);
+    add_event(increasing_ts(), 1, PPME_SYSCALL_OPEN_E, 3, "/tmp/other_dir", 0, 0);
+    add_event_advance_ts(increasing_ts(), 1, PPME_SYSCALL_OPEN_X, 6, fd, "/tmp/other_dir", 0, 0, 0, ino);
+    add_event_advance_ts(increasing_ts(), 1, PPME_SYSCALL_OPENAT2_E, 5, dirfd, "subdir1//../the_file", 0, 0, 0);
+    evt = add_event_advance_ts(increasing_ts(), 1, PPME_SYSCALL_OPENAT2_X, 8, new_fd, dirfd, "subdir1//../the_file", 0, 0, 0, 0, ino);
+    fdinfo = evt->get_thread_info()->get_fd(new_fd);
+    fdinfo->m_name.clear();
+    fdinfo->m_name_raw.clear();
+    ASSERT_EQ(get_field_as_string(evt, "anomaly.count_min_sketch.profile[1]", pl_flist), "1101/tmp/other_dir/the_file/tmp/other_dirthe_file0777subdir1//../the_file");
+
+    // Relative to the cwd
+    evt = NULL;
+    new_fd = 102;
+    add_event_advance_ts(increasing_ts(), 1, PPME_SYSCALL_OPENAT2_E, 5, (int64_t)PPM_AT_FDCWD, "subdir1//../the_file", 0, 0, 0);
+    evt = add_event_advance_ts(increasing_ts(), 1, PPME_SYSCALL_OPENAT2_X, 8, new_fd, (int64_t)PPM_AT_FDCWD, "subdir1//../the_file", 0, 0, 0, 0, ino);
+    fdinfo = evt->get_thread_info()->get_fd(new_fd);
+    fdinfo->m_name.clear();
+    fdinfo->m_name_raw.clear();
+    ASSERT_EQ(get_field_as_string(evt, "anomaly.count_min_sketch.profile[1]", pl_flist), "1102/root/the_file/rootthe_file0777subdir1//../the_file");
+
     evt = NULL;
     fd = 4;
     int64_t mountfd = 5;
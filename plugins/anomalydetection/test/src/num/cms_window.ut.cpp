@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/cms_window.h>
+#include <num/sketch.h>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_cms_window)
+{
+    uint64_t d = 7;
+    uint64_t w = 27183;
+    uint32_t k = 4;
+    plugin::anomalydetection::num::cms_window<uint64_t> window(d, w, k);
+
+    EXPECT_EQ(window.get_slices(), k);
+    EXPECT_EQ(window.get_d(), d);
+    EXPECT_EQ(window.get_w(), w);
+    EXPECT_EQ(window.get_size_bytes(), k * plugin::anomalydetection::num::cms<uint64_t>::get_size_bytes(d, w));
+
+    // Counts of each slice add up while they are within the window
+    std::string test_str = "falco";
+    for (uint32_t i = 0; i < k; ++i)
+    {
+        window.update(test_str, i + 1);
+        EXPECT_EQ(window.estimate(test_str), (i + 1) * (i + 2) / 2);
+        window.rotate();
+    }
+
+    // Each rotation only expires the oldest slice
+    EXPECT_EQ(window.estimate(test_str), 2 + 3 + 4);
+    window.rotate();
+    EXPECT_EQ(window.estimate(test_str), 3 + 4);
+    window.rotate();
+    window.rotate();
+    EXPECT_EQ(window.estimate(test_str), 0);
+
+    window.update(test_str, 5);
+    EXPECT_EQ(window.update_estimate(test_str, 1), 6);
+    window.reset();
+    EXPECT_EQ(window.estimate(test_str), 0);
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_sketch_types)
+{
+    std::vector<std::shared_ptr<plugin::anomalydetection::num::sketch>> sketches;
+    sketches.push_back(std::make_shared<plugin::anomalydetection::num::sketch_impl<plugin::anomalydetection::num::cms<uint64_t>>>((uint64_t)7, (uint64_t)27183));
+    sketches.push_back(std::make_shared<plugin::anomalydetection::num::sketch_impl<plugin::anomalydetection::num::cms_window<uint64_t>>>((uint64_t)7, (uint64_t)27183, 2));
+
+    std::string test_str = "falco";
+    for (auto& sketch : sketches)
+    {
+        sketch->update(test_str, 2);
+        EXPECT_EQ(sketch->estimate(test_str), 2);
+        EXPECT_EQ(sketch->estimate(""), 0);
+    }
+
+    // A plain sketch forgets everything at each rotation, the sliding window keeps the previous slice
+    for (auto& sketch : sketches)
+    {
+        sketch->rotate();
+    }
+    EXPECT_EQ(sketches[0]->get_slices(), 1);
+    EXPECT_EQ(sketches[0]->estimate(test_str), 0);
+    EXPECT_EQ(sketches[1]->get_slices(), 2);
+    EXPECT_EQ(sketches[1]->estimate(test_str), 2);
+}
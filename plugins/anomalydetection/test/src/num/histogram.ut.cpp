@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/histogram.h>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_log2_histogram)
+{
+    namespace num = plugin::anomalydetection::num;
+    num::log2_histogram histogram;
+    EXPECT_EQ(histogram.get_count(), 0);
+    EXPECT_EQ(histogram.get_mean(), 0);
+    EXPECT_EQ(histogram.get_quantile(0.5), 0);
+
+    // 90 fast samples in [64, 128) and 10 slow ones in [4096, 8192)
+    for (uint64_t i = 0; i < 90; ++i)
+    {
+        histogram.record(100);
+    }
+    for (uint64_t i = 0; i < 10; ++i)
+    {
+        histogram.record(5000);
+    }
+    EXPECT_EQ(histogram.get_count(), 100);
+    EXPECT_EQ(histogram.get_mean(), (90 * 100 + 10 * 5000) / 100);
+    EXPECT_EQ(histogram.get_quantile(0.5), 127);
+    EXPECT_EQ(histogram.get_quantile(0.99), 8191);
+    EXPECT_EQ(histogram.get_quantile(1.0), 8191);
+    EXPECT_EQ(histogram.get_quantile(0.0), 127);
+
+    histogram.record(0);
+    histogram.record(UINT64_MAX);
+    EXPECT_EQ(histogram.get_quantile(0.0), 0);
+    EXPECT_EQ(histogram.get_quantile(1.0), UINT64_MAX);
+
+    histogram.reset();
+    EXPECT_EQ(histogram.get_count(), 0);
+    EXPECT_EQ(histogram.get_quantile(0.99), 0);
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/hll.h>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_hll)
+{
+    plugin::anomalydetection::num::hll hll(12);
+    EXPECT_EQ(hll.get_precision(), 12);
+    EXPECT_EQ(hll.get_registers(), 4096);
+    EXPECT_EQ(hll.get_size_bytes(), 4096);
+    EXPECT_EQ(hll.estimate(), 0);
+
+    // Duplicates do not count, small cardinalities are near exact via linear counting
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            hll.update("exepath" + std::to_string(i));
+        }
+    }
+    EXPECT_NEAR(hll.estimate(), 100, 2);
+
+    // Standard error 1.04 / sqrt(4096) ~ 1.6%
+    for (int i = 0; i < 100000; ++i)
+    {
+        hll.update("destination" + std::to_string(i));
+    }
+    EXPECT_NEAR(hll.estimate(), 100100, 100100 * 0.05);
+
+    // Union of disjoint streams
+    plugin::anomalydetection::num::hll other(12);
+    for (int i = 0; i < 50000; ++i)
+    {
+        other.update("other" + std::to_string(i));
+    }
+    ASSERT_TRUE(hll.merge(other));
+    EXPECT_NEAR(hll.estimate(), 150100, 150100 * 0.05);
+    EXPECT_FALSE(hll.merge(plugin::anomalydetection::num::hll(10)));
+
+    hll.reset();
+    EXPECT_EQ(hll.estimate(), 0);
+
+    // Precision is clamped to the supported range
+    EXPECT_EQ(plugin::anomalydetection::num::hll(1).get_precision(), plugin::anomalydetection::num::hll::MIN_PRECISION);
+    EXPECT_EQ(plugin::anomalydetection::num::hll(30).get_precision(), plugin::anomalydetection::num::hll::MAX_PRECISION);
+}
@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/cms.h>
+#include <num/cms_window.h>
+#include <num/sketch.h>
+#include <num/partitioned_sketch.h>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_partitioned_sketch)
+{
+    namespace num = plugin::anomalydetection::num;
+    size_t allocated = 0;
+    num::partitioned_sketch partitioned([&allocated]() {
+        allocated++;
+        return std::make_shared<num::sketch_impl<num::cms<uint32_t>>>((uint64_t)3, (uint64_t)512);
+    }, 2, 1000);
+    auto hash = num::sketch::hash("falco");
+
+    // A noisy partition does not raise the counts of a quiet one
+    partitioned.update(1, hash, 100, 0);
+    partitioned.update(2, hash, 1, 10);
+    EXPECT_EQ(partitioned.estimate(1, hash), 100);
+    EXPECT_EQ(partitioned.estimate(2, hash), 1);
+    EXPECT_EQ(partitioned.estimate(3, hash), 0);
+    EXPECT_EQ(partitioned.get_partitions(), 2);
+
+    // The least recently updated partition makes room, its sketch is reset and reused
+    partitioned.update(1, hash, 1, 20);
+    partitioned.update(3, hash, 5, 30);
+    EXPECT_EQ(partitioned.get_partitions(), 2);
+    EXPECT_EQ(partitioned.get_evictions(), 1);
+    EXPECT_EQ(partitioned.estimate(1, hash), 101);
+    EXPECT_EQ(partitioned.estimate(2, hash), 0);
+    EXPECT_EQ(partitioned.estimate(3, hash), 5);
+    EXPECT_EQ(allocated, 2);
+    EXPECT_EQ(partitioned.get_size_bytes(), 2 * 3 * 512 * sizeof(uint32_t));
+
+    // TTL eviction of idle partitions
+    EXPECT_EQ(partitioned.evict_expired(1025), 1);
+    EXPECT_EQ(partitioned.estimate(1, hash), 0);
+    EXPECT_EQ(partitioned.estimate(3, hash), 5);
+    partitioned.update(4, hash, 1, 1030);
+    EXPECT_EQ(allocated, 2);
+
+    // Rotations are only requested, each partition applies them when next touched
+    partitioned.rotate();
+    EXPECT_EQ(partitioned.estimate(3, hash), 0);
+    partitioned.update(4, hash, 2, 1040);
+    EXPECT_EQ(partitioned.estimate(4, hash), 2);
+
+    // Idle partitions expire as the writer goes, measured in event time
+    partitioned.update(3, hash, 1, 2050);
+    EXPECT_EQ(partitioned.get_partitions(), 1);
+    EXPECT_EQ(partitioned.estimate(4, hash), 0);
+
+    // Evicted sketches are reset off the writer and reused
+    partitioned.reset();
+    EXPECT_EQ(partitioned.get_partitions(), 0);
+    partitioned.reset_evicted();
+    partitioned.update(5, hash, 1, 2060);
+    EXPECT_EQ(partitioned.estimate(5, hash), 1);
+    EXPECT_EQ(allocated, 2);
+    EXPECT_EQ(partitioned.get_size_bytes(), 2 * 3 * 512 * sizeof(uint32_t));
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_partitioned_sketch_window)
+{
+    namespace num = plugin::anomalydetection::num;
+    num::partitioned_sketch partitioned([]() {
+        return std::make_shared<num::sketch_impl<num::cms_window<uint32_t>>>((uint64_t)3, (uint64_t)512, (uint32_t)4);
+    }, 4);
+    auto hash = num::sketch::hash("falco");
+
+    // A partition idle for a few rotations catches up at once, keeping its unexpired slices
+    partitioned.update(1, hash, 3, 0);
+    partitioned.rotate();
+    partitioned.update(1, hash, 2, 0);
+    partitioned.rotate();
+    partitioned.rotate();
+    EXPECT_EQ(partitioned.estimate(1, hash), 5);
+    partitioned.rotate();
+    EXPECT_EQ(partitioned.estimate(1, hash), 2);
+    partitioned.rotate();
+    partitioned.rotate();
+    partitioned.rotate();
+    partitioned.rotate();
+    EXPECT_EQ(partitioned.estimate(1, hash), 0);
+}
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/profile_hasher.h>
+
+#include <string>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_profile_hasher)
+{
+    namespace num = plugin::anomalydetection::num;
+    num::profile_hasher hasher;
+    hasher.update("bash");
+    hasher.update("/usr/bin/bash");
+    auto hash = hasher.digest();
+    EXPECT_EQ(hasher.get_length(), 17);
+
+    // Same as hashing the separator terminated fields at once
+    std::string concat("bash\0/usr/bin/bash\0", 19);
+    auto expected = XXH3_128bits(concat.data(), concat.size());
+    EXPECT_EQ(hash.low64, expected.low64);
+    EXPECT_EQ(hash.high64, expected.high64);
+
+    // Shifting characters between adjacent fields changes the hash
+    hasher.reset();
+    hasher.update("bash/");
+    hasher.update("usr/bin/bash");
+    EXPECT_EQ(hasher.get_length(), 17);
+    EXPECT_NE(hasher.digest().low64, hash.low64);
+}
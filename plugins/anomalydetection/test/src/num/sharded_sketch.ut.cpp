@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/cms.h>
+#include <num/sketch.h>
+#include <num/sharded_sketch.h>
+#include <num/topk.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_sharded_sketch)
+{
+    namespace num = plugin::anomalydetection::num;
+    num::cms_options options;
+    options.concurrency = num::cms_concurrency::SINGLE_WRITER;
+    num::sharded_sketch sharded([&options]() {
+        return std::make_shared<num::sketch_impl<num::cms<uint32_t>>>((uint64_t)3, (uint64_t)256, options);
+    }, 4, 64);
+    EXPECT_EQ(sharded.get_shards(), 4);
+    EXPECT_EQ(sharded.get_d(), 3);
+    EXPECT_EQ(sharded.get_w(), 4 * 256);
+
+    // More updates than the queues hold, the producer waits for the workers instead of dropping
+    const uint64_t keys = 64;
+    const uint64_t rounds = 50;
+    for (uint64_t round = 0; round < rounds; ++round)
+    {
+        for (uint64_t key = 0; key < keys; ++key)
+        {
+            sharded.update(std::to_string(key), 1);
+        }
+    }
+    sharded.flush();
+    EXPECT_EQ(sharded.get_pending(), 0);
+    for (uint64_t key = 0; key < keys; ++key)
+    {
+        EXPECT_GE(sharded.estimate(std::to_string(key)), rounds);
+    }
+    EXPECT_EQ(sharded.estimate("never seen"), 0);
+    EXPECT_EQ(sharded.get_stats().total, keys * rounds);
+
+    // Read your writes without waiting for the workers, the queued updates are counted too
+    std::this_thread::sleep_for(std::chrono::milliseconds(20)); // Workers park
+    auto hash = num::sketch::hash("falco");
+    sharded.update(hash, 7);
+    EXPECT_GE(sharded.estimate_with_queued(hash), 7);
+    uint64_t exact[16] = {};
+    uint64_t under = 0;
+    for (uint64_t n = 0; n < 20000; ++n)
+    {
+        std::string key = "key" + std::to_string(n % 16);
+        sharded.update(key, 1);
+        exact[n % 16]++;
+        under += sharded.estimate_with_queued(num::sketch::hash(key)) < exact[n % 16] ? 1 : 0;
+    }
+    EXPECT_EQ(under, 0);
+    sharded.flush();
+    EXPECT_GE(sharded.estimate(hash), 7);
+
+    // One snapshot file per shard, restored all or nothing
+    std::string path = ::testing::TempDir() + "sharded_sketch.cms";
+    ASSERT_TRUE(sharded.save_snapshot(path, 42));
+    sharded.reset();
+    EXPECT_EQ(sharded.estimate(hash), 0);
+    EXPECT_FALSE(sharded.load_snapshot(path, 43));
+    EXPECT_TRUE(sharded.load_snapshot(path, 42));
+    EXPECT_GE(sharded.estimate(hash), 7);
+    std::remove(num::sharded_sketch::get_shard_path(path, 3).c_str());
+    sharded.reset();
+    EXPECT_FALSE(sharded.load_snapshot(path, 42));
+    EXPECT_EQ(sharded.estimate(hash), 0);
+    for (size_t j = 0; j < 3; ++j)
+    {
+        std::remove(num::sharded_sketch::get_shard_path(path, j).c_str());
+    }
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_sharded_sketch_topk)
+{
+    namespace num = plugin::anomalydetection::num;
+    num::cms_options options;
+    options.concurrency = num::cms_concurrency::SINGLE_WRITER;
+    // A queue this small is mostly full, the estimates count the queued updates without scanning or waiting
+    const size_t queue_capacity = 64;
+    num::sharded_sketch sharded([&options]() {
+        return std::make_shared<num::sketch_impl<num::cms<uint32_t>>>((uint64_t)3, (uint64_t)4096, options);
+    }, 2, queue_capacity);
+    sharded.enable_topk(4, 0);
+    auto* topk = sharded.get_topk();
+
+    // Key j occurs 8 (j + 1) times per round, tracked the way the plugin does on every event. The frequencies are
+    // further apart than the over count bound, so the order of the top keys is exact
+    const uint64_t keys = 16;
+    std::vector<uint64_t> exact(keys, 0);
+    uint64_t under = 0;
+    uint64_t max_over = 0;
+    for (uint64_t round = 0; round < 10; ++round)
+    {
+        for (uint64_t key = 0; key < keys; ++key)
+        {
+            auto hash = num::sketch::hash("key" + std::to_string(key));
+            for (uint64_t j = 0; j < 8 * (key + 1); ++j)
+            {
+                uint64_t count = sharded.estimate_with_queued(hash) + 1;
+                under += count < exact[key] + 1 ? 1 : 0;
+                max_over = std::max(max_over, count - (exact[key] + 1));
+                if (!topk->update(hash, count) && topk->admits(count))
+                {
+                    topk->insert(hash, count, "key" + std::to_string(key));
+                }
+                sharded.update(hash, 1);
+                exact[key]++;
+            }
+        }
+    }
+    EXPECT_EQ(under, 0);
+    // Over counts are bounded by the updates queued at once, not by the stream length
+    EXPECT_LE(max_over, 2 * queue_capacity);
+    auto top = topk->get_top();
+    ASSERT_EQ(top.size(), 4);
+    for (size_t i = 0; i < top.size(); ++i)
+    {
+        EXPECT_EQ(top[i].label, "key" + std::to_string(keys - 1 - i));
+    }
+    sharded.flush();
+    EXPECT_EQ(sharded.get_pending(), 0);
+}
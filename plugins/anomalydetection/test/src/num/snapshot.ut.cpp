@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/cms.h>
+#include <num/cms_window.h>
+#include <num/sketch.h>
+#include <num/snapshot.h>
+
+#include <cstdio>
+#include <filesystem>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_snapshot)
+{
+    namespace num = plugin::anomalydetection::num;
+    std::string path = (std::filesystem::temp_directory_path() / "anomalydetection_snapshot.ut.cms").string();
+    uint64_t fingerprint = 42;
+    std::string test_str = "falco";
+
+    num::cms<uint32_t> cms((uint64_t)3, (uint64_t)1000);
+    cms.update(test_str, 7);
+    ASSERT_TRUE(num::save_snapshot(cms, path, fingerprint));
+
+    // Warm restart into a sketch of the same type, dimensions and behavior profile
+    num::cms<uint32_t> restored((uint64_t)3, (uint64_t)1000);
+    ASSERT_TRUE(num::load_snapshot(restored, path, fingerprint));
+    EXPECT_EQ(restored.estimate(test_str), 7);
+
+    // Any mismatch leaves the sketch untouched
+    num::cms<uint32_t> other_profile((uint64_t)3, (uint64_t)1000);
+    EXPECT_FALSE(num::load_snapshot(other_profile, path, fingerprint + 1));
+    EXPECT_EQ(other_profile.estimate(test_str), 0);
+    num::cms<uint32_t> other_dims((uint64_t)3, (uint64_t)1001);
+    EXPECT_FALSE(num::load_snapshot(other_dims, path, fingerprint));
+    num::cms<uint64_t> other_counters((uint64_t)3, (uint64_t)1000);
+    EXPECT_FALSE(num::load_snapshot(other_counters, path, fingerprint));
+    EXPECT_FALSE(num::load_snapshot(restored, path + ".missing", fingerprint));
+
+    // Sliding windows keep the age of their slices
+    num::cms_window<uint32_t> window((uint64_t)3, (uint64_t)1000, 4);
+    window.update(test_str, 1);
+    window.rotate();
+    window.update(test_str, 2);
+    ASSERT_TRUE(num::save_snapshot(window, path, fingerprint));
+    num::cms_window<uint32_t> restored_window((uint64_t)3, (uint64_t)1000, 4);
+    ASSERT_TRUE(num::load_snapshot(restored_window, path, fingerprint));
+    EXPECT_EQ(restored_window.estimate(test_str), 3);
+    restored_window.rotate();
+    restored_window.rotate();
+    restored_window.rotate();
+    EXPECT_EQ(restored_window.estimate(test_str), 2);
+
+    // Type-erased sketches
+    num::sketch_impl<num::cms<uint8_t>> sketch((uint64_t)3, (uint64_t)1000);
+    sketch.update(test_str, 300);
+    ASSERT_TRUE(sketch.save_snapshot(path, fingerprint));
+    num::sketch_impl<num::cms<uint8_t>> restored_sketch((uint64_t)3, (uint64_t)1000);
+    ASSERT_TRUE(restored_sketch.load_snapshot(path, fingerprint));
+    EXPECT_EQ(restored_sketch.estimate(test_str), 255);
+
+    std::remove(path.c_str());
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_snapshot_merge)
+{
+    namespace num = plugin::anomalydetection::num;
+    auto dir = std::filesystem::temp_directory_path();
+    std::vector<std::string> chunks = {(dir / "anomalydetection_merge_0.ut.cms").string(), (dir / "anomalydetection_merge_1.ut.cms").string()};
+    std::string merged_path = (dir / "anomalydetection_merge.ut.cms").string();
+    uint64_t fingerprint = 42;
+
+    // Sketches learned on disjoint chunks of the events add up to the sketch of all events
+    num::cms<uint16_t> chunk0((uint64_t)3, (uint64_t)1000);
+    num::cms<uint16_t> chunk1((uint64_t)3, (uint64_t)1000);
+    chunk0.update("falco", 7);
+    chunk0.update("saturated", 60000);
+    chunk1.update("falco", 5);
+    chunk1.update("sysdig", 1);
+    chunk1.update("saturated", 60000);
+    ASSERT_TRUE(num::save_snapshot(chunk0, chunks[0], fingerprint));
+    ASSERT_TRUE(num::save_snapshot(chunk1, chunks[1], fingerprint));
+    ASSERT_TRUE(num::merge_snapshots(chunks, merged_path));
+
+    num::cms<uint16_t> merged((uint64_t)3, (uint64_t)1000);
+    ASSERT_TRUE(num::load_snapshot(merged, merged_path, fingerprint));
+    EXPECT_EQ(merged.estimate("falco"), 12);
+    EXPECT_EQ(merged.estimate("sysdig"), 1);
+    EXPECT_EQ(merged.estimate("saturated"), 65535);
+
+    // Nothing is written unless all chunks were learned for the same behavior profile and dimensions
+    std::remove(merged_path.c_str());
+    ASSERT_TRUE(num::save_snapshot(chunk1, chunks[1], fingerprint + 1));
+    EXPECT_FALSE(num::merge_snapshots(chunks, merged_path));
+    num::cms<uint16_t> other_dims((uint64_t)3, (uint64_t)1001);
+    ASSERT_TRUE(num::save_snapshot(other_dims, chunks[1], fingerprint));
+    EXPECT_FALSE(num::merge_snapshots(chunks, merged_path));
+    EXPECT_FALSE(num::merge_snapshots({chunks[0], chunks[0] + ".missing"}, merged_path));
+    EXPECT_FALSE(num::merge_snapshots({}, merged_path));
+    EXPECT_FALSE(std::filesystem::exists(merged_path));
+
+    for (const auto& chunk : chunks)
+    {
+        std::remove(chunk.c_str());
+    }
+}
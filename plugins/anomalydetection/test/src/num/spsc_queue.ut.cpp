@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/spsc_queue.h>
+
+#include <thread>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_spsc_queue)
+{
+    namespace num = plugin::anomalydetection::num;
+    num::spsc_queue<uint64_t> queue(3);
+    EXPECT_EQ(queue.capacity(), 4);
+    EXPECT_TRUE(queue.empty());
+
+    uint64_t out[8];
+    EXPECT_EQ(queue.pop_batch(out, 8), 0);
+    for (uint64_t i = 0; i < 4; ++i)
+    {
+        EXPECT_TRUE(queue.try_push(i));
+    }
+    EXPECT_FALSE(queue.try_push(4));
+    EXPECT_EQ(queue.size(), 4);
+    EXPECT_EQ(queue.pop_batch(out, 3), 3);
+    EXPECT_EQ(out[0], 0);
+    EXPECT_EQ(out[2], 2);
+
+    // Wraps around
+    EXPECT_TRUE(queue.try_push(4));
+    EXPECT_TRUE(queue.try_push(5));
+    EXPECT_EQ(queue.pop_batch(out, 8), 3);
+    EXPECT_EQ(out[0], 3);
+    EXPECT_EQ(out[2], 5);
+    EXPECT_TRUE(queue.empty());
+
+    // Values arrive complete and in order across threads
+    num::spsc_queue<uint64_t> shared(64);
+    const uint64_t n = 20000;
+    std::thread producer([&shared, n]() {
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            while (!shared.try_push(i))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint64_t expected = 0;
+    bool ordered = true;
+    while (expected < n)
+    {
+        size_t m = shared.pop_batch(out, 8);
+        if (m == 0)
+        {
+            std::this_thread::yield();
+        }
+        for (size_t i = 0; i < m; ++i)
+        {
+            ordered = ordered && out[i] == expected;
+            expected++;
+        }
+    }
+    producer.join();
+    EXPECT_TRUE(ordered);
+    EXPECT_TRUE(shared.empty());
+}
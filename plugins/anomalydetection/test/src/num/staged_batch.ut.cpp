@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/sketch.h>
+#include <num/staged_batch.h>
+
+#include <string>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_staged_batch)
+{
+    namespace num = plugin::anomalydetection::num;
+    num::staged_batch batch(16);
+    EXPECT_TRUE(batch.empty());
+    auto a = num::sketch::hash("a");
+    auto b = num::sketch::hash("b");
+    EXPECT_EQ(batch.count(a), 0);
+
+    // Occurrences per hash, the hashes stay in staging order for `update_batch`
+    batch.push(a);
+    batch.push(b);
+    batch.push(a);
+    EXPECT_EQ(batch.size(), 3);
+    EXPECT_EQ(batch.count(a), 2);
+    EXPECT_EQ(batch.count(b), 1);
+    EXPECT_EQ(batch.data()[1].low64, b.low64);
+
+    batch.clear();
+    EXPECT_TRUE(batch.empty());
+    EXPECT_EQ(batch.count(a), 0);
+    EXPECT_EQ(batch.count(b), 0);
+
+    // A full batch of distinct hashes, counted exactly with colliding probe slots
+    for (int i = 0; i < 16; ++i)
+    {
+        batch.push(num::sketch::hash(std::to_string(i)));
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+        EXPECT_EQ(batch.count(num::sketch::hash(std::to_string(i))), 1);
+    }
+    EXPECT_EQ(batch.count(a), 0);
+}
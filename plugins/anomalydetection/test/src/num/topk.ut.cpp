@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/cms.h>
+#include <num/sketch.h>
+#include <num/topk.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_topk)
+{
+    namespace num = plugin::anomalydetection::num;
+    num::sketch_impl<num::cms<uint64_t>> sketch((uint64_t)5, (uint64_t)2000);
+    sketch.enable_topk(3, 2);
+    auto* topk = sketch.get_topk();
+    ASSERT_NE(topk, nullptr);
+
+    // Feed the tracking the same way the plugin does, with the sketch estimates
+    auto observe = [&](const std::string& label)
+    {
+        auto hash = num::sketch::hash(label);
+        uint64_t count = sketch.estimate(hash) + 1;
+        if (count == 1)
+        {
+            topk->insert_rare(hash, label);
+        }
+        if (!topk->update(hash, count) && topk->admits(count))
+        {
+            topk->insert(hash, count, label);
+        }
+        sketch.update(hash, 1);
+    };
+    for (int i = 0; i < 10; ++i)
+    {
+        for (int j = 0; j <= i; ++j)
+        {
+            observe("frequent" + std::to_string(i));
+        }
+    }
+    observe("rare1");
+    observe("rare2");
+    observe("rare3");
+
+    auto top = topk->get_top();
+    ASSERT_EQ(top.size(), 3);
+    EXPECT_EQ(top[0].label, "frequent9");
+    EXPECT_EQ(top[0].count, 10);
+    EXPECT_EQ(top[1].label, "frequent8");
+    EXPECT_EQ(top[2].label, "frequent7");
+
+    auto rare = topk->get_rare();
+    ASSERT_EQ(rare.size(), 2);
+    EXPECT_EQ(rare[0].label, "rare3");
+    EXPECT_EQ(rare[1].label, "rare2");
+
+    // Cleared together with the counts
+    sketch.rotate();
+    EXPECT_TRUE(topk->get_top().empty());
+    EXPECT_TRUE(topk->get_rare().empty());
+    EXPECT_TRUE(topk->admits(1));
+
+    num::topk disabled(0, 0);
+    EXPECT_FALSE(disabled.admits(100));
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_topk_heap)
+{
+    namespace num = plugin::anomalydetection::num;
+    // Item j occurs j + 1 times, interleaved, with exact counts the tracked items end up being the true top k
+    const uint32_t n = 200;
+    const size_t k = 16;
+    num::topk topk(k, 0);
+    std::vector<uint32_t> stream;
+    for (uint32_t j = 0; j < n; ++j)
+    {
+        stream.insert(stream.end(), j + 1, j);
+    }
+    std::mt19937 rng(7);
+    std::shuffle(stream.begin(), stream.end(), rng);
+    std::vector<uint64_t> counts(n, 0);
+    for (uint32_t j : stream)
+    {
+        auto hash = num::sketch::hash("item" + std::to_string(j));
+        uint64_t count = ++counts[j];
+        if (!topk.update(hash, count) && topk.admits(count))
+        {
+            topk.insert(hash, count, "item" + std::to_string(j));
+        }
+    }
+    auto top = topk.get_top();
+    ASSERT_EQ(top.size(), k);
+    for (size_t i = 0; i < k; ++i)
+    {
+        EXPECT_EQ(top[i].label, "item" + std::to_string(n - 1 - i));
+        EXPECT_EQ(top[i].count, n - i);
+    }
+    EXPECT_FALSE(topk.admits(n - k));
+    EXPECT_TRUE(topk.admits(n - k + 2));
+}
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_topk_concurrent)
+{
+    namespace num = plugin::anomalydetection::num;
+    num::topk topk(4, 4);
+    std::atomic<bool> done{false};
+
+    // Readers and clears from other threads, the event parsing thread is the only writer
+    std::thread reader([&]()
+    {
+        while (!done)
+        {
+            for (const auto& i : topk.get_top())
+            {
+                EXPECT_FALSE(i.label.empty());
+            }
+            EXPECT_LE(topk.get_rare().size(), 4);
+        }
+    });
+    std::thread clearer([&]()
+    {
+        for (int i = 0; i < 100 && !done; ++i)
+        {
+            topk.clear();
+            std::this_thread::yield();
+        }
+    });
+    for (uint64_t n = 1; n <= 20000; ++n)
+    {
+        std::string label = "item" + std::to_string(n % 16);
+        auto hash = num::sketch::hash(label);
+        if (n <= 16)
+        {
+            topk.insert_rare(hash, label);
+        }
+        if (!topk.update(hash, n) && topk.admits(n))
+        {
+            topk.insert(hash, n, label);
+        }
+    }
+    done = true;
+    reader.join();
+    clearer.join();
+
+    // A clear requested after the last write is applied by the next write and hides the items until then
+    topk.clear();
+    EXPECT_TRUE(topk.get_top().empty());
+    EXPECT_TRUE(topk.admits(1));
+    topk.insert(num::sketch::hash("a"), 1, "a");
+    EXPECT_EQ(topk.get_top().size(), 1);
+}
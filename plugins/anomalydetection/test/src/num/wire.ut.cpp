@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <num/cms.h>
+#include <num/cms_window.h>
+#include <num/wire.h>
+
+TEST(plugin_anomalydetection, plugin_anomalydetection_merge)
+{
+    namespace num = plugin::anomalydetection::num;
+    uint64_t fingerprint = 42;
+    std::string common_str = "falco";
+    std::string rare_str = "sysdig";
+
+    num::cms<uint32_t> node1((uint64_t)3, (uint64_t)1000);
+    num::cms<uint32_t> node2((uint64_t)3, (uint64_t)1000);
+    node1.update(common_str, 5);
+    node2.update(common_str, 7);
+    node2.update(rare_str, 1);
+
+    // Sketches are linear, merging adds up the counts
+    num::cms<uint32_t> merged = node1;
+    ASSERT_TRUE(merged.merge(node2));
+    EXPECT_EQ(merged.estimate(common_str), 12);
+    EXPECT_EQ(merged.estimate(rare_str), 1);
+    num::cms<uint32_t> other_dims((uint64_t)3, (uint64_t)1001);
+    EXPECT_FALSE(merged.merge(other_dims));
+
+    // Compact wire format only encodes the non-zero counters
+    std::string wire1 = num::serialize(node1, fingerprint);
+    std::string wire2 = num::serialize(node2, fingerprint);
+    EXPECT_LT(wire2.size(), sizeof(num::wire_header) + 2 * 3 * 4);
+    num::cms<uint64_t> fleet((uint64_t)3, (uint64_t)1000);
+    ASSERT_TRUE(num::merge_serialized(fleet, wire1, fingerprint));
+    ASSERT_TRUE(num::merge_serialized(fleet, wire2, fingerprint));
+    EXPECT_EQ(fleet.estimate(common_str), 12);
+    EXPECT_EQ(fleet.estimate(rare_str), 1);
+
+    // Mismatching profiles and malformed input are rejected without side effects
+    EXPECT_FALSE(num::merge_serialized(fleet, wire1, fingerprint + 1));
+    EXPECT_FALSE(num::merge_serialized(fleet, wire1.substr(0, wire1.size() - 1), fingerprint));
+    EXPECT_EQ(fleet.estimate(common_str), 12);
+
+    // Sliding windows are exchanged as the sum of their slices
+    num::cms_window<uint32_t> window((uint64_t)3, (uint64_t)1000, 4);
+    window.update(common_str, 1);
+    window.rotate();
+    window.update(common_str, 2);
+    ASSERT_TRUE(num::merge_serialized(fleet, num::serialize(window, fingerprint), fingerprint));
+    EXPECT_EQ(fleet.estimate(common_str), 15);
+}
@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: Apache-2.0
+/*
+Copyright (C) 2024 The Falco Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+Offline baseline training: replays captures through the plugin's event parsing as fast as they can be read and writes
+the sketch snapshots the live plugin warm restarts from (`count_min_sketch.snapshot_dir`).
+
+Each capture file is one chunk, typically the time rotated files of one long capture, each starting with a dump of the
+machine state. Chunks are replayed in parallel, each by its own inspector and plugin instance learning into its own
+snapshot directory. The per-chunk snapshots are then summed into the output directory.
+*/
+
+#include <libsinsp/sinsp.h>
+#include <nlohmann/json.hpp>
+#include <num/snapshot.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+namespace num = plugin::anomalydetection::num;
+
+struct train_options
+{
+    std::string plugin_path = ANOMALYDETECTION_PLUGIN_PATH;
+    std::string config_path; // JSON init config of the plugin, the behavior profiles and sketch options must match the live config
+    std::string output_dir;
+    uint32_t threads = std::max<uint32_t>(1, std::thread::hardware_concurrency());
+    std::vector<std::string> captures;
+};
+
+static void usage()
+{
+    fprintf(stderr,
+        "Usage: anomalydetection-train --config <init_config.json> --output <snapshot_dir> [--plugin <libanomalydetection.so>] [--threads <n>] <capture.scap>...\n"
+        "Replays each capture (chunk) through the plugin in parallel and writes the summed sketch snapshots to <snapshot_dir>.\n");
+}
+
+static bool parse_args(int argc, char** argv, train_options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--config" && has_value)
+        {
+            options.config_path = argv[++i];
+        } else if (arg == "--output" && has_value)
+        {
+            options.output_dir = argv[++i];
+        } else if (arg == "--plugin" && has_value)
+        {
+            options.plugin_path = argv[++i];
+        } else if (arg == "--threads" && has_value)
+        {
+            options.threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg.rfind("--", 0) == 0)
+        {
+            return false;
+        } else
+        {
+            options.captures.push_back(arg);
+        }
+    }
+    return !options.config_path.empty() && !options.output_dir.empty() && !options.captures.empty();
+}
+
+// Replay one chunk and return its number of events, the plugin persists its sketches once the inspector destroys it
+static uint64_t replay_chunk(const std::string& plugin_path, const std::string& config, const std::string& capture)
+{
+    sinsp inspector;
+    auto plugin = inspector.register_plugin(plugin_path);
+    std::string err;
+    if (!plugin->init(config, err))
+    {
+        throw std::runtime_error("cannot init the plugin: " + err);
+    }
+    inspector.open_savefile(capture);
+    uint64_t n = 0;
+    sinsp_evt* evt = nullptr;
+    while (true)
+    {
+        int32_t res = inspector.next(&evt);
+        if (res == SCAP_EOF)
+        {
+            break;
+        }
+        if (res == SCAP_TIMEOUT || res == SCAP_FILTERED_EVENT)
+        {
+            continue;
+        }
+        if (res != SCAP_SUCCESS)
+        {
+            throw std::runtime_error(inspector.getlasterr());
+        }
+        n++;
+    }
+    inspector.close();
+    return n;
+}
+
+// Sum the snapshots of all chunks into `output_dir`, one merge per snapshot file (behavior profile or shard)
+static bool merge_chunks(const std::vector<std::string>& chunk_dirs, const std::string& output_dir)
+{
+    bool ok = true;
+    size_t merged = 0;
+    for (const auto& entry : fs::directory_iterator(chunk_dirs[0]))
+    {
+        std::string name = entry.path().filename().string();
+        if (!entry.is_regular_file() || entry.path().extension() == ".tmp")
+        {
+            continue;
+        }
+        std::vector<std::string> inputs;
+        for (const auto& dir : chunk_dirs)
+        {
+            inputs.push_back(dir + "/" + name);
+        }
+        if (num::merge_snapshots(inputs, output_dir + "/" + name))
+        {
+            merged++;
+        } else
+        {
+            fprintf(stderr, "failed to merge the chunk snapshots of (%s)\n", name.c_str());
+            ok = false;
+        }
+    }
+    printf("merged (%zu) snapshots of (%zu) chunks into (%s)\n", merged, chunk_dirs.size(), output_dir.c_str());
+    return ok && merged > 0;
+}
+
+int main(int argc, char** argv)
+{
+    train_options options;
+    if (!parse_args(argc, argv, options))
+    {
+        usage();
+        return 1;
+    }
+
+    nlohmann::json config;
+    try
+    {
+        std::ifstream in(options.config_path);
+        config = nlohmann::json::parse(in);
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "cannot read the init config (%s): %s\n", options.config_path.c_str(), e.what());
+        return 1;
+    }
+    if (!config.contains("count_min_sketch") || !config["count_min_sketch"].value("enabled", false))
+    {
+        fprintf(stderr, "the init config does not enable count_min_sketch, nothing to train\n");
+        return 1;
+    }
+
+    /*
+    Each chunk learns into its own snapshot directory, without periodic snapshots or fleet exchanges. The wall clock
+    driven resets and window rotations are disabled too, a replay would otherwise keep a tail of the capture that depends
+    on the disk speed. Sketch types and slices stay configured, so the snapshots match the live sketches.
+    */
+    std::string chunks_root = options.output_dir + "/.chunks";
+    std::vector<std::string> chunk_dirs;
+    std::vector<std::string> chunk_configs;
+    for (size_t k = 0; k < options.captures.size(); ++k)
+    {
+        chunk_dirs.push_back(chunks_root + "/" + std::to_string(k));
+        fs::create_directories(chunk_dirs.back());
+        auto chunk_config = config;
+        chunk_config["count_min_sketch"]["snapshot_dir"] = chunk_dirs.back();
+        chunk_config["count_min_sketch"].erase("snapshot_interval_ms");
+        chunk_config["count_min_sketch"].erase("fleet_dir");
+        chunk_config["count_min_sketch"]["periodic_workers"] = false;
+        chunk_configs.push_back(chunk_config.dump());
+    }
+
+    std::atomic<size_t> next_chunk{0};
+    std::atomic<bool> failed{false};
+    std::mutex log_mutex;
+    auto worker = [&]()
+    {
+        for (size_t k = next_chunk++; k < options.captures.size(); k = next_chunk++)
+        {
+            const auto& capture = options.captures[k];
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                uint64_t n = replay_chunk(options.plugin_path, chunk_configs[k], capture);
+                double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                std::lock_guard<std::mutex> lock(log_mutex);
+                printf("replayed (%s): (%lu) events in (%.1f) s, (%.0f) events/s\n", capture.c_str(), (unsigned long)n, s, s > 0 ? n / s : 0.0);
+            }
+            catch (const std::exception& e)
+            {
+                failed = true;
+                std::lock_guard<std::mutex> lock(log_mutex);
+                fprintf(stderr, "failed to replay (%s): %s\n", capture.c_str(), e.what());
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < std::min<size_t>(options.threads, options.captures.size()); ++t)
+    {
+        workers.emplace_back(worker);
+    }
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+
+    // A partial baseline would under count, nothing is written unless all chunks were replayed
+    bool ok = !failed && merge_chunks(chunk_dirs, options.output_dir);
+    std::error_code ec;
+    fs::remove_all(chunks_root, ec);
+    return ok ? 0 : 1;
+}